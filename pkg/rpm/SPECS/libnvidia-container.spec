@@ -85,6 +85,13 @@ This package contains command-line tools that facilitate using the library.
 %{_bindir}/*
 
 %changelog
+* Fri Oct 16 2026 NVIDIA CORPORATION <cudatools@nvidia.com> 1.1.0-0.1.alpha.1
+- Add flag-based constructors and lazy device attribute queries
+- Add device lookup by UUID or PCI bus ID
+- Add asynchronous ldcache updates and nvc_driver_unmount
+- Add published driver information images and driver watches
+- Add driver statistics and device property queries
+
 * Wed Jan 10 2018 NVIDIA CORPORATION <cudatools@nvidia.com> 1.0.0-0.1.alpha.3
 - d268f8f Improve error message if driver installed in the container
 - 3fdac29 Add optional support for libelf from the elfutils project
@@ -27,11 +27,13 @@ struct context {
         gid_t gid;
         char *ldcache;
         bool load_kmods;
-        char *init_flags;
+        uint32_t init_flags;
         const struct command *command;
 
-        /* info */
+        /* info, stats */
         bool csv_output;
+        bool publish;
+        size_t repeat;
 
         /* configure */
         pid_t pid;
@@ -39,7 +41,10 @@ struct context {
         char *reqs[32];
         size_t nreqs;
         char *ldconfig;
-        char *container_flags;
+        uint32_t container_flags;
+        char *batch;
+        size_t jobs;
+        char *cache_dir;
 
         /* list */
         bool compat32;
@@ -47,18 +52,26 @@ struct context {
         bool list_libs;
         bool list_ipcs;
 
+        /* log-decode */
+        char *log_file;
+
         char *devices;
 };
 
-int select_devices(struct error *, char *, const struct nvc_device *[],
-    const struct nvc_device [], size_t);
+bool devices_resolvable(const char *);
+int select_devices(struct error *, struct nvc_context *, char *, struct nvc_device *[],
+    struct nvc_device [], size_t);
 
 extern const struct argp info_usage;
 extern const struct argp list_usage;
 extern const struct argp configure_usage;
+extern const struct argp stats_usage;
+extern const struct argp log_decode_usage;
 
 int info_command(const struct context *);
 int list_command(const struct context *);
 int configure_command(const struct context *);
+int stats_command(const struct context *);
+int log_decode_command(const struct context *);
 
 #endif /* HEADER_CLI_H */
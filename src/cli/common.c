@@ -3,15 +3,62 @@
  */
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "cli.h"
 
+#define UUID_LEN (sizeof("GPU-xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx") - 1)
+
+static int parse_busid(const char *, unsigned int [4]);
+
+/* Parse a PCI bus ID of the form [domain:]bus:device.function. */
+static int
+parse_busid(const char *str, unsigned int loc[4])
+{
+        int n;
+
+        loc[0] = 0;
+        if (sscanf(str, "%x:%x:%x.%x%n", &loc[0], &loc[1], &loc[2], &loc[3], &n) == 4 && str[n] == '\0')
+                return (0);
+        if (sscanf(str, "%x:%x.%x%n", &loc[1], &loc[2], &loc[3], &n) == 3 && str[n] == '\0')
+                return (0);
+        return (-1);
+}
+
+/*
+ * Check whether all the devices given are full UUIDs or PCI bus IDs.
+ * If so, they can be looked up directly instead of enumerating all the devices with select_devices.
+ */
+bool
+devices_resolvable(const char *devs)
+{
+        const char *gpu, *end;
+        size_t len;
+        size_t n = 0;
+
+        for (gpu = devs; gpu != NULL && *gpu != '\0'; gpu = (*end != '\0') ? end + 1 : end) {
+                if ((end = strchr(gpu, ',')) == NULL)
+                        end = gpu + strlen(gpu);
+                if ((len = (size_t)(end - gpu)) == 0)
+                        continue;
+                if (!strncasecmp(gpu, "GPU-", strlen("GPU-")) && len == UUID_LEN)
+                        ++n;
+                else if (memchr(gpu, ':', len) != NULL)
+                        ++n;
+                else
+                        return (false);
+        }
+        return (n > 0);
+}
+
 int
-select_devices(struct error *err, char *devs, const struct nvc_device *selected[],
-    const struct nvc_device available[], size_t size)
+select_devices(struct error *err, struct nvc_context *nvc, char *devs, struct nvc_device *selected[],
+    struct nvc_device available[], size_t size)
 {
         char *gpu, *ptr;
+        const char *uuid, *busid;
+        unsigned int loc[4], dloc[4];
         size_t i;
         uintmax_t n;
 
@@ -25,7 +72,25 @@ select_devices(struct error *err, char *devs, const struct nvc_device *selected[
                 }
                 if (!strncasecmp(gpu, "GPU-", strlen("GPU-")) && strlen(gpu) > strlen("GPU-")) {
                         for (i = 0; i < size; ++i) {
-                                if (!strncasecmp(available[i].uuid, gpu, strlen(gpu))) {
+                                if ((uuid = nvc_device_get_uuid(nvc, &available[i])) == NULL) {
+                                        error_setx(err, "%s", nvc_error(nvc));
+                                        return (-1);
+                                }
+                                if (!strncasecmp(uuid, gpu, strlen(gpu))) {
+                                        selected[i] = &available[i];
+                                        goto next;
+                                }
+                        }
+                } else if (strchr(gpu, ':') != NULL) {
+                        /* Compare bus IDs numerically, the domain might be shortened or omitted. */
+                        if (parse_busid(gpu, loc) < 0)
+                                goto invalid;
+                        for (i = 0; i < size; ++i) {
+                                if ((busid = nvc_device_get_busid(nvc, &available[i])) == NULL) {
+                                        error_setx(err, "%s", nvc_error(nvc));
+                                        return (-1);
+                                }
+                                if (parse_busid(busid, dloc) == 0 && !memcmp(loc, dloc, sizeof(loc))) {
                                         selected[i] = &available[i];
                                         goto next;
                                 }
@@ -37,6 +102,7 @@ select_devices(struct error *err, char *devs, const struct nvc_device *selected[
                                 goto next;
                         }
                 }
+         invalid:
                 error_setx(err, "unknown device id: %s", gpu);
                 return (-1);
          next: ;
@@ -4,22 +4,38 @@
 
 #include <alloca.h>
 #include <err.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <stdlib.h>
 
 #include "cli.h"
 #include "dsl.h"
+#include "metrics.h"
+
+struct target {
+        pid_t pid;
+        char *rootfs;
+        struct nvc_container_config *cfg;
+        struct nvc_container *cnt;
+};
 
 static error_t configure_parser(int, char *, struct argp_state *);
-static int check_cuda_version(const struct dsl_data *, enum dsl_comparator, const char *);
-static int check_driver_version(const struct dsl_data *, enum dsl_comparator, const char *);
-static int check_device_arch(const struct dsl_data *, enum dsl_comparator, const char *);
+static int check_cuda_version(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_driver_version(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_device_arch(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_device_memory(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_device_brand(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_device_compute_mode(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+static int check_device_ecc(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
 static bool is_root_dir(const char *);
+static int load_targets(struct error *, const char *, char **, struct target **, size_t *);
+static int wait_jobs(struct nvc_context *, struct nvc_ldcache_job *[], size_t *, bool);
 
 const struct argp configure_usage = {
         (const struct argp_option[]){
                 {NULL, 0, NULL, 0, "Options:", -1},
                 {"pid", 'p', "PID", 0, "Container PID", -1},
-                {"device", 'd', "ID", 0, "Device UUID(s) or index(es) to isolate", -1},
+                {"device", 'd', "ID", 0, "Device UUID(s), PCI bus ID(s) or index(es) to isolate", -1},
                 {"require", 'r', "EXPR", 0, "Check container requirements", -1},
                 {"ldconfig", 'l', "PATH", 0, "Path to the ldconfig binary", -1},
                 {"compute", 'c', NULL, 0, "Enable compute capability", -1},
@@ -29,10 +45,13 @@ const struct argp configure_usage = {
                 {"compat32", 0x80, NULL, 0, "Enable 32bits compatibility", -1},
                 {"no-cgroups", 0x81, NULL, 0, "Don't use cgroup enforcement", -1},
                 {"no-devbind", 0x82, NULL, 0, "Don't bind mount devices", -1},
+                {"batch", 0x83, "FILE", 0, "Configure the containers listed in FILE (one \"PID ROOTFS\" per line)", -1},
+                {"jobs", 'j', "N", 0, "Number of ldconfig to run concurrently in batch mode", -1},
+                {"cache-dir", 0x84, "DIR", 0, "Reuse the DSO caches generated by ldconfig from DIR", -1},
                 {0},
         },
         configure_parser,
-        "ROOTFS",
+        "ROOTFS\n--batch=FILE",
         "Configure a container with GPU support by exposing device drivers to it.\n\n"
         "This command enters the namespace of the container process referred by PID (or the current parent process if none specified) "
         "and performs the necessary steps to ensure that the given capabilities are available inside the container.\n"
@@ -43,9 +62,13 @@ const struct argp configure_usage = {
 };
 
 static const struct dsl_rule rules[] = {
-        {"cuda", &check_cuda_version},
-        {"driver", &check_driver_version},
-        {"arch", &check_device_arch},
+        {"cuda", DSL_VERSION, &check_cuda_version, false},
+        {"driver", DSL_VERSION, &check_driver_version, false},
+        {"arch", DSL_VERSION, &check_device_arch, false},
+        {"memory", DSL_SIZE, &check_device_memory, true},
+        {"brand", DSL_STRING, &check_device_brand, true},
+        {"compute_mode", DSL_STRING, &check_device_compute_mode, true},
+        {"ecc", DSL_BOOL, &check_device_ecc, true},
 };
 
 static error_t
@@ -53,6 +76,8 @@ configure_parser(int key, char *arg, struct argp_state *state)
 {
         struct context *ctx = state->input;
         struct error err = {0};
+        uintmax_t n;
+        char *ptr;
 
         switch (key) {
         case 'p':
@@ -74,35 +99,41 @@ configure_parser(int key, char *arg, struct argp_state *state)
                 ctx->ldconfig = arg;
                 break;
         case 'c':
-                if (strjoin(&err, &ctx->container_flags, "compute", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_COMPUTE;
                 break;
         case 'u':
-                if (strjoin(&err, &ctx->container_flags, "utility", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_UTILITY;
                 break;
         case 'v':
-                if (strjoin(&err, &ctx->container_flags, "video", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_VIDEO;
                 break;
         case 'g':
-                if (strjoin(&err, &ctx->container_flags, "graphics", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_GRAPHICS;
                 break;
         case 0x80:
-                if (strjoin(&err, &ctx->container_flags, "compat32", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_COMPAT32;
                 break;
         case 0x81:
-                if (strjoin(&err, &ctx->container_flags, "no-cgroups", " ") < 0)
-                        goto fatal;
+                ctx->container_flags |= NVC_CONTAINER_NO_CGROUPS;
                 break;
         case 0x82:
-                if (strjoin(&err, &ctx->container_flags, "no-devbind", " ") < 0)
+                ctx->container_flags |= NVC_CONTAINER_NO_DEVBIND;
+                break;
+        case 0x83:
+                ctx->batch = arg;
+                break;
+        case 0x84:
+                ctx->cache_dir = arg;
+                break;
+        case 'j':
+                if ((n = strtoumax(arg, &ptr, 10)) == 0 || *ptr != '\0' || n > 1024) {
+                        error_setx(&err, "invalid number of jobs");
                         goto fatal;
+                }
+                ctx->jobs = (size_t)n;
                 break;
         case ARGP_KEY_ARG:
-                if (state->arg_num > 0)
+                if (state->arg_num > 0 || ctx->batch != NULL)
                         argp_usage(state);
                 if (is_root_dir(arg)) {
                         error_setx(&err, "invalid rootfs directory");
@@ -111,18 +142,19 @@ configure_parser(int key, char *arg, struct argp_state *state)
                 ctx->rootfs = arg;
                 break;
         case ARGP_KEY_SUCCESS:
-                if (ctx->pid > 0) {
-                        if (strjoin(&err, &ctx->container_flags, "supervised", " ") < 0)
-                                goto fatal;
+                /* Containers of a batch are referred to by their PID. */
+                if (ctx->pid > 0 || ctx->batch != NULL) {
+                        ctx->container_flags |= NVC_CONTAINER_SUPERVISED;
                 } else {
                         ctx->pid = getppid();
-                        if (strjoin(&err, &ctx->container_flags, "standalone", " ") < 0)
-                                goto fatal;
+                        ctx->container_flags |= NVC_CONTAINER_STANDALONE;
                 }
                 break;
         case ARGP_KEY_END:
-                if (state->arg_num < 1)
+                if (state->arg_num < 1 && ctx->batch == NULL)
                         argp_usage(state);
+                if (ctx->jobs == 0)
+                        ctx->jobs = (sysconf(_SC_NPROCESSORS_ONLN) > 0) ? (size_t)sysconf(_SC_NPROCESSORS_ONLN) : 1;
                 break;
         default:
                 return (ARGP_ERR_UNKNOWN);
@@ -135,24 +167,61 @@ configure_parser(int key, char *arg, struct argp_state *state)
 }
 
 static int
-check_cuda_version(const struct dsl_data *data, enum dsl_comparator cmp, const char *version)
+check_cuda_version(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
 {
-        return (dsl_compare_version(data->drv->cuda_version, cmp, version));
+        return (dsl_compare_version(&data->cuda, cmp, &value->version));
 }
 
 static int
-check_driver_version(const struct dsl_data *data, enum dsl_comparator cmp, const char *version)
+check_driver_version(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
 {
-        return (dsl_compare_version(data->drv->nvrm_version, cmp, version));
+        return (dsl_compare_version(&data->driver, cmp, &value->version));
 }
 
 static int
-check_device_arch(const struct dsl_data *data, enum dsl_comparator cmp, const char *arch)
+check_device_arch(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
 {
         /* XXX No device is visible, assume the arch is ok. */
-        if (data->dev == NULL)
+        if (!data->has_device)
+                return (true);
+        return (dsl_compare_version(&data->arch, cmp, &value->version));
+}
+
+static int
+check_device_memory(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
+{
+        /* XXX No device is visible, assume the properties are ok. */
+        if (data->props == NULL)
                 return (true);
-        return (dsl_compare_version(data->dev->arch, cmp, arch));
+        /*
+         * This is the total memory reported by the driver, which comes in under the nominal size of the board
+         * (e.g. about 16160M for a 16G board), hence requirements should be expressed with some slack.
+         */
+        return (dsl_compare_number(data->props->memory, cmp, value->number));
+}
+
+static int
+check_device_brand(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
+{
+        if (data->props == NULL)
+                return (true);
+        return (dsl_compare_string(data->props->brand, cmp, value->string));
+}
+
+static int
+check_device_compute_mode(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
+{
+        if (data->props == NULL)
+                return (true);
+        return (dsl_compare_string(data->props->compute_mode, cmp, value->string));
+}
+
+static int
+check_device_ecc(const struct dsl_data *data, enum dsl_comparator cmp, const struct dsl_value *value)
+{
+        if (data->props == NULL)
+                return (true);
+        return (dsl_compare_number(data->props->ecc, cmp, value->number));
 }
 
 static bool
@@ -168,6 +237,86 @@ is_root_dir(const char *path)
         return (rv);
 }
 
+/* Parse a batch file, every line holds the PID and the rootfs of a container. */
+static int
+load_targets(struct error *err, const char *path, char **buf, struct target **targets, size_t *size)
+{
+        char *line, *pid, *rootfs, *ptr;
+        struct target *tmp;
+
+        if (file_read_text(err, path, buf) < 0)
+                return (-1);
+        for (line = strtok_r(*buf, "\n", &ptr); line != NULL; line = strtok_r(NULL, "\n", &ptr)) {
+                line += strspn(line, " \t");
+                if (*line == '\0' || *line == '#')
+                        continue;
+                pid = strsep(&line, " \t");
+                rootfs = (line != NULL) ? line + strspn(line, " \t") : NULL;
+                if (rootfs == NULL || *rootfs == '\0') {
+                        error_setx(err, "invalid batch entry: %s", pid);
+                        return (-1);
+                }
+                if (is_root_dir(rootfs)) {
+                        error_setx(err, "invalid rootfs directory: %s", rootfs);
+                        return (-1);
+                }
+                if ((tmp = realloc(*targets, (*size + 1) * sizeof(*tmp))) == NULL) {
+                        error_set(err, "memory allocation failed");
+                        return (-1);
+                }
+                *targets = tmp;
+                tmp = &(*targets)[*size];
+                *tmp = (struct target){0};
+                if (strtopid(err, pid, &tmp->pid) < 0)
+                        return (-1);
+                tmp->rootfs = rootfs;
+                ++*size;
+        }
+        if (*size == 0) {
+                error_setx(err, "no container found in %s", path);
+                return (-1);
+        }
+        return (0);
+}
+
+/*
+ * Complete one of the ldcache updates in flight (or all of them), moving their output into the log meanwhile.
+ * Completed jobs are removed from the array, even if they failed.
+ */
+static int
+wait_jobs(struct nvc_context *nvc, struct nvc_ldcache_job *jobs[], size_t *njobs, bool all)
+{
+        struct pollfd *fds;
+        bool done = false;
+        int rv = 0;
+        int n;
+
+        fds = alloca(*njobs * sizeof(*fds));
+        while (*njobs > 0 && (all || !done)) {
+                for (size_t i = 0; i < *njobs; ++i) {
+                        if ((n = nvc_ldcache_update_poll(nvc, jobs[i])) < 0) {
+                                warnx("ldcache error: %s", nvc_error(nvc));
+                                return (-1);
+                        }
+                        if (n == 0)
+                                continue;
+                        if (nvc_ldcache_update_wait(nvc, jobs[i]) < 0 && rv == 0) {
+                                warnx("ldcache error: %s", nvc_error(nvc));
+                                rv = -1;
+                        }
+                        jobs[i--] = jobs[--*njobs];
+                        done = true;
+                }
+                if (*njobs == 0 || (done && !all))
+                        break;
+                /* Wake up periodically regardless, the pipes of the jobs need draining too. */
+                for (size_t i = 0; i < *njobs; ++i)
+                        fds[i] = (struct pollfd){nvc_ldcache_update_fd(jobs[i]), POLLIN, 0};
+                poll(fds, *njobs, 100);
+        }
+        return (rv);
+}
+
 int
 configure_command(const struct context *ctx)
 {
@@ -175,22 +324,61 @@ configure_command(const struct context *ctx)
         struct nvc_config *nvc_cfg = NULL;
         struct nvc_driver_info *drv = NULL;
         struct nvc_device_info *dev = NULL;
-        struct nvc_container *cnt = NULL;
-        struct nvc_container_config *cnt_cfg = NULL;
-        const struct nvc_device **gpus = NULL;
+        struct nvc_device **gpus = NULL;
+        struct nvc_device **visible = NULL;
+        struct nvc_device_props *props = NULL;
+        size_t nvisible = 0;
+        struct nvc_stats *stats = NULL;
+        struct target *targets = NULL;
+        struct nvc_ldcache_job **jobs = NULL;
+        size_t ntargets = 0;
+        size_t njobs = 0;
+        char *batch = NULL;
+        const char *info_file;
+        struct metrics metrics;
+        struct dsl_program reqs[nitems(ctx->reqs)] = {{0}};
+        struct dsl_data data = {0};
         bool eval_reqs = true;
         struct error err = {0};
         int rv = EXIT_FAILURE;
 
+        /* Failures are accounted for in the metrics no matter how early they happen. */
+        metrics_init(&metrics);
         if (geteuid() != 0) {
                 warnx("requires root privileges");
-                return (rv);
+                goto fail;
         }
         if (perm_set_capabilities(&err, CAP_PERMITTED, permitted_caps, nitems(permitted_caps)) < 0 ||
             perm_set_capabilities(&err, CAP_INHERITABLE, inherited_caps, nitems(inherited_caps)) < 0 ||
             perm_drop_bounds(&err) < 0) {
                 warnx("permission error: %s", err.msg);
-                return (rv);
+                goto fail;
+        }
+
+        /* Containers are either listed in a batch file or given on the command line. */
+        if (ctx->batch != NULL) {
+                if (load_targets(&err, ctx->batch, &batch, &targets, &ntargets) < 0) {
+                        warnx("batch error: %s", err.msg);
+                        goto fail;
+                }
+        } else {
+                if ((targets = calloc(1, sizeof(*targets))) == NULL) {
+                        warn("memory allocation failed");
+                        goto fail;
+                }
+                targets[ntargets++] = (struct target){.pid = ctx->pid, .rootfs = ctx->rootfs};
+        }
+        if ((jobs = calloc(MIN(ctx->jobs, ntargets), sizeof(*jobs))) == NULL) {
+                warn("memory allocation failed");
+                goto fail;
+        }
+
+        /* Compile the container requirements once, they are evaluated against every visible device. */
+        for (size_t i = 0; i < ctx->nreqs; ++i) {
+                if (dsl_compile(&err, ctx->reqs[i], rules, nitems(rules), &reqs[i]) < 0) {
+                        warnx("requirement error: %s: %s", err.msg, ctx->reqs[i]);
+                        goto fail;
+                }
         }
 
         /* Initialize the library and container contexts. */
@@ -200,35 +388,57 @@ configure_command(const struct context *ctx)
                 goto fail;
         }
         if ((nvc = nvc_context_new()) == NULL ||
-            (nvc_cfg = nvc_config_new()) == NULL ||
-            (cnt_cfg = nvc_container_config_new(ctx->pid, ctx->rootfs)) == NULL) {
+            (nvc_cfg = nvc_config_new()) == NULL) {
                 warn("memory allocation failed");
                 goto fail;
         }
         nvc_cfg->uid = ctx->uid;
         nvc_cfg->gid = ctx->gid;
         nvc_cfg->ldcache = ctx->ldcache;
-        if (nvc_init(nvc, nvc_cfg, ctx->init_flags) < 0) {
+        nvc_cfg->ldcache_dir = ctx->cache_dir;
+        if (nvc_init_flags(nvc, nvc_cfg, ctx->init_flags) < 0) {
                 warnx("initialization error: %s", nvc_error(nvc));
                 goto fail;
         }
+        metrics_phase(&metrics, PHASE_CONTAINER);
         if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_CONTAINER], effective_caps_size(CAPS_CONTAINER)) < 0) {
                 warnx("permission error: %s", err.msg);
                 goto fail;
         }
-        cnt_cfg->ldconfig = ctx->ldconfig;
-        if ((cnt = nvc_container_new(nvc, cnt_cfg, ctx->container_flags)) == NULL) {
-                warnx("container error: %s", nvc_error(nvc));
-                goto fail;
+        for (size_t i = 0; i < ntargets; ++i) {
+                if ((targets[i].cfg = nvc_container_config_new(targets[i].pid, targets[i].rootfs)) == NULL) {
+                        warn("memory allocation failed");
+                        goto fail;
+                }
+                targets[i].cfg->ldconfig = ctx->ldconfig;
+                if ((targets[i].cnt = nvc_container_new_flags(nvc, targets[i].cfg, ctx->container_flags)) == NULL) {
+                        warnx("container error: %s", nvc_error(nvc));
+                        goto fail;
+                }
         }
 
         /* Query the driver and device information. */
+        metrics_phase(&metrics, PHASE_INFO);
         if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_INFO], effective_caps_size(CAPS_INFO)) < 0) {
                 warnx("permission error: %s", err.msg);
                 goto fail;
         }
-        if ((drv = nvc_driver_info_new(nvc, NULL)) == NULL ||
-            (dev = nvc_device_info_new(nvc, NULL)) == NULL) {
+        /* Use the information published by "info --publish" if requested, and query the driver otherwise. */
+        if ((info_file = secure_getenv("NVC_INFO_FILE")) != NULL) {
+                if (nvc_info_load(nvc, info_file, &drv, devices_resolvable(ctx->devices) ? NULL : &dev) < 0)
+                        warnx("ignoring published information: %s", nvc_error(nvc));
+        }
+        if (drv == NULL && (drv = nvc_driver_info_new_flags(nvc, 0)) == NULL) {
+                warnx("detection error: %s", nvc_error(nvc));
+                goto fail;
+        }
+        if (dev == NULL) {
+                if (devices_resolvable(ctx->devices))
+                        dev = nvc_device_info_lookup_flags(nvc, ctx->devices, NVC_DEVICE_LAZY);
+                else
+                        dev = nvc_device_info_new_flags(nvc, NVC_DEVICE_LAZY);
+        }
+        if (dev == NULL) {
                 warnx("detection error: %s", nvc_error(nvc));
                 goto fail;
         }
@@ -237,7 +447,10 @@ configure_command(const struct context *ctx)
         if (dev->ngpus > 0) {
                 gpus = alloca(dev->ngpus * sizeof(*gpus));
                 memset(gpus, 0, dev->ngpus * sizeof(*gpus));
-                if (select_devices(&err, ctx->devices, gpus, dev->gpus, dev->ngpus) < 0) {
+                if (devices_resolvable(ctx->devices)) {
+                        for (size_t i = 0; i < dev->ngpus; ++i)
+                                gpus[i] = &dev->gpus[i];
+                } else if (select_devices(&err, nvc, ctx->devices, gpus, dev->gpus, dev->ngpus) < 0) {
                         warnx("device error: %s", err.msg);
                         goto fail;
                 }
@@ -247,13 +460,42 @@ configure_command(const struct context *ctx)
          * Check the container requirements.
          * Try evaluating per visible device first, and globally otherwise.
          */
-        for (size_t i = 0; i < dev->ngpus; ++i) {
+        if (ctx->nreqs > 0 && (dsl_parse_version(drv->cuda_version, &data.cuda) < 0 ||
+            dsl_parse_version(drv->nvrm_version, &data.driver) < 0)) {
+                warnx("requirement error: invalid driver version");
+                goto fail;
+        }
+        /* Device properties are fetched for all the visible devices at once, and only if a requirement needs them. */
+        for (size_t i = 0; i < ctx->nreqs && props == NULL; ++i) {
+                if (!dsl_uses_device_props(&reqs[i]) || dev->ngpus == 0)
+                        continue;
+                visible = alloca(dev->ngpus * sizeof(*visible));
+                props = alloca(dev->ngpus * sizeof(*props));
+                for (size_t j = 0; j < dev->ngpus; ++j) {
+                        if (gpus[j] != NULL)
+                                visible[nvisible++] = gpus[j];
+                }
+                if (nvisible > 0 && nvc_device_get_props(nvc, visible, nvisible, props) < 0) {
+                        warnx("detection error: %s", nvc_error(nvc));
+                        goto fail;
+                }
+        }
+        for (size_t i = 0, n = 0; i < dev->ngpus; ++i) {
                 if (gpus[i] == NULL)
                         continue;
+                if (ctx->nreqs > 0 && nvc_device_get_arch(nvc, gpus[i]) == NULL) {
+                        warnx("detection error: %s", nvc_error(nvc));
+                        goto fail;
+                }
 
-                struct dsl_data data = {drv, gpus[i]};
+                data.has_device = true;
+                data.props = (props != NULL) ? &props[n++] : NULL;
+                if (ctx->nreqs > 0 && dsl_parse_version(gpus[i]->arch, &data.arch) < 0) {
+                        warnx("requirement error: invalid device architecture: %s", gpus[i]->arch);
+                        goto fail;
+                }
                 for (size_t j = 0; j < ctx->nreqs; ++j) {
-                        if (dsl_evaluate(&err, ctx->reqs[j], &data, rules, nitems(rules)) < 0) {
+                        if (dsl_evaluate(&err, &reqs[j], &data) < 0) {
                                 warnx("requirement error: %s", err.msg);
                                 goto fail;
                         }
@@ -261,40 +503,53 @@ configure_command(const struct context *ctx)
                 eval_reqs = false;
         }
         if (eval_reqs) {
-                struct dsl_data data = {drv, NULL};
+                data.has_device = false;
+                data.props = NULL;
                 for (size_t j = 0; j < ctx->nreqs; ++j) {
-                        if (dsl_evaluate(&err, ctx->reqs[j], &data, rules, nitems(rules)) < 0) {
+                        if (dsl_evaluate(&err, &reqs[j], &data) < 0) {
                                 warnx("requirement error: %s", err.msg);
                                 goto fail;
                         }
                 }
         }
 
-        /* Mount the driver and visible devices. */
-        if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_MOUNT], effective_caps_size(CAPS_MOUNT)) < 0) {
-                warnx("permission error: %s", err.msg);
-                goto fail;
-        }
-        if (nvc_driver_mount(nvc, cnt, drv) < 0) {
-                warnx("mount error: %s", nvc_error(nvc));
-                goto fail;
-        }
-        for (size_t i = 0; i < dev->ngpus; ++i) {
-                if (gpus[i] != NULL && nvc_device_mount(nvc, cnt, gpus[i]) < 0) {
+        /*
+         * Mount the driver and visible devices, then update the container ldcache.
+         * The ldconfig of a container runs while the next one is being mounted, with at most ctx->jobs in flight.
+         */
+        metrics_phase(&metrics, PHASE_MOUNT);
+        for (size_t i = 0; i < ntargets; ++i) {
+                if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_MOUNT], effective_caps_size(CAPS_MOUNT)) < 0) {
+                        warnx("permission error: %s", err.msg);
+                        goto fail;
+                }
+                if (nvc_driver_mount(nvc, targets[i].cnt, drv) < 0) {
                         warnx("mount error: %s", nvc_error(nvc));
                         goto fail;
                 }
-        }
+                for (size_t j = 0; j < dev->ngpus; ++j) {
+                        if (gpus[j] != NULL && nvc_device_mount(nvc, targets[i].cnt, gpus[j]) < 0) {
+                                warnx("mount error: %s", nvc_error(nvc));
+                                goto fail;
+                        }
+                }
 
-        /* Update the container ldcache. */
-        if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_LDCACHE], effective_caps_size(CAPS_LDCACHE)) < 0) {
-                warnx("permission error: %s", err.msg);
-                goto fail;
+                if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_LDCACHE], effective_caps_size(CAPS_LDCACHE)) < 0) {
+                        warnx("permission error: %s", err.msg);
+                        goto fail;
+                }
+                if (njobs == MIN(ctx->jobs, ntargets) && wait_jobs(nvc, jobs, &njobs, false) < 0)
+                        goto fail;
+                if ((jobs[njobs] = nvc_ldcache_update_start(nvc, targets[i].cnt)) == NULL) {
+                        warnx("ldcache error: %s", nvc_error(nvc));
+                        goto fail;
+                }
+                ++njobs;
         }
-        if (nvc_ldcache_update(nvc, cnt) < 0) {
-                warnx("ldcache error: %s", nvc_error(nvc));
+        metrics_phase(&metrics, PHASE_LDCACHE);
+        if (wait_jobs(nvc, jobs, &njobs, true) < 0)
                 goto fail;
-        }
+        metrics_phase(&metrics, PHASE_DONE);
 
         if (perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_SHUTDOWN], effective_caps_size(CAPS_SHUTDOWN)) < 0) {
                 warnx("permission error: %s", err.msg);
@@ -303,13 +558,28 @@ configure_command(const struct context *ctx)
         rv = EXIT_SUCCESS;
 
  fail:
+        if (jobs != NULL && wait_jobs(nvc, jobs, &njobs, true) < 0)
+                rv = EXIT_FAILURE;
+        if (metrics.path != NULL) {
+                stats = nvc_stats_new(nvc);
+                if (metrics_write(&err, &metrics, stats) < 0)
+                        warnx("metrics error: %s", err.msg);
+                nvc_stats_free(stats);
+        }
         nvc_shutdown(nvc);
-        nvc_container_free(cnt);
+        for (size_t i = 0; i < ntargets; ++i) {
+                nvc_container_free(targets[i].cnt);
+                nvc_container_config_free(targets[i].cfg);
+        }
         nvc_device_info_free(dev);
         nvc_driver_info_free(drv);
-        nvc_container_config_free(cnt_cfg);
         nvc_config_free(nvc_cfg);
         nvc_context_free(nvc);
+        for (size_t i = 0; i < ctx->nreqs; ++i)
+                dsl_free(&reqs[i]);
+        free(jobs);
+        free(targets);
+        free(batch);
         error_reset(&err);
         return (rv);
 }
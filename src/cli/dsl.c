@@ -3,6 +3,7 @@
  */
 
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
@@ -12,9 +13,9 @@
 #include "dsl.h"
 #include "utils.h"
 
-#define EXPR_MAX 128
-
-static int evaluate_rule(char *, char *, void *, const struct dsl_rule [], size_t);
+static int parse_size(const char *, uint64_t *);
+static int parse_bool(const char *, uint64_t *);
+static int compile_expr(struct dsl_expr *, const char *, size_t, const struct dsl_rule [], size_t);
 
 struct operator {
         const char *str;
@@ -31,124 +32,265 @@ static const struct operator operators[] = {
 };
 
 int
-dsl_compare_version(const char *v1, enum dsl_comparator cmp, const char *v2)
+dsl_parse_version(const char *str, struct dsl_version *v)
 {
-        char *ptr1, *ptr2;
-        uintmax_t n1, n2;
+        char *ptr;
+        uintmax_t n;
 
-        if (strspn(v1, "0123456789.") != strlen(v1))
-                return (-1);
-        if (strspn(v2, "0123456789.") != strlen(v2))
+        *v = (struct dsl_version){0};
+        if (strspn(str, "0123456789.") != strlen(str))
                 return (-1);
 
-        while (*v1 != '\0' && *v2 != '\0') {
-                if ((n1 = strtoumax(v1, &ptr1, 10)) == UINTMAX_MAX || v1 == ptr1)
-                        return (-1);
-                if ((n2 = strtoumax(v2, &ptr2, 10)) == UINTMAX_MAX || v2 == ptr2)
+        for (size_t i = 0; *str != '\0'; ++i) {
+                if ((n = strtoumax(str, &ptr, 10)) == UINTMAX_MAX || str == ptr || n > UINT64_MAX)
                         return (-1);
-                if (n1 != n2) {
-                        if (cmp == EQUAL)
-                                return (false);
-                        if (cmp == NOT_EQUAL)
-                                return (true);
-                        if (cmp == LESS || cmp == LESS_EQUAL)
-                                return (n1 < n2);
-                        if (cmp == GREATER || cmp == GREATER_EQUAL)
-                                return (n1 > n2);
+                if (n != 0) {
+                        if (i >= DSL_VERSION_MAX)
+                                return (-1);
+                        v->num[i] = (uint64_t)n;
+                        v->len = i + 1;
                 }
-                v1 = ptr1 + strspn(ptr1, ".");
-                v2 = ptr2 + strspn(ptr2, ".");
+                str = ptr + strspn(ptr, ".");
         }
-        v1 += strspn(v1, ".0");
-        v2 += strspn(v2, ".0");
+        return (0);
+}
+
+int
+dsl_compare_version(const struct dsl_version *v1, enum dsl_comparator cmp, const struct dsl_version *v2)
+{
+        size_t len;
+
+        /* Missing components are zeros, they are stored as such. */
+        len = (v1->len > v2->len) ? v1->len : v2->len;
+        for (size_t i = 0; i < len; ++i) {
+                if (v1->num[i] != v2->num[i])
+                        return (dsl_compare_number(v1->num[i], cmp, v2->num[i]));
+        }
+        return (dsl_compare_number(0, cmp, 0));
+}
+
+int
+dsl_compare_number(uint64_t n1, enum dsl_comparator cmp, uint64_t n2)
+{
+        switch (cmp) {
+        case EQUAL:
+                return (n1 == n2);
+        case NOT_EQUAL:
+                return (n1 != n2);
+        case LESS:
+                return (n1 < n2);
+        case LESS_EQUAL:
+                return (n1 <= n2);
+        case GREATER:
+                return (n1 > n2);
+        case GREATER_EQUAL:
+                return (n1 >= n2);
+        }
+        return (-1);
+}
+
+int
+dsl_compare_string(const char *s1, enum dsl_comparator cmp, const char *s2)
+{
+        if (cmp == EQUAL)
+                return (!strcasecmp(s1, s2));
         if (cmp == NOT_EQUAL)
-                return (*v1 != '\0' || *v2 != '\0');
-        if (cmp == EQUAL || cmp == LESS_EQUAL || cmp == GREATER_EQUAL) {
-                if (*v1 == '\0' && *v2 == '\0')
-                        return (true);
-                if (cmp == EQUAL)
-                        return (false);
+                return (strcasecmp(s1, s2) != 0);
+        return (-1);
+}
+
+static int
+parse_size(const char *str, uint64_t *size)
+{
+        const char *units = "KMGT";
+        const char *unit;
+        char *ptr;
+        uintmax_t n;
+        unsigned int shift = 20;
+
+        if (strspn(str, "0123456789") == 0)
+                return (-1);
+        if ((n = strtoumax(str, &ptr, 10)) == UINTMAX_MAX)
+                return (-1);
+        if (*ptr != '\0') {
+                if ((unit = strchr(units, toupper((unsigned char)*ptr))) == NULL)
+                        return (-1);
+                shift = 10 * (unsigned int)(unit - units + 1);
+                ++ptr;
+                if (*ptr == 'i')
+                        ++ptr;
+                if (*ptr == 'B' || *ptr == 'b')
+                        ++ptr;
+                if (*ptr != '\0')
+                        return (-1);
+        }
+        if (n > (UINT64_MAX >> shift))
+                return (-1);
+        *size = (uint64_t)n << shift;
+        return (0);
+}
+
+static int
+parse_bool(const char *str, uint64_t *val)
+{
+        const char * const values[][2] = {
+                {"0", "1"}, {"off", "on"}, {"no", "yes"}, {"false", "true"}, {"disabled", "enabled"},
+        };
+
+        for (size_t i = 0; i < nitems(values); ++i) {
+                for (size_t j = 0; j < 2; ++j) {
+                        if (!strcasecmp(str, values[i][j])) {
+                                *val = j;
+                                return (0);
+                        }
+                }
         }
-        if (cmp == LESS || cmp == LESS_EQUAL)
-                return (*v1 == '\0' && *v2 != '\0');
-        if (cmp == GREATER || cmp == GREATER_EQUAL)
-                return (*v1 != '\0' && *v2 == '\0');
         return (-1);
 }
 
 static int
-evaluate_rule(char *buf, char *expr, void *ctx, const struct dsl_rule rules[], size_t size)
+compile_expr(struct dsl_expr *expr, const char *str, size_t len, const struct dsl_rule rules[], size_t size)
 {
-        size_t i, n;
+        char buf[DSL_EXPR_MAX];
+        const struct operator *op = NULL;
         char *ptr, *val;
-        const struct operator *op;
-        int ret;
+        size_t i, n;
+
+        if (len >= sizeof(buf))
+                return (-1);
+        memcpy(buf, str, len);
+        buf[len] = '\0';
 
         /* Parse the expression */
-        if ((n = strcspn(expr, "<>=!")) == 0)
+        if ((n = strcspn(buf, "<>=!")) == 0)
                 return (-1);
-        ptr = expr + n;
+        ptr = buf + n;
         if ((n = strspn(ptr, "<>=!")) == 0)
                 return (-1);
         for (i = 0; i < nitems(operators); ++i) {
-                if (!strncmp(ptr, operators[i].str, n)) {
+                if (strlen(operators[i].str) == n && !strncmp(ptr, operators[i].str, n)) {
                         op = &operators[i];
-                        *ptr = '\0';
-                        val = ptr + n;
                         break;
                 }
         }
-        if (i == nitems(operators) || *val == '\0')
+        if (op == NULL)
+                return (-1);
+        *ptr = '\0';
+        val = ptr + n;
+        if (*val == '\0')
                 return (-1);
 
-        /* Lookup the rule and evaluate it. */
+        /* Lookup the rule and pre-parse its operand. */
         for (i = 0; i < size; ++i) {
-                if (!strcasecmp(expr, rules[i].name)) {
-                        if ((ret = rules[i].func(ctx, op->cmp, val)) == false) {
-                                /* Save the expression formatted for error reporting. */
-                                if (snprintf(buf, EXPR_MAX, "%s %s %s", expr, op->str, val) >= EXPR_MAX)
-                                        return (-1);
-                        }
-                        return (ret);
-                }
+                if (!strcasecmp(buf, rules[i].name))
+                        break;
+        }
+        if (i == size)
+                return (-1);
+        expr->rule = &rules[i];
+        expr->cmp = op->cmp;
+
+        /* Save the expression formatted for error reporting. */
+        if (snprintf(expr->str, sizeof(expr->str), "%s %s %s", buf, op->str, val) >= (int)sizeof(expr->str))
+                return (-1);
+
+        switch (expr->rule->type) {
+        case DSL_VERSION:
+                return (dsl_parse_version(val, &expr->value.version));
+        case DSL_SIZE:
+                return (parse_size(val, &expr->value.number));
+        case DSL_BOOL:
+                if (op->cmp != EQUAL && op->cmp != NOT_EQUAL)
+                        return (-1);
+                return (parse_bool(val, &expr->value.number));
+        case DSL_STRING:
+                if (op->cmp != EQUAL && op->cmp != NOT_EQUAL)
+                        return (-1);
+                /* The operand is the tail of the formatted expression. */
+                expr->value.string = expr->str + strlen(expr->str) - strlen(val);
+                return (0);
         }
         return (-1);
 }
 
 int
-dsl_evaluate(struct error *err, const char *predicate, void *ctx, const struct dsl_rule rules[], size_t size)
+dsl_compile(struct error *err, const char *predicate, const struct dsl_rule rules[], size_t size, struct dsl_program *prog)
 {
-        char *ptr, *expr = NULL;
-        char *or_expr, *and_expr;
-        int ret = true;
-        int rv = -1;
-        char buf[EXPR_MAX];
-
-        if ((expr = ptr = xstrdup(err, predicate)) == NULL)
-                goto fail;
-        while ((or_expr = strsep(&ptr, " ")) != NULL) {
-                if (*or_expr == '\0')
+        const char *ptr;
+        size_t n, len;
+
+        *prog = (struct dsl_program){0};
+
+        /* Every separator potentially ends an expression, this bounds their number. */
+        for (n = 1, ptr = predicate; *ptr != '\0'; ++ptr)
+                n += (*ptr == ' ' || *ptr == ',');
+        if ((prog->exprs = xcalloc(err, n, sizeof(*prog->exprs))) == NULL)
+                return (-1);
+
+        for (ptr = predicate; *ptr != '\0'; ptr += len) {
+                if (*ptr == ' ' || *ptr == ',') {
+                        /* A space closes the current conjunction. */
+                        if (*ptr == ' ' && prog->nexprs > 0)
+                                prog->exprs[prog->nexprs - 1].last = true;
+                        len = 1;
                         continue;
-                while ((and_expr = strsep(&or_expr, ",")) != NULL) {
-                        if (*and_expr == '\0')
-                                continue;
-                        if ((ret = evaluate_rule(buf, and_expr, ctx, rules, size)) < 0) {
-                                error_setx(err, "invalid expression");
-                                goto fail;
-                        }
-                        if (!ret)
-                                break;
                 }
-                if (and_expr == NULL)
-                        break;
+                len = strcspn(ptr, " ,");
+                if (compile_expr(&prog->exprs[prog->nexprs], ptr, len, rules, size) < 0) {
+                        error_setx(err, "invalid expression");
+                        dsl_free(prog);
+                        return (-1);
+                }
+                ++prog->nexprs;
+        }
+        if (prog->nexprs > 0)
+                prog->exprs[prog->nexprs - 1].last = true;
+        return (0);
+}
+
+int
+dsl_evaluate(struct error *err, const struct dsl_program *prog, const struct dsl_data *data)
+{
+        const struct dsl_expr *expr;
+        const struct dsl_expr *failed = NULL;
+        int ret;
+
+        for (size_t i = 0; i < prog->nexprs; ++i) {
+                expr = &prog->exprs[i];
+                if ((ret = expr->rule->func(data, expr->cmp, &expr->value)) < 0) {
+                        error_setx(err, "invalid expression");
+                        return (-1);
+                }
+                if (ret) {
+                        /* The whole conjunction holds, so does the requirement. */
+                        if (expr->last)
+                                return (0);
+                        continue;
+                }
+                failed = expr;
+                while (!prog->exprs[i].last)
+                        ++i;
         }
-        if (!ret) {
-                error_setx(err, "unsatisfied condition: %s", buf);
-                goto fail;
+        if (failed != NULL) {
+                error_setx(err, "unsatisfied condition: %s", failed->str);
+                return (-1);
+        }
+        return (0);
+}
+
+bool
+dsl_uses_device_props(const struct dsl_program *prog)
+{
+        for (size_t i = 0; i < prog->nexprs; ++i) {
+                if (prog->exprs[i].rule->device_props)
+                        return (true);
         }
-        rv = 0;
+        return (false);
+}
 
- fail:
-        free(expr);
-        return (rv);
+void
+dsl_free(struct dsl_program *prog)
+{
+        free(prog->exprs);
+        *prog = (struct dsl_program){0};
 }
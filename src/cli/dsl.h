@@ -6,9 +6,13 @@
 #define HEADER_DSL_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "cli.h"
 
+#define DSL_EXPR_MAX    128
+#define DSL_VERSION_MAX 8
+
 enum dsl_comparator {
         EQUAL,
         NOT_EQUAL,
@@ -18,17 +22,60 @@ enum dsl_comparator {
         GREATER_EQUAL,
 };
 
+enum dsl_type {
+        DSL_VERSION,
+        DSL_SIZE,   /* Bytes, given in MiB unless suffixed with K, M, G or T (powers of 1024). */
+        DSL_STRING, /* Compared for (in)equality ignoring case. */
+        DSL_BOOL,
+};
+
+struct dsl_version {
+        uint64_t num[DSL_VERSION_MAX];
+        size_t len; /* Trailing zeros excluded. */
+};
+
+struct dsl_value {
+        struct dsl_version version;
+        uint64_t number;
+        const char *string;
+};
+
 struct dsl_data {
-        struct nvc_driver_info *drv;
-        const struct nvc_device *dev;
+        struct dsl_version cuda;
+        struct dsl_version driver;
+        struct dsl_version arch;
+        const struct nvc_device_props *props;
+        bool has_device;
 };
 
 struct dsl_rule {
         const char *name;
-        int (*func)(const struct dsl_data *, enum dsl_comparator, const char *);
+        enum dsl_type type;
+        int (*func)(const struct dsl_data *, enum dsl_comparator, const struct dsl_value *);
+        bool device_props; /* Requires the device properties (see nvc_device_get_props). */
+};
+
+struct dsl_expr {
+        const struct dsl_rule *rule;
+        enum dsl_comparator cmp;
+        struct dsl_value value;
+        bool last; /* Last expression of a conjunction. */
+        char str[DSL_EXPR_MAX];
+};
+
+/* Disjunction of conjunctions compiled from a requirement (e.g. "cuda>=9.0,arch>=6.0 cuda>=9.2"). */
+struct dsl_program {
+        struct dsl_expr *exprs;
+        size_t nexprs;
 };
 
-int dsl_compare_version(const char *, enum dsl_comparator, const char *);
-int dsl_evaluate(struct error *, const char *, void *, const struct dsl_rule [], size_t);
+int dsl_parse_version(const char *, struct dsl_version *);
+int dsl_compare_version(const struct dsl_version *, enum dsl_comparator, const struct dsl_version *);
+int dsl_compare_number(uint64_t, enum dsl_comparator, uint64_t);
+int dsl_compare_string(const char *, enum dsl_comparator, const char *);
+int dsl_compile(struct error *, const char *, const struct dsl_rule [], size_t, struct dsl_program *);
+int dsl_evaluate(struct error *, const struct dsl_program *, const struct dsl_data *);
+bool dsl_uses_device_props(const struct dsl_program *);
+void dsl_free(struct dsl_program *);
 
 #endif /* HEADER_DSL_H */
@@ -14,6 +14,7 @@ const struct argp info_usage = {
         (const struct argp_option[]){
                 {NULL, 0, NULL, 0, "Options:", -1},
                 {"csv", 0x80, NULL, 0, "Output in CSV format", -1},
+                {"publish", 0x81, NULL, 0, "Publish the information for other invocations to load", -1},
                 {0},
         },
         info_parser,
@@ -33,6 +34,9 @@ info_parser(int key, maybe_unused char *arg, struct argp_state *state)
         case 0x80:
                 ctx->csv_output = true;
                 break;
+        case 0x81:
+                ctx->publish = true;
+                break;
         default:
                 return (ARGP_ERR_UNKNOWN);
         }
@@ -83,7 +87,7 @@ info_command(const struct context *ctx)
         nvc_cfg->uid = (!run_as_root && ctx->uid == (uid_t)-1) ? geteuid() : ctx->uid;
         nvc_cfg->gid = (!run_as_root && ctx->gid == (gid_t)-1) ? getegid() : ctx->gid;
         nvc_cfg->ldcache = ctx->ldcache;
-        if (nvc_init(nvc, nvc_cfg, ctx->init_flags) < 0) {
+        if (nvc_init_flags(nvc, nvc_cfg, ctx->init_flags) < 0) {
                 warnx("initialization error: %s", nvc_error(nvc));
                 goto fail;
         }
@@ -93,11 +97,15 @@ info_command(const struct context *ctx)
                 warnx("permission error: %s", err.msg);
                 goto fail;
         }
-        if ((drv = nvc_driver_info_new(nvc, NULL)) == NULL ||
-            (dev = nvc_device_info_new(nvc, NULL)) == NULL) {
+        if ((drv = nvc_driver_info_new_flags(nvc, 0)) == NULL ||
+            (dev = nvc_device_info_new_flags(nvc, 0)) == NULL) {
                 warnx("detection error: %s", nvc_error(nvc));
                 goto fail;
         }
+        if (ctx->publish && nvc_info_publish(nvc, secure_getenv("NVC_INFO_FILE"), drv, dev) < 0) {
+                warnx("publication error: %s", nvc_error(nvc));
+                goto fail;
+        }
 
         if (ctx->csv_output) {
                 printf("NVRM version,CUDA version\n%s,%s\n", drv->nvrm_version, drv->cuda_version);
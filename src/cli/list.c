@@ -13,7 +13,7 @@ static error_t list_parser(int, char *, struct argp_state *);
 const struct argp list_usage = {
         (const struct argp_option[]){
                 {NULL, 0, NULL, 0, "Options:", -1},
-                {"device", 'd', "ID", 0, "Device UUID(s) or index(es) to list", -1},
+                {"device", 'd', "ID", 0, "Device UUID(s), PCI bus ID(s) or index(es) to list", -1},
                 {"libraries", 'l', NULL, 0, "List driver libraries", -1},
                 {"binaries", 'b', NULL, 0, "List driver binaries", -1},
                 {"ipcs", 'i', NULL, 0, "List driver ipcs", -1},
@@ -79,7 +79,7 @@ list_command(const struct context *ctx)
         struct nvc_config *nvc_cfg = NULL;
         struct nvc_driver_info *drv = NULL;
         struct nvc_device_info *dev = NULL;
-        const struct nvc_device **gpus = NULL;
+        struct nvc_device **gpus = NULL;
         struct error err = {0};
         int rv = EXIT_FAILURE;
 
@@ -116,7 +116,7 @@ list_command(const struct context *ctx)
         nvc_cfg->uid = (!run_as_root && ctx->uid == (uid_t)-1) ? geteuid() : ctx->uid;
         nvc_cfg->gid = (!run_as_root && ctx->gid == (gid_t)-1) ? getegid() : ctx->gid;
         nvc_cfg->ldcache = ctx->ldcache;
-        if (nvc_init(nvc, nvc_cfg, ctx->init_flags) < 0) {
+        if (nvc_init_flags(nvc, nvc_cfg, ctx->init_flags) < 0) {
                 warnx("initialization error: %s", nvc_error(nvc));
                 goto fail;
         }
@@ -126,8 +126,15 @@ list_command(const struct context *ctx)
                 warnx("permission error: %s", err.msg);
                 goto fail;
         }
-        if ((drv = nvc_driver_info_new(nvc, NULL)) == NULL ||
-            (dev = nvc_device_info_new(nvc, NULL)) == NULL) {
+        if ((drv = nvc_driver_info_new_flags(nvc, 0)) == NULL) {
+                warnx("detection error: %s", nvc_error(nvc));
+                goto fail;
+        }
+        if (devices_resolvable(ctx->devices))
+                dev = nvc_device_info_lookup_flags(nvc, ctx->devices, NVC_DEVICE_LAZY);
+        else
+                dev = nvc_device_info_new_flags(nvc, NVC_DEVICE_LAZY);
+        if (dev == NULL) {
                 warnx("detection error: %s", nvc_error(nvc));
                 goto fail;
         }
@@ -136,7 +143,10 @@ list_command(const struct context *ctx)
         if (dev->ngpus > 0) {
                 gpus = alloca(dev->ngpus * sizeof(*gpus));
                 memset(gpus, 0, dev->ngpus * sizeof(*gpus));
-                if (select_devices(&err, ctx->devices, gpus, dev->gpus, dev->ngpus) < 0) {
+                if (devices_resolvable(ctx->devices)) {
+                        for (size_t i = 0; i < dev->ngpus; ++i)
+                                gpus[i] = &dev->gpus[i];
+                } else if (select_devices(&err, nvc, ctx->devices, gpus, dev->gpus, dev->ngpus) < 0) {
                         warnx("device error: %s", err.msg);
                         goto fail;
                 }
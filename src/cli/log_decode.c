@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cli.h"
+
+static error_t log_decode_parser(int, char *, struct argp_state *);
+
+const struct argp log_decode_usage = {
+        (const struct argp_option[]){
+                {0},
+        },
+        log_decode_parser,
+        "[FILE]",
+        "Decode a binary debug log (i.e. NVC_DEBUG_FORMAT=binary) from FILE or the standard input.",
+        NULL,
+        NULL,
+        NULL,
+};
+
+static error_t
+log_decode_parser(int key, char *arg, struct argp_state *state)
+{
+        struct context *ctx = state->input;
+
+        switch (key) {
+        case ARGP_KEY_ARG:
+                if (state->arg_num > 0)
+                        argp_usage(state);
+                ctx->log_file = arg;
+                break;
+        default:
+                return (ARGP_ERR_UNKNOWN);
+        }
+        return (0);
+}
+
+int
+log_decode_command(const struct context *ctx)
+{
+        FILE *fs = stdin;
+        struct error err = {0};
+        int rv = EXIT_FAILURE;
+
+        if (ctx->log_file != NULL && (fs = fopen(ctx->log_file, "re")) == NULL) {
+                warn("open failed: %s", ctx->log_file);
+                return (rv);
+        }
+        if (log_decode(&err, fs, stdout) < 0) {
+                warnx("decoding error: %s", err.msg);
+                goto fail;
+        }
+        rv = EXIT_SUCCESS;
+
+ fail:
+        if (fs != stdin)
+                fclose(fs);
+        error_reset(&err);
+        return (rv);
+}
@@ -34,6 +34,8 @@ static struct argp usage = {
                 {"info", 0, NULL, OPTION_DOC|OPTION_NO_USAGE, "Report information about the driver and devices", 0},
                 {"list", 0, NULL, OPTION_DOC|OPTION_NO_USAGE, "List driver components", 0},
                 {"configure", 0, NULL, OPTION_DOC|OPTION_NO_USAGE, "Configure a container with GPU support", 0},
+                {"stats", 0, NULL, OPTION_DOC|OPTION_NO_USAGE, "Report driver call counts and latencies", 0},
+                {"log-decode", 0, NULL, OPTION_DOC|OPTION_NO_USAGE, "Decode a binary debug log", 0},
                 {0},
         },
         parser,
@@ -48,6 +50,8 @@ static const struct command commands[] = {
         {"info", &info_usage, &info_command},
         {"list", &list_usage, &list_command},
         {"configure", &configure_usage, &configure_command},
+        {"stats", &stats_usage, &stats_command},
+        {"log-decode", &log_decode_usage, &log_decode_command},
 };
 
 static void
@@ -88,8 +92,7 @@ parser(int key, char *arg, struct argp_state *state)
                 break;
         case 'k':
                 ctx->load_kmods = true;
-                if (strjoin(&err, &ctx->init_flags, "load-kmods", " ") < 0)
-                        goto fatal;
+                ctx->init_flags |= NVC_INIT_LOAD_KMODS;
                 break;
         case 'u':
                 if (arg != NULL) {
@@ -132,7 +135,5 @@ main(int argc, char *argv[])
         rv = ctx.command->func(&ctx);
 
         free(ctx.devices);
-        free(ctx.init_flags);
-        free(ctx.container_flags);
         return (rv);
 }
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define METRICS_PREFIX "nvidia_container_cli_"
+
+struct samples {
+        struct sample {
+                char *key;
+                double value;
+        } *data;
+        size_t size;
+};
+
+static double elapsed(const struct timespec *);
+static int samples_add(struct error *, struct samples *, double, const char *, ...)
+    __attribute__((format(printf, 4, 5)));
+static int samples_load(struct error *, struct samples *, const char *);
+static int samples_store(struct error *, const struct samples *, const char *);
+static void samples_free(struct samples *);
+static bool match_family(const char *, const char *);
+
+static const char * const phase_names[] = {
+        [PHASE_INIT]      = "init",
+        [PHASE_CONTAINER] = "container",
+        [PHASE_INFO]      = "info",
+        [PHASE_MOUNT]     = "mount",
+        [PHASE_LDCACHE]   = "ldcache",
+};
+
+static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+} families[] = {
+        {METRICS_PREFIX "configure_total", "counter", "Number of configure runs."},
+        {METRICS_PREFIX "configure_failures_total", "counter", "Number of failed configure runs by phase."},
+        {METRICS_PREFIX "configure_phase_seconds", "summary", "Time spent in each configure phase."},
+        {METRICS_PREFIX "mounts_total", "counter", "Number of mounts performed."},
+        {METRICS_PREFIX "libraries_selected_total", "counter", "Number of driver libraries mounted."},
+        {METRICS_PREFIX "libraries_skipped_total", "counter", "Number of driver libraries skipped by capability."},
+        {METRICS_PREFIX "ldconfig_seconds", "summary", "Time spent running ldconfig."},
+        {METRICS_PREFIX "driver_rpcs_total", "counter", "Number of driver service calls by procedure."},
+        {METRICS_PREFIX "driver_rpc_errors_total", "counter", "Number of failed driver service calls by procedure."},
+        {METRICS_PREFIX "driver_rpc_seconds_total", "counter", "Time spent in driver service calls by procedure."},
+};
+
+static double
+elapsed(const struct timespec *start)
+{
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        return ((double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static int
+samples_add(struct error *err, struct samples *s, double value, const char *fmt, ...)
+{
+        va_list ap;
+        char *key;
+        struct sample *ptr;
+        int rv;
+
+        va_start(ap, fmt);
+        rv = vasprintf(&key, fmt, ap);
+        va_end(ap);
+        if (rv < 0) {
+                error_set(err, "memory allocation failed");
+                return (-1);
+        }
+
+        for (size_t i = 0; i < s->size; ++i) {
+                if (!strcmp(s->data[i].key, key)) {
+                        s->data[i].value += value;
+                        free(key);
+                        return (0);
+                }
+        }
+        if ((ptr = realloc(s->data, (s->size + 1) * sizeof(*ptr))) == NULL) {
+                error_set(err, "memory allocation failed");
+                free(key);
+                return (-1);
+        }
+        s->data = ptr;
+        s->data[s->size++] = (struct sample){key, value};
+        return (0);
+}
+
+static int
+samples_load(struct error *err, struct samples *s, const char *path)
+{
+        char *buf = NULL;
+        char *line, *value, *ptr;
+        int rv = -1;
+
+        if (file_read_text(err, path, &buf) < 0)
+                return ((err->code == ENOENT) ? 0 : -1);
+
+        for (line = strtok_r(buf, "\n", &ptr); line != NULL; line = strtok_r(NULL, "\n", &ptr)) {
+                if (*line == '#' || (value = strrchr(line, ' ')) == NULL)
+                        continue;
+                *value++ = '\0';
+                if (samples_add(err, s, strtod(value, NULL), "%s", line) < 0)
+                        goto fail;
+        }
+        rv = 0;
+
+ fail:
+        free(buf);
+        return (rv);
+}
+
+static bool
+match_family(const char *key, const char *family)
+{
+        size_t len, n;
+
+        len = strcspn(key, "{");
+        n = strlen(family);
+        if (len < n || strncmp(key, family, n))
+                return (false);
+        key += n;
+        len -= n;
+        return (len == 0 || (len == strlen("_sum") && !strncmp(key, "_sum", len)) ||
+            (len == strlen("_count") && !strncmp(key, "_count", len)));
+}
+
+/*
+ * Write the samples to a temporary file next to the destination and rename it over, such that the textfile
+ * collector never sees a partially written file.
+ */
+static int
+samples_store(struct error *err, const struct samples *s, const char *path)
+{
+        char *tmp = NULL;
+        FILE *fs = NULL;
+        int fd = -1;
+        bool header, matched;
+        int rv = -1;
+
+        if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+                error_set(err, "memory allocation failed");
+                return (-1);
+        }
+        if ((fd = mkostemp(tmp, O_CLOEXEC)) < 0) {
+                error_set(err, "file creation failed: %s", tmp);
+                free(tmp);
+                return (-1);
+        }
+        if (fchmod(fd, 0644) < 0 || (fs = fdopen(fd, "w")) == NULL) {
+                error_set(err, "file creation failed: %s", tmp);
+                close(fd);
+                goto fail;
+        }
+
+        for (size_t i = 0; i < nitems(families); ++i) {
+                header = false;
+                for (size_t j = 0; j < s->size; ++j) {
+                        if (!match_family(s->data[j].key, families[i].name))
+                                continue;
+                        if (!header) {
+                                fprintf(fs, "# HELP %s %s\n", families[i].name, families[i].help);
+                                fprintf(fs, "# TYPE %s %s\n", families[i].name, families[i].type);
+                                header = true;
+                        }
+                        fprintf(fs, "%s %.15g\n", s->data[j].key, s->data[j].value);
+                }
+        }
+        for (size_t j = 0; j < s->size; ++j) {
+                matched = false;
+                for (size_t i = 0; i < nitems(families) && !matched; ++i)
+                        matched = match_family(s->data[j].key, families[i].name);
+                if (!matched)
+                        fprintf(fs, "%s %.15g\n", s->data[j].key, s->data[j].value);
+        }
+
+        if (fflush(fs) == EOF || ferror(fs) || fsync(fileno(fs)) < 0) {
+                error_set(err, "file write error: %s", tmp);
+                goto fail;
+        }
+        if (rename(tmp, path) < 0) {
+                error_set(err, "file rename failed: %s", path);
+                goto fail;
+        }
+        rv = 0;
+
+ fail:
+        if (fs != NULL)
+                fclose(fs);
+        if (rv < 0)
+                unlink(tmp);
+        free(tmp);
+        return (rv);
+}
+
+static void
+samples_free(struct samples *s)
+{
+        for (size_t i = 0; i < s->size; ++i)
+                free(s->data[i].key);
+        free(s->data);
+}
+
+void
+metrics_init(struct metrics *m)
+{
+        *m = (struct metrics){.path = secure_getenv("NVC_METRICS_FILE"), .phase = PHASE_INIT};
+        if (strempty(m->path))
+                m->path = NULL;
+        clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+void
+metrics_phase(struct metrics *m, enum metrics_phase phase)
+{
+        if (m->phase < PHASE_DONE)
+                m->durations[m->phase] = elapsed(&m->start);
+        m->phase = phase;
+        clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+/*
+ * Merge the metrics of this run into the metrics file (i.e. NVC_METRICS_FILE), concurrent runs are serialized
+ * through a lock file since the file itself gets replaced on every update.
+ */
+int
+metrics_write(struct error *err, struct metrics *m, const struct nvc_stats *stats)
+{
+        struct samples s = {0};
+        char *lock = NULL;
+        int fd = -1;
+        int rv = -1;
+
+        if (m->path == NULL)
+                return (0);
+
+        if (asprintf(&lock, "%s.lock", m->path) < 0) {
+                error_set(err, "memory allocation failed");
+                return (-1);
+        }
+        if ((fd = open(lock, O_RDWR|O_CREAT|O_CLOEXEC, 0644)) < 0) {
+                error_set(err, "open failed: %s", lock);
+                goto fail;
+        }
+        if (flock(fd, LOCK_EX) < 0) {
+                error_set(err, "file locking failed: %s", lock);
+                goto fail;
+        }
+        if (samples_load(err, &s, m->path) < 0)
+                goto fail;
+
+        if (samples_add(err, &s, 1, METRICS_PREFIX "configure_total") < 0)
+                goto fail;
+        if (m->phase < PHASE_DONE) {
+                if (samples_add(err, &s, 1, METRICS_PREFIX "configure_failures_total{phase=\"%s\"}",
+                    phase_names[m->phase]) < 0)
+                        goto fail;
+        }
+        /* Phases run in order, only account for the ones which completed. */
+        for (size_t i = 0; i < m->phase; ++i) {
+                if (samples_add(err, &s, m->durations[i], METRICS_PREFIX "configure_phase_seconds_sum{phase=\"%s\"}",
+                    phase_names[i]) < 0)
+                        goto fail;
+                if (samples_add(err, &s, 1, METRICS_PREFIX "configure_phase_seconds_count{phase=\"%s\"}",
+                    phase_names[i]) < 0)
+                        goto fail;
+        }
+
+        if (stats != NULL) {
+                if (samples_add(err, &s, (double)stats->mounts, METRICS_PREFIX "mounts_total") < 0)
+                        goto fail;
+                if (samples_add(err, &s, (double)stats->libs_selected, METRICS_PREFIX "libraries_selected_total") < 0)
+                        goto fail;
+                if (samples_add(err, &s, (double)stats->libs_skipped, METRICS_PREFIX "libraries_skipped_total") < 0)
+                        goto fail;
+                if (stats->ldconfig_ns > 0) {
+                        if (samples_add(err, &s, (double)stats->ldconfig_ns / 1e9, METRICS_PREFIX "ldconfig_seconds_sum") < 0)
+                                goto fail;
+                        if (samples_add(err, &s, 1, METRICS_PREFIX "ldconfig_seconds_count") < 0)
+                                goto fail;
+                }
+                for (size_t i = 0; i < stats->nrpcs; ++i) {
+                        if (samples_add(err, &s, (double)stats->rpcs[i].count,
+                            METRICS_PREFIX "driver_rpcs_total{rpc=\"%s\"}", stats->rpcs[i].name) < 0)
+                                goto fail;
+                        if (samples_add(err, &s, (double)stats->rpcs[i].errors,
+                            METRICS_PREFIX "driver_rpc_errors_total{rpc=\"%s\"}", stats->rpcs[i].name) < 0)
+                                goto fail;
+                        if (samples_add(err, &s, (double)stats->rpcs[i].total_ns / 1e9,
+                            METRICS_PREFIX "driver_rpc_seconds_total{rpc=\"%s\"}", stats->rpcs[i].name) < 0)
+                                goto fail;
+                }
+        }
+
+        rv = samples_store(err, &s, m->path);
+
+ fail:
+        samples_free(&s);
+        if (fd >= 0)
+                close(fd);
+        free(lock);
+        return (rv);
+}
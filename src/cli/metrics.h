@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef HEADER_METRICS_H
+#define HEADER_METRICS_H
+
+#include <time.h>
+
+#include "cli.h"
+
+enum metrics_phase {
+        PHASE_INIT,
+        PHASE_CONTAINER,
+        PHASE_INFO,
+        PHASE_MOUNT,
+        PHASE_LDCACHE,
+        PHASE_DONE,
+};
+
+struct metrics {
+        const char *path;
+        enum metrics_phase phase;
+        struct timespec start;
+        double durations[PHASE_DONE];
+};
+
+void metrics_init(struct metrics *);
+void metrics_phase(struct metrics *, enum metrics_phase);
+int metrics_write(struct error *, struct metrics *, const struct nvc_stats *);
+
+#endif /* HEADER_METRICS_H */
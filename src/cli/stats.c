@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <alloca.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "cli.h"
+
+static error_t stats_parser(int, char *, struct argp_state *);
+static size_t percentile(const struct nvc_stats_entry *, unsigned int);
+static const char *bucket_label(char *, size_t, size_t);
+static void print_entries(const char *, const struct nvc_stats_entry *, size_t, bool);
+
+const struct argp stats_usage = {
+        (const struct argp_option[]){
+                {NULL, 0, NULL, 0, "Options:", -1},
+                {"csv", 0x80, NULL, 0, "Output in CSV format", -1},
+                {"repeat", 'n', "N", 0, "Query the driver N times (e.g. to compare transports)", -1},
+                {0},
+        },
+        stats_parser,
+        NULL,
+        "Query the driver and report the call counts and latencies it observed.",
+        NULL,
+        NULL,
+        NULL,
+};
+
+static error_t
+stats_parser(int key, char *arg, struct argp_state *state)
+{
+        struct context *ctx = state->input;
+        struct error err = {0};
+        char *ptr;
+        uintmax_t n;
+
+        switch (key) {
+        case 0x80:
+                ctx->csv_output = true;
+                break;
+        case 'n':
+                if ((n = strtoumax(arg, &ptr, 10)) == 0 || *ptr != '\0' || n > 1000000) {
+                        error_setx(&err, "invalid number of repetitions");
+                        goto fatal;
+                }
+                ctx->repeat = (size_t)n;
+                break;
+        default:
+                return (ARGP_ERR_UNKNOWN);
+        }
+        return (0);
+
+ fatal:
+        errx(EXIT_FAILURE, "input error: %s", err.msg);
+        return (0);
+}
+
+/* Returns the histogram bucket holding the given percentile. */
+static size_t
+percentile(const struct nvc_stats_entry *entry, unsigned int pct)
+{
+        uint64_t n = 0;
+        size_t i;
+
+        for (i = 0; i < NVC_STATS_BUCKETS - 1; ++i) {
+                n += entry->buckets[i];
+                if (n * 100 >= entry->count * pct)
+                        break;
+        }
+        return (i);
+}
+
+static const char *
+bucket_label(char *buf, size_t size, size_t bucket)
+{
+        if (bucket < NVC_STATS_BUCKETS - 1)
+                snprintf(buf, size, "<%"PRIu64, (uint64_t)1 << bucket);
+        else
+                snprintf(buf, size, ">=%"PRIu64, (uint64_t)1 << (bucket - 1));
+        return (buf);
+}
+
+static void
+print_entries(const char *type, const struct nvc_stats_entry *entries, size_t size, bool csv)
+{
+        const struct nvc_stats_entry *e;
+        char p50[16], p99[16];
+
+        if (!csv && size > 0)
+                printf("\n%s:\n%-40s %8s %8s %12s %12s %12s\n", type, "Name", "Count", "Errors",
+                    "Mean (us)", "p50 (us)", "p99 (us)");
+
+        for (size_t i = 0; i < size; ++i) {
+                e = &entries[i];
+                if (csv) {
+                        printf("%s,%s,%"PRIu64",%"PRIu64",%"PRIu64, type, e->name, e->count, e->errors, e->total_ns);
+                        for (size_t j = 0; j < NVC_STATS_BUCKETS; ++j)
+                                printf(",%"PRIu64, e->buckets[j]);
+                        printf("\n");
+                } else {
+                        printf("%-40s %8"PRIu64" %8"PRIu64" %12"PRIu64" %12s %12s\n",
+                            e->name, e->count, e->errors, (e->count > 0) ? e->total_ns / e->count / 1000 : 0,
+                            bucket_label(p50, sizeof(p50), percentile(e, 50)),
+                            bucket_label(p99, sizeof(p99), percentile(e, 99)));
+                }
+        }
+}
+
+int
+stats_command(const struct context *ctx)
+{
+        bool run_as_root;
+        struct nvc_context *nvc = NULL;
+        struct nvc_config *nvc_cfg = NULL;
+        struct nvc_driver_info *drv = NULL;
+        struct nvc_device_info *dev = NULL;
+        struct nvc_stats *stats = NULL;
+        struct error err = {0};
+        char buf[16];
+        int rv = EXIT_FAILURE;
+
+        run_as_root = (geteuid() == 0);
+        if (!run_as_root && ctx->load_kmods) {
+                warnx("requires root privileges");
+                return (rv);
+        }
+        if (run_as_root) {
+                if (perm_set_capabilities(&err, CAP_PERMITTED, permitted_caps, nitems(permitted_caps)) < 0 ||
+                    perm_set_capabilities(&err, CAP_INHERITABLE, inherited_caps, nitems(inherited_caps)) < 0 ||
+                    perm_drop_bounds(&err) < 0) {
+                        warnx("permission error: %s", err.msg);
+                        return (rv);
+                }
+        } else {
+                if (perm_set_capabilities(&err, CAP_PERMITTED, NULL, 0) < 0) {
+                        warnx("permission error: %s", err.msg);
+                        return (rv);
+                }
+        }
+
+        /* Initialize the library context. */
+        int c = ctx->load_kmods ? CAPS_INIT_KMODS : CAPS_INIT;
+        if (run_as_root && perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[c], effective_caps_size(c)) < 0) {
+                warnx("permission error: %s", err.msg);
+                goto fail;
+        }
+        if ((nvc = nvc_context_new()) == NULL ||
+            (nvc_cfg = nvc_config_new()) == NULL) {
+                warn("memory allocation failed");
+                goto fail;
+        }
+        nvc_cfg->uid = (!run_as_root && ctx->uid == (uid_t)-1) ? geteuid() : ctx->uid;
+        nvc_cfg->gid = (!run_as_root && ctx->gid == (gid_t)-1) ? getegid() : ctx->gid;
+        nvc_cfg->ldcache = ctx->ldcache;
+        if (nvc_init_flags(nvc, nvc_cfg, ctx->init_flags) < 0) {
+                warnx("initialization error: %s", nvc_error(nvc));
+                goto fail;
+        }
+
+        /*
+         * Exercise the driver the same way the info command does, then report what the library
+         * and the driver service measured while doing so.
+         */
+        if (run_as_root && perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_INFO], effective_caps_size(CAPS_INFO)) < 0) {
+                warnx("permission error: %s", err.msg);
+                goto fail;
+        }
+        for (size_t i = 0; i < MAX(ctx->repeat, 1); ++i) {
+                nvc_device_info_free(dev);
+                nvc_driver_info_free(drv);
+                dev = NULL;
+                if ((drv = nvc_driver_info_new_flags(nvc, 0)) == NULL ||
+                    (dev = nvc_device_info_new_flags(nvc, 0)) == NULL) {
+                        warnx("detection error: %s", nvc_error(nvc));
+                        goto fail;
+                }
+        }
+        if ((stats = nvc_stats_new(nvc)) == NULL) {
+                warnx("statistics error: %s", nvc_error(nvc));
+                goto fail;
+        }
+
+        if (ctx->csv_output) {
+                printf("Type,Name,Count,Errors,Total (ns)");
+                for (size_t i = 0; i < NVC_STATS_BUCKETS; ++i)
+                        printf(",%sus", bucket_label(buf, sizeof(buf), i));
+                printf("\n");
+        }
+        print_entries("Client RPCs", stats->rpcs, stats->nrpcs, ctx->csv_output);
+        print_entries("Service procedures", stats->procs, stats->nprocs, ctx->csv_output);
+        print_entries("Driver calls", stats->calls, stats->ncalls, ctx->csv_output);
+
+        if (run_as_root && perm_set_capabilities(&err, CAP_EFFECTIVE, effective_caps[CAPS_SHUTDOWN], effective_caps_size(CAPS_SHUTDOWN)) < 0) {
+                warnx("permission error: %s", err.msg);
+                goto fail;
+        }
+        rv = EXIT_SUCCESS;
+ fail:
+        nvc_shutdown(nvc);
+        nvc_stats_free(stats);
+        nvc_device_info_free(dev);
+        nvc_driver_info_free(drv);
+        nvc_config_free(nvc_cfg);
+        nvc_context_free(nvc);
+        error_reset(&err);
+        return (rv);
+}
@@ -2,13 +2,17 @@
  * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <sys/param.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
@@ -32,26 +36,99 @@
 #define SONAME_LIBCUDA "libcuda.so.1"
 #define SONAME_LIBNVML "libnvidia-ml.so.1"
 
-#define MAX_DEVICES     64
 #define REAP_TIMEOUT_MS 10
 
+#ifdef WITH_SEQPACKET
+# define SOCK_TYPE SOCK_SEQPACKET
+#else
+# define SOCK_TYPE SOCK_STREAM
+#endif /* WITH_SEQPACKET */
+
 static int reset_cuda_environment(struct error *);
 static int setup_rpc_client(struct driver *);
 static noreturn void setup_rpc_service(struct driver *, uid_t, gid_t, pid_t);
 static int reap_process(struct error *, pid_t, int, bool);
+static int wait_rpc_service(struct driver *);
+static int open_device(struct driver *, CUdevice, unsigned int *);
+static struct driver_device *lookup_device(struct driver *, unsigned int);
+static void dispatch_rpc_service(struct svc_req *, SVCXPRT *);
+static void record_stat(u_int *, driver_stat **, const char *, bool, const struct timespec *);
+static int copy_stats(struct error *, u_int *, driver_stat **, u_int, const driver_stat *);
+static const char *lookup_name(const char * const [], size_t, int);
+
+#ifdef WITH_SEQPACKET
+# ifdef WITH_TIRPC
+typedef rpcproc_t ipc_proc_t;
+typedef void *ipc_ptr_t;
+# else
+typedef u_long ipc_proc_t;
+typedef caddr_t ipc_ptr_t;
+# endif /* WITH_TIRPC */
+
+static CLIENT *ipc_client_create(struct error *, int, int);
+static enum clnt_stat ipc_client_call(CLIENT *, ipc_proc_t, xdrproc_t, ipc_ptr_t, xdrproc_t, ipc_ptr_t, struct timeval);
+static void ipc_client_destroy(CLIENT *);
+static SVCXPRT *ipc_service_create(struct error *, int);
+static void ipc_service_run(SVCXPRT *);
+static bool_t ipc_service_getargs(SVCXPRT *, xdrproc_t, ipc_ptr_t);
+static bool_t ipc_service_reply(SVCXPRT *, struct rpc_msg *);
+static bool_t ipc_service_freeargs(SVCXPRT *, xdrproc_t, ipc_ptr_t);
+static void ipc_service_destroy(SVCXPRT *);
+#endif /* WITH_SEQPACKET */
 
-static struct driver_device {
-        nvmlDevice_t nvml;
-        CUdevice cuda;
-} device_handles[MAX_DEVICES];
+/*
+ * Device handles opened by the service, indexed by CUDA device ordinal.
+ * Clients refer to them through their index which remains valid as the registry grows.
+ */
+static struct {
+        struct driver_device {
+                bool opened;
+                nvmlDevice_t nvml;
+                CUdevice cuda;
+        } *devs;
+        size_t size;
+} device_registry;
+
+static struct error init_error;
+
+/*
+ * Call counts and latency histograms of the service, that is, the procedures it serves as well as the driver library
+ * calls they make. Each client records its own RPCs in its context. Bucket i counts the calls which took less than
+ * 2^i us.
+ */
+static struct driver_stats stats_registry;
+
+static const char * const procedure_names[] = {
+        [DRIVER_INIT]                = "driver_init_1",
+        [DRIVER_SHUTDOWN]            = "driver_shutdown_1",
+        [DRIVER_GET_RM_VERSION]      = "driver_get_rm_version_1",
+        [DRIVER_GET_CUDA_VERSION]    = "driver_get_cuda_version_1",
+        [DRIVER_GET_DEVICE_COUNT]    = "driver_get_device_count_1",
+        [DRIVER_GET_DEVICE]          = "driver_get_device_1",
+        [DRIVER_GET_DEVICE_MINOR]    = "driver_get_device_minor_1",
+        [DRIVER_GET_DEVICE_BUSID]    = "driver_get_device_busid_1",
+        [DRIVER_GET_DEVICE_UUID]     = "driver_get_device_uuid_1",
+        [DRIVER_GET_DEVICE_ARCH]     = "driver_get_device_arch_1",
+        [DRIVER_GET_DEVICE_MODEL]    = "driver_get_device_model_1",
+        [DRIVER_GET_DEVICE_BY_UUID]  = "driver_get_device_by_uuid_1",
+        [DRIVER_GET_DEVICE_BY_BUSID] = "driver_get_device_by_busid_1",
+        [DRIVER_GET_STATS]           = "driver_get_stats_1",
+        [DRIVER_GET_DEVICE_PROPS]    = "driver_get_device_props_1",
+};
+
+#define stats_record(field, name, failed, start) \
+        record_stat(&stats_registry.field.field##_len, &stats_registry.field.field##_val, name, failed, start)
 
 #define call_nvml(ctx, sym, ...) __extension__ ({                                                      \
         union {void *ptr; __typeof__(&sym) fn;} u_;                                                    \
         nvmlReturn_t r_;                                                                               \
+        struct timespec t_;                                                                            \
                                                                                                        \
+        clock_gettime(CLOCK_MONOTONIC, &t_);                                                           \
         dlerror();                                                                                     \
         u_.ptr = dlsym((ctx)->nvml_dl, #sym);                                                          \
         r_ = (dlerror() == NULL) ? (*u_.fn)(__VA_ARGS__) : NVML_ERROR_FUNCTION_NOT_FOUND;              \
+        stats_record(calls, #sym, r_ != NVML_SUCCESS, &t_);                                            \
         if (r_ != NVML_SUCCESS)                                                                        \
                 error_set_nvml((ctx)->err, (ctx)->nvml_dl, r_, "nvml error");                          \
         (r_ == NVML_SUCCESS) ? 0 : -1;                                                                 \
@@ -60,28 +137,55 @@ static struct driver_device {
 #define call_cuda(ctx, sym, ...) __extension__ ({                                                      \
         union {void *ptr; __typeof__(&sym) fn;} u_;                                                    \
         CUresult r_;                                                                                   \
+        struct timespec t_;                                                                            \
                                                                                                        \
+        clock_gettime(CLOCK_MONOTONIC, &t_);                                                           \
         dlerror();                                                                                     \
         u_.ptr = dlsym((ctx)->cuda_dl, #sym);                                                          \
         r_ = (dlerror() == NULL) ? (*u_.fn)(__VA_ARGS__) : CUDA_ERROR_SHARED_OBJECT_SYMBOL_NOT_FOUND;  \
+        stats_record(calls, #sym, r_ != CUDA_SUCCESS, &t_);                                            \
         if (r_ != CUDA_SUCCESS)                                                                        \
                 error_set_cuda((ctx)->err, (ctx)->cuda_dl, r_, "cuda error");                          \
         (r_ == CUDA_SUCCESS) ? 0 : -1;                                                                 \
 })
 
-#define call_rpc(ctx, res, func, ...) __extension__ ({                                                 \
+#ifdef WITH_SEQPACKET
+#define send_rpc(ctx, res, func, ...) __extension__ ({                                                 \
         enum clnt_stat r_;                                                                             \
+        struct timespec t_;                                                                            \
+                                                                                                       \
+        static_assert(sizeof(ptr_t) >= sizeof(intptr_t), "incompatible types");                        \
+        clock_gettime(CLOCK_MONOTONIC, &t_);                                                           \
+        if ((r_ = func((ptr_t)ctx, ##__VA_ARGS__, res, (ctx)->rpc_clt)) != RPC_SUCCESS)                \
+                error_set_rpc((ctx)->err, r_, "driver error");                                         \
+        else if ((res)->errcode != 0)                                                                  \
+                error_from_xdr((ctx)->err, res);                                                       \
+        record_stat(&(ctx)->nrpcs, &(ctx)->rpcs, #func,                                                \
+            r_ != RPC_SUCCESS || (res)->errcode != 0, &t_);                                            \
+        (r_ == RPC_SUCCESS && (res)->errcode == 0) ? 0 : -1;                                           \
+})
+#else
+#define send_rpc(ctx, res, func, ...) __extension__ ({                                                 \
+        enum clnt_stat r_;                                                                             \
+        struct timespec t_;                                                                            \
         struct sigaction osa_, sa_ = {.sa_handler = SIG_IGN};                                          \
                                                                                                        \
         static_assert(sizeof(ptr_t) >= sizeof(intptr_t), "incompatible types");                        \
         sigaction(SIGPIPE, &sa_, &osa_);                                                               \
+        clock_gettime(CLOCK_MONOTONIC, &t_);                                                           \
         if ((r_ = func((ptr_t)ctx, ##__VA_ARGS__, res, (ctx)->rpc_clt)) != RPC_SUCCESS)                \
                 error_set_rpc((ctx)->err, r_, "driver error");                                         \
         else if ((res)->errcode != 0)                                                                  \
                 error_from_xdr((ctx)->err, res);                                                       \
+        record_stat(&(ctx)->nrpcs, &(ctx)->rpcs, #func,                                                \
+            r_ != RPC_SUCCESS || (res)->errcode != 0, &t_);                                            \
         sigaction(SIGPIPE, &osa_, NULL);                                                               \
         (r_ == RPC_SUCCESS && (res)->errcode == 0) ? 0 : -1;                                           \
 })
+#endif /* WITH_SEQPACKET */
+
+#define call_rpc(ctx, res, func, ...) \
+        ((wait_rpc_service(ctx) < 0) ? -1 : send_rpc(ctx, res, func, ##__VA_ARGS__))
 
 static int
 reset_cuda_environment(struct error *err)
@@ -106,6 +210,17 @@ reset_cuda_environment(struct error *err)
         return (0);
 }
 
+#ifdef WITH_SEQPACKET
+static int
+setup_rpc_client(struct driver *ctx)
+{
+        xclose(ctx->fd[SOCK_SVC]);
+
+        if ((ctx->rpc_clt = ipc_client_create(ctx->err, ctx->fd[SOCK_CLT], 1000)) == NULL)
+                return (-1);
+        return (0);
+}
+#else
 static int
 setup_rpc_client(struct driver *ctx)
 {
@@ -127,6 +242,7 @@ setup_rpc_client(struct driver *ctx)
         clnt_control(ctx->rpc_clt, CLSET_TIMEOUT, (char *)&timeout);
         return (0);
 }
+#endif /* WITH_SEQPACKET */
 
 static void
 setup_rpc_service(struct driver *ctx, uid_t uid, gid_t gid, pid_t ppid)
@@ -159,21 +275,38 @@ setup_rpc_service(struct driver *ctx, uid_t uid, gid_t gid, pid_t ppid)
         if (reset_cuda_environment(ctx->err) < 0)
                 goto fail;
 
+        /*
+         * Initialize the driver libraries before serving any request, this overlaps with the work done by our parent
+         * until its first call. Failures are reported back to the client in response to its DRIVER_INIT request.
+         */
+        if (call_cuda(ctx, cuInit, 0) < 0 || call_nvml(ctx, nvmlInit_v2) < 0) {
+                init_error = *ctx->err;
+                *ctx->err = (struct error){0};
+        }
+
+#ifdef WITH_SEQPACKET
+        if ((ctx->rpc_svc = ipc_service_create(ctx->err, ctx->fd[SOCK_SVC])) == NULL)
+                goto fail;
+        ipc_service_run(ctx->rpc_svc);
+#else
         if ((ctx->rpc_svc = svcunixfd_create(ctx->fd[SOCK_SVC], 0, 0)) == NULL ||
-            !svc_register(ctx->rpc_svc, DRIVER_PROGRAM, DRIVER_VERSION, driver_program_1, 0)) {
+            !svc_register(ctx->rpc_svc, DRIVER_PROGRAM, DRIVER_VERSION, dispatch_rpc_service, 0)) {
                 error_setx(ctx->err, "program registration failed");
                 goto fail;
         }
         svc_run();
+#endif /* WITH_SEQPACKET */
 
         log_info("terminating driver service");
         svc_destroy(ctx->rpc_svc);
+        log_flush();
         _exit(EXIT_SUCCESS);
 
  fail:
         log_errf("could not start driver service: %s", ctx->err->msg);
         if (ctx->rpc_svc != NULL)
                 svc_destroy(ctx->rpc_svc);
+        log_flush();
         _exit(EXIT_FAILURE);
 }
 
@@ -209,6 +342,312 @@ reap_process(struct error *err, pid_t pid, int fd, bool force)
         return (ret);
 }
 
+static int
+wait_rpc_service(struct driver *ctx)
+{
+        struct driver_init_res res = {0};
+        int ret;
+
+        if (ctx->initialized)
+                return (0);
+
+        ret = send_rpc(ctx, &res, driver_init_1);
+        xdr_free((xdrproc_t)xdr_driver_init_res, (caddr_t)&res);
+        if (ret < 0)
+                return (-1);
+        ctx->initialized = true;
+        return (0);
+}
+
+static void
+dispatch_rpc_service(struct svc_req *req, SVCXPRT *xprt)
+{
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        driver_program_1(req, xprt);
+        if (req->rq_proc < nitems(procedure_names) && procedure_names[req->rq_proc] != NULL)
+                stats_record(procs, procedure_names[req->rq_proc], false, &start);
+}
+
+static void
+record_stat(u_int *len, driver_stat **stats, const char *name, bool failed, const struct timespec *start)
+{
+        struct timespec end;
+        driver_stat *stat = NULL, *ptr;
+        uint64_t elapsed, us;
+        size_t bucket;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000000 + (uint64_t)end.tv_nsec - (uint64_t)start->tv_nsec;
+
+        for (u_int i = 0; i < *len; ++i) {
+                if ((*stats)[i].name == name || !strcmp((*stats)[i].name, name)) {
+                        stat = &(*stats)[i];
+                        break;
+                }
+        }
+        if (stat == NULL) {
+                /* Statistics are best effort, drop the sample if we run out of memory. */
+                if ((ptr = realloc(*stats, (*len + 1) * sizeof(*ptr))) == NULL)
+                        return;
+                *stats = ptr;
+                stat = &ptr[(*len)++];
+                *stat = (driver_stat){.name = (char *)name};
+        }
+
+        us = elapsed / 1000;
+        for (bucket = 0; bucket < DRIVER_STATS_BUCKETS - 1 && us > 0; ++bucket)
+                us >>= 1;
+        ++stat->count;
+        ++stat->buckets[bucket];
+        stat->total += elapsed;
+        if (failed)
+                ++stat->errors;
+}
+
+static int
+copy_stats(struct error *err, u_int *len, driver_stat **dst, u_int size, const driver_stat *src)
+{
+        if (size == 0)
+                return (0);
+        if ((*dst = xcalloc(err, size, sizeof(**dst))) == NULL)
+                return (-1);
+        *len = size;
+        for (u_int i = 0; i < size; ++i) {
+                (*dst)[i] = src[i];
+                if (((*dst)[i].name = xstrdup(err, src[i].name)) == NULL)
+                        return (-1);
+        }
+        return (0);
+}
+
+#ifdef WITH_SEQPACKET
+/*
+ * Lightweight replacement for the ONC RPC unix transports.
+ *
+ * Each call is a single datagram made of a fixed-size header followed by the XDR encoded arguments, and its reply
+ * a single datagram made of the same header followed by the XDR encoded results. This skips the record marking,
+ * the RPC message headers and authentication, while keeping the generated client stubs and service dispatcher.
+ */
+
+#define IPC_MSG_MAX 65536
+
+struct ipc_header {
+        uint32_t xid;
+        uint32_t proc;
+        int32_t stat;
+};
+
+struct ipc_client {
+        CLIENT clnt;
+        int fd;
+        int timeout;
+        uint32_t xid;
+        char buf[IPC_MSG_MAX];
+};
+
+struct ipc_service {
+        SVCXPRT xprt;
+        int fd;
+        struct ipc_header hdr;
+        size_t len;
+        char buf[IPC_MSG_MAX];
+};
+
+static struct clnt_ops ipc_client_ops = {
+        .cl_call = ipc_client_call,
+        .cl_destroy = ipc_client_destroy,
+};
+
+static const struct xp_ops ipc_service_ops = {
+        .xp_getargs = ipc_service_getargs,
+        .xp_reply = ipc_service_reply,
+        .xp_freeargs = ipc_service_freeargs,
+        .xp_destroy = ipc_service_destroy,
+};
+
+static CLIENT *
+ipc_client_create(struct error *err, int fd, int timeout)
+{
+        struct ipc_client *ipc;
+
+        if ((ipc = xcalloc(err, 1, sizeof(*ipc))) == NULL)
+                return (NULL);
+        ipc->clnt.cl_ops = &ipc_client_ops;
+        ipc->clnt.cl_private = (void *)ipc;
+        ipc->fd = fd;
+        ipc->timeout = timeout;
+        return (&ipc->clnt);
+}
+
+static enum clnt_stat
+ipc_client_call(CLIENT *clnt, ipc_proc_t proc, xdrproc_t xargs, ipc_ptr_t args,
+    xdrproc_t xres, ipc_ptr_t res, maybe_unused struct timeval timeout)
+{
+        struct ipc_client *ipc = (struct ipc_client *)clnt->cl_private;
+        struct ipc_header hdr = {.xid = ++ipc->xid, .proc = (uint32_t)proc};
+        struct ipc_header rep;
+        struct pollfd fds = {.fd = ipc->fd, .events = POLLIN};
+        enum clnt_stat stat;
+        XDR xdrs;
+        ssize_t n;
+
+        xdrmem_create(&xdrs, ipc->buf + sizeof(hdr), IPC_MSG_MAX - sizeof(hdr), XDR_ENCODE);
+        if (!(*xargs)(&xdrs, args)) {
+                xdr_destroy(&xdrs);
+                return (RPC_CANTENCODEARGS);
+        }
+        memcpy(ipc->buf, &hdr, sizeof(hdr));
+        n = send(ipc->fd, ipc->buf, sizeof(hdr) + xdr_getpos(&xdrs), MSG_NOSIGNAL);
+        xdr_destroy(&xdrs);
+        if (n < 0)
+                return (RPC_CANTSEND);
+
+        /* Discard any reply to a previous call which timed out. */
+        for (;;) {
+                switch (poll(&fds, 1, ipc->timeout)) {
+                case -1:
+                        if (errno == EINTR)
+                                continue;
+                        return (RPC_CANTRECV);
+                case 0:
+                        return (RPC_TIMEDOUT);
+                }
+                if ((n = recv(ipc->fd, ipc->buf, IPC_MSG_MAX, 0)) < (ssize_t)sizeof(rep))
+                        return (RPC_CANTRECV);
+                memcpy(&rep, ipc->buf, sizeof(rep));
+                if (rep.xid == hdr.xid)
+                        break;
+        }
+        if (rep.stat != RPC_SUCCESS)
+                return ((enum clnt_stat)rep.stat);
+
+        xdrmem_create(&xdrs, ipc->buf + sizeof(rep), (u_int)((size_t)n - sizeof(rep)), XDR_DECODE);
+        stat = (*xres)(&xdrs, res) ? RPC_SUCCESS : RPC_CANTDECODERES;
+        xdr_destroy(&xdrs);
+        return (stat);
+}
+
+static void
+ipc_client_destroy(CLIENT *clnt)
+{
+        free(clnt->cl_private);
+}
+
+static SVCXPRT *
+ipc_service_create(struct error *err, int fd)
+{
+        struct ipc_service *ipc;
+
+        if ((ipc = xcalloc(err, 1, sizeof(*ipc))) == NULL)
+                return (NULL);
+        ipc->xprt.xp_ops = &ipc_service_ops;
+        ipc->xprt.xp_p1 = (void *)ipc;
+        ipc->fd = fd;
+        return (&ipc->xprt);
+}
+
+static void
+ipc_service_run(SVCXPRT *xprt)
+{
+        struct ipc_service *ipc = (struct ipc_service *)xprt->xp_p1;
+        struct svc_req req;
+        ssize_t n;
+
+        for (;;) {
+                if ((n = recv(ipc->fd, ipc->buf, IPC_MSG_MAX, 0)) < 0 && errno == EINTR)
+                        continue;
+                if (n < (ssize_t)sizeof(ipc->hdr))
+                        break;
+                memcpy(&ipc->hdr, ipc->buf, sizeof(ipc->hdr));
+                ipc->len = (size_t)n - sizeof(ipc->hdr);
+
+                req = (struct svc_req){
+                        .rq_prog = DRIVER_PROGRAM,
+                        .rq_vers = DRIVER_VERSION,
+                        .rq_proc = ipc->hdr.proc,
+                        .rq_xprt = xprt,
+                };
+                dispatch_rpc_service(&req, xprt);
+
+                /* If the shutdown failed, the client terminates us anyway. */
+                if (req.rq_proc == DRIVER_SHUTDOWN)
+                        break;
+        }
+}
+
+static bool_t
+ipc_service_getargs(SVCXPRT *xprt, xdrproc_t xargs, ipc_ptr_t args)
+{
+        struct ipc_service *ipc = (struct ipc_service *)xprt->xp_p1;
+        XDR xdrs;
+        bool_t ret;
+
+        xdrmem_create(&xdrs, ipc->buf + sizeof(ipc->hdr), (u_int)ipc->len, XDR_DECODE);
+        ret = (*xargs)(&xdrs, args);
+        xdr_destroy(&xdrs);
+        return (ret);
+}
+
+static bool_t
+ipc_service_reply(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+        struct ipc_service *ipc = (struct ipc_service *)xprt->xp_p1;
+        struct ipc_header rep = ipc->hdr;
+        XDR xdrs;
+        size_t len = 0;
+        ssize_t n;
+
+        rep.stat = RPC_SUCCESS;
+        if (msg->rm_reply.rp_stat != MSG_ACCEPTED) {
+                rep.stat = RPC_AUTHERROR;
+        } else {
+                switch (msg->acpted_rply.ar_stat) {
+                case SUCCESS:
+                        xdrmem_create(&xdrs, ipc->buf + sizeof(rep), IPC_MSG_MAX - sizeof(rep), XDR_ENCODE);
+                        if ((*msg->acpted_rply.ar_results.proc)(&xdrs, msg->acpted_rply.ar_results.where))
+                                len = xdr_getpos(&xdrs);
+                        else
+                                rep.stat = RPC_SYSTEMERROR;
+                        xdr_destroy(&xdrs);
+                        break;
+                case PROG_UNAVAIL:
+                        rep.stat = RPC_PROGUNAVAIL;
+                        break;
+                case PROG_MISMATCH:
+                        rep.stat = RPC_PROGVERSMISMATCH;
+                        break;
+                case PROC_UNAVAIL:
+                        rep.stat = RPC_PROCUNAVAIL;
+                        break;
+                case GARBAGE_ARGS:
+                        rep.stat = RPC_CANTDECODEARGS;
+                        break;
+                default:
+                        rep.stat = RPC_SYSTEMERROR;
+                        break;
+                }
+        }
+        memcpy(ipc->buf, &rep, sizeof(rep));
+        n = send(ipc->fd, ipc->buf, sizeof(rep) + len, MSG_NOSIGNAL);
+        return (n >= 0);
+}
+
+static bool_t
+ipc_service_freeargs(maybe_unused SVCXPRT *xprt, xdrproc_t xargs, ipc_ptr_t args)
+{
+        xdr_free(xargs, args);
+        return (true);
+}
+
+static void
+ipc_service_destroy(SVCXPRT *xprt)
+{
+        free(xprt->xp_p1);
+}
+#endif /* WITH_SEQPACKET */
+
 int
 driver_program_1_freeresult(maybe_unused SVCXPRT *svc, xdrproc_t xdr_result, caddr_t res)
 {
@@ -219,11 +658,9 @@ driver_program_1_freeresult(maybe_unused SVCXPRT *svc, xdrproc_t xdr_result, cad
 int
 driver_init(struct driver *ctx, struct error *err, uid_t uid, gid_t gid)
 {
-        int ret;
         pid_t pid;
-        struct driver_init_res res = {0};
 
-        *ctx = (struct driver){err, NULL, NULL, {-1, -1}, -1, NULL, NULL};
+        *ctx = (struct driver){err, NULL, NULL, {-1, -1}, -1, NULL, NULL, false, NULL, 0};
 
         if ((ctx->cuda_dl = xdlopen(err, SONAME_LIBCUDA, RTLD_NOW)) == NULL)
                 goto fail;
@@ -231,7 +668,8 @@ driver_init(struct driver *ctx, struct error *err, uid_t uid, gid_t gid)
                 goto fail;
 
         pid = getpid();
-        if (socketpair(PF_LOCAL, SOCK_STREAM|SOCK_CLOEXEC, 0, ctx->fd) < 0 || (ctx->pid = fork()) < 0) {
+        log_flush();
+        if (socketpair(PF_LOCAL, SOCK_TYPE|SOCK_CLOEXEC, 0, ctx->fd) < 0 || (ctx->pid = fork()) < 0) {
                 error_set(err, "process creation failed");
                 goto fail;
         }
@@ -240,11 +678,10 @@ driver_init(struct driver *ctx, struct error *err, uid_t uid, gid_t gid)
         if (setup_rpc_client(ctx) < 0)
                 goto fail;
 
-        ret = call_rpc(ctx, &res, driver_init_1);
-        xdr_free((xdrproc_t)xdr_driver_init_res, (caddr_t)&res);
-        if (ret < 0)
-                goto fail;
-
+        /*
+         * Don't wait for the driver libraries to be initialized, the first call to the service will block until
+         * they are (see wait_rpc_service).
+         */
         return (0);
 
  fail:
@@ -261,19 +698,10 @@ driver_init(struct driver *ctx, struct error *err, uid_t uid, gid_t gid)
 }
 
 bool_t
-driver_init_1_svc(ptr_t ctxptr, driver_init_res *res, maybe_unused struct svc_req *req)
+driver_init_1_svc(maybe_unused ptr_t ctxptr, driver_init_res *res, maybe_unused struct svc_req *req)
 {
-        struct driver *ctx = (struct driver *)ctxptr;
-
         memset(res, 0, sizeof(*res));
-        if (call_cuda(ctx, cuInit, 0) < 0)
-                goto fail;
-        if (call_nvml(ctx, nvmlInit_v2) < 0)
-                goto fail;
-        return (true);
-
- fail:
-        error_to_xdr(ctx->err, res);
+        error_to_xdr(&init_error, res);
         return (true);
 }
 
@@ -283,10 +711,14 @@ driver_shutdown(struct driver *ctx)
         int ret;
         struct driver_shutdown_res res = {0};
 
-        ret = call_rpc(ctx, &res, driver_shutdown_1);
+        ret = send_rpc(ctx, &res, driver_shutdown_1);
         xdr_free((xdrproc_t)xdr_driver_shutdown_res, (caddr_t)&res);
         if (ret < 0)
                 log_warnf("could not terminate driver service: %s", ctx->err->msg);
+        /* The names recorded are string literals, only the array is ours. */
+        free(ctx->rpcs);
+        ctx->rpcs = NULL;
+        ctx->nrpcs = 0;
 
         if (reap_process(ctx->err, ctx->pid, ctx->fd[SOCK_CLT], (ret < 0)) < 0)
                 return (-1);
@@ -299,7 +731,7 @@ driver_shutdown(struct driver *ctx)
         if (xdlclose(ctx->err, ctx->nvml_dl) < 0)
                 return (-1);
 
-        *ctx = (struct driver){NULL, NULL, NULL, {-1, -1}, -1, NULL, NULL};
+        *ctx = (struct driver){NULL, NULL, NULL, {-1, -1}, -1, NULL, NULL, false, NULL, 0};
         return (0);
 }
 
@@ -424,14 +856,14 @@ driver_get_device_count_1_svc(ptr_t ctxptr, driver_get_device_count_res *res, ma
 }
 
 int
-driver_get_device(struct driver *ctx, unsigned int idx, struct driver_device **dev)
+driver_get_device(struct driver *ctx, unsigned int idx, unsigned int *dev)
 {
         struct driver_get_device_res res = {0};
         int rv = -1;
 
         if (call_rpc(ctx, &res, driver_get_device_1, idx) < 0)
                 goto fail;
-        *dev = (struct driver_device *)res.driver_get_device_res_u.dev;
+        *dev = res.driver_get_device_res_u.dev;
         rv = 0;
 
  fail:
@@ -439,31 +871,146 @@ driver_get_device(struct driver *ctx, unsigned int idx, struct driver_device **d
         return (rv);
 }
 
+static int
+open_device(struct driver *ctx, CUdevice cuda, unsigned int *dev)
+{
+        struct driver_device *handle, *ptr;
+        size_t size;
+        int domainid, deviceid, busid;
+        char buf[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE + 1];
+
+        if (cuda < 0) {
+                error_setx(ctx->err, "invalid device ordinal");
+                return (-1);
+        }
+        if ((size_t)cuda >= device_registry.size) {
+                size = MAX(device_registry.size * 2, (size_t)cuda + 1);
+                if ((ptr = xrealloc(ctx->err, device_registry.devs, size * sizeof(*ptr))) == NULL)
+                        return (-1);
+                memset(ptr + device_registry.size, 0, (size - device_registry.size) * sizeof(*ptr));
+                device_registry.devs = ptr;
+                device_registry.size = size;
+        }
+        handle = &device_registry.devs[cuda];
+        if (handle->opened)
+                goto done;
+
+        if (call_cuda(ctx, cuDeviceGetAttribute, &domainid, CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID, cuda) < 0)
+                return (-1);
+        if (call_cuda(ctx, cuDeviceGetAttribute, &busid, CU_DEVICE_ATTRIBUTE_PCI_BUS_ID, cuda) < 0)
+                return (-1);
+        if (call_cuda(ctx, cuDeviceGetAttribute, &deviceid, CU_DEVICE_ATTRIBUTE_PCI_DEVICE_ID, cuda) < 0)
+                return (-1);
+        snprintf(buf, sizeof(buf), "%08x:%02x:%02x.0", domainid, busid, deviceid);
+        if (call_nvml(ctx, nvmlDeviceGetHandleByPciBusId_v2, buf, &handle->nvml) < 0)
+                return (-1);
+        handle->cuda = cuda;
+        handle->opened = true;
+
+ done:
+        *dev = (unsigned int)cuda;
+        return (0);
+}
+
+static struct driver_device *
+lookup_device(struct driver *ctx, unsigned int dev)
+{
+        if (dev >= device_registry.size || !device_registry.devs[dev].opened) {
+                error_setx(ctx->err, "invalid device handle: %u", dev);
+                return (NULL);
+        }
+        return (&device_registry.devs[dev]);
+}
+
 bool_t
 driver_get_device_1_svc(ptr_t ctxptr, u_int idx, driver_get_device_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        int domainid, deviceid, busid;
-        char buf[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE + 1];
+        CUdevice cuda;
 
         memset(res, 0, sizeof(*res));
-        if (idx >= MAX_DEVICES) {
-                error_setx(ctx->err, "too many devices");
+        if (idx > INT_MAX) {
+                error_setx(ctx->err, "invalid device index: %u", idx);
                 goto fail;
         }
-        if (call_cuda(ctx, cuDeviceGet, &device_handles[idx].cuda, (int)idx) < 0)
+        if (call_cuda(ctx, cuDeviceGet, &cuda, (int)idx) < 0)
                 goto fail;
-        if (call_cuda(ctx, cuDeviceGetAttribute, &domainid, CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID, device_handles[idx].cuda) < 0)
+        if (open_device(ctx, cuda, &res->driver_get_device_res_u.dev) < 0)
                 goto fail;
-        if (call_cuda(ctx, cuDeviceGetAttribute, &busid, CU_DEVICE_ATTRIBUTE_PCI_BUS_ID, device_handles[idx].cuda) < 0)
+        return (true);
+
+ fail:
+        error_to_xdr(ctx->err, res);
+        return (true);
+}
+
+int
+driver_get_device_by_uuid(struct driver *ctx, const char *uuid, unsigned int *dev)
+{
+        struct driver_get_device_by_uuid_res res = {0};
+        int rv = -1;
+
+        if (call_rpc(ctx, &res, driver_get_device_by_uuid_1, (char *)uuid) < 0)
                 goto fail;
-        if (call_cuda(ctx, cuDeviceGetAttribute, &deviceid, CU_DEVICE_ATTRIBUTE_PCI_DEVICE_ID, device_handles[idx].cuda) < 0)
+        *dev = res.driver_get_device_by_uuid_res_u.dev;
+        rv = 0;
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_get_device_by_uuid_res, (caddr_t)&res);
+        return (rv);
+}
+
+bool_t
+driver_get_device_by_uuid_1_svc(ptr_t ctxptr, char *uuid, driver_get_device_by_uuid_res *res, maybe_unused struct svc_req *req)
+{
+        struct driver *ctx = (struct driver *)ctxptr;
+        nvmlDevice_t nvml;
+        nvmlPciInfo_t pci;
+        CUdevice cuda;
+
+        memset(res, 0, sizeof(*res));
+        if (call_nvml(ctx, nvmlDeviceGetHandleByUUID, uuid, &nvml) < 0)
                 goto fail;
-        snprintf(buf, sizeof(buf), "%08x:%02x:%02x.0", domainid, busid, deviceid);
-        if (call_nvml(ctx, nvmlDeviceGetHandleByPciBusId_v2, buf, &device_handles[idx].nvml) < 0)
+        if (call_nvml(ctx, nvmlDeviceGetPciInfo_v2, nvml, &pci) < 0)
+                goto fail;
+        if (call_cuda(ctx, cuDeviceGetByPCIBusId, &cuda, pci.busId) < 0)
+                goto fail;
+        if (open_device(ctx, cuda, &res->driver_get_device_by_uuid_res_u.dev) < 0)
+                goto fail;
+        return (true);
+
+ fail:
+        error_to_xdr(ctx->err, res);
+        return (true);
+}
+
+int
+driver_get_device_by_busid(struct driver *ctx, const char *busid, unsigned int *dev)
+{
+        struct driver_get_device_by_busid_res res = {0};
+        int rv = -1;
+
+        if (call_rpc(ctx, &res, driver_get_device_by_busid_1, (char *)busid) < 0)
                 goto fail;
+        *dev = res.driver_get_device_by_busid_res_u.dev;
+        rv = 0;
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_get_device_by_busid_res, (caddr_t)&res);
+        return (rv);
+}
+
+bool_t
+driver_get_device_by_busid_1_svc(ptr_t ctxptr, char *busid, driver_get_device_by_busid_res *res, maybe_unused struct svc_req *req)
+{
+        struct driver *ctx = (struct driver *)ctxptr;
+        CUdevice cuda;
 
-        res->driver_get_device_res_u.dev = (ptr_t)&device_handles[idx];
+        memset(res, 0, sizeof(*res));
+        if (call_cuda(ctx, cuDeviceGetByPCIBusId, &cuda, busid) < 0)
+                goto fail;
+        if (open_device(ctx, cuda, &res->driver_get_device_by_busid_res_u.dev) < 0)
+                goto fail;
         return (true);
 
  fail:
@@ -472,12 +1019,12 @@ driver_get_device_1_svc(ptr_t ctxptr, u_int idx, driver_get_device_res *res, may
 }
 
 int
-driver_get_device_minor(struct driver *ctx, struct driver_device *dev, unsigned int *minor)
+driver_get_device_minor(struct driver *ctx, unsigned int dev, unsigned int *minor)
 {
         struct driver_get_device_minor_res res = {0};
         int rv = -1;
 
-        if (call_rpc(ctx, &res, driver_get_device_minor_1, (ptr_t)dev) < 0)
+        if (call_rpc(ctx, &res, driver_get_device_minor_1, dev) < 0)
                 goto fail;
         *minor = res.driver_get_device_minor_res_u.minor;
         rv = 0;
@@ -488,13 +1035,15 @@ driver_get_device_minor(struct driver *ctx, struct driver_device *dev, unsigned
 }
 
 bool_t
-driver_get_device_minor_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_minor_res *res, maybe_unused struct svc_req *req)
+driver_get_device_minor_1_svc(ptr_t ctxptr, u_int dev, driver_get_device_minor_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        struct driver_device *handle = (struct driver_device *)dev;
+        struct driver_device *handle;
         unsigned int minor;
 
         memset(res, 0, sizeof(*res));
+        if ((handle = lookup_device(ctx, dev)) == NULL)
+                goto fail;
         if (call_nvml(ctx, nvmlDeviceGetMinorNumber, handle->nvml, &minor) < 0)
                 goto fail;
         res->driver_get_device_minor_res_u.minor = minor;
@@ -506,12 +1055,12 @@ driver_get_device_minor_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_minor_r
 }
 
 int
-driver_get_device_busid(struct driver *ctx, struct driver_device *dev, char **busid)
+driver_get_device_busid(struct driver *ctx, unsigned int dev, char **busid)
 {
         struct driver_get_device_busid_res res = {0};
         int rv = -1;
 
-        if (call_rpc(ctx, &res, driver_get_device_busid_1, (ptr_t)dev) < 0)
+        if (call_rpc(ctx, &res, driver_get_device_busid_1, dev) < 0)
                 goto fail;
         if ((*busid = xstrdup(ctx->err, res.driver_get_device_busid_res_u.busid)) == NULL)
                 goto fail;
@@ -523,13 +1072,15 @@ driver_get_device_busid(struct driver *ctx, struct driver_device *dev, char **bu
 }
 
 bool_t
-driver_get_device_busid_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_busid_res *res, maybe_unused struct svc_req *req)
+driver_get_device_busid_1_svc(ptr_t ctxptr, u_int dev, driver_get_device_busid_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        struct driver_device *handle = (struct driver_device *)dev;
+        struct driver_device *handle;
         int domainid, deviceid, busid;
 
         memset(res, 0, sizeof(*res));
+        if ((handle = lookup_device(ctx, dev)) == NULL)
+                goto fail;
         if (call_cuda(ctx, cuDeviceGetAttribute, &domainid, CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID, handle->cuda) < 0)
                 goto fail;
         if (call_cuda(ctx, cuDeviceGetAttribute, &busid, CU_DEVICE_ATTRIBUTE_PCI_BUS_ID, handle->cuda) < 0)
@@ -546,12 +1097,12 @@ driver_get_device_busid_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_busid_r
 }
 
 int
-driver_get_device_uuid(struct driver *ctx, struct driver_device *dev, char **uuid)
+driver_get_device_uuid(struct driver *ctx, unsigned int dev, char **uuid)
 {
         struct driver_get_device_uuid_res res = {0};
         int rv = -1;
 
-        if (call_rpc(ctx, &res, driver_get_device_uuid_1, (ptr_t)dev) < 0)
+        if (call_rpc(ctx, &res, driver_get_device_uuid_1, dev) < 0)
                 goto fail;
         if ((*uuid = xstrdup(ctx->err, res.driver_get_device_uuid_res_u.uuid)) == NULL)
                 goto fail;
@@ -563,13 +1114,15 @@ driver_get_device_uuid(struct driver *ctx, struct driver_device *dev, char **uui
 }
 
 bool_t
-driver_get_device_uuid_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_uuid_res *res, maybe_unused struct svc_req *req)
+driver_get_device_uuid_1_svc(ptr_t ctxptr, u_int dev, driver_get_device_uuid_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        struct driver_device *handle = (struct driver_device *)dev;
+        struct driver_device *handle;
         char buf[NVML_DEVICE_UUID_BUFFER_SIZE];
 
         memset(res, 0, sizeof(*res));
+        if ((handle = lookup_device(ctx, dev)) == NULL)
+                goto fail;
         if (call_nvml(ctx, nvmlDeviceGetUUID, handle->nvml, buf, sizeof(buf)) < 0)
                 goto fail;
         if ((res->driver_get_device_uuid_res_u.uuid = xstrdup(ctx->err, buf)) == NULL)
@@ -582,12 +1135,12 @@ driver_get_device_uuid_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_uuid_res
 }
 
 int
-driver_get_device_model(struct driver *ctx, struct driver_device *dev, char **model)
+driver_get_device_model(struct driver *ctx, unsigned int dev, char **model)
 {
         struct driver_get_device_model_res res = {0};
         int rv = -1;
 
-        if (call_rpc(ctx, &res, driver_get_device_model_1, (ptr_t)dev) < 0)
+        if (call_rpc(ctx, &res, driver_get_device_model_1, dev) < 0)
                 goto fail;
         if ((*model = xstrdup(ctx->err, res.driver_get_device_model_res_u.model)) == NULL)
                 goto fail;
@@ -599,13 +1152,15 @@ driver_get_device_model(struct driver *ctx, struct driver_device *dev, char **mo
 }
 
 bool_t
-driver_get_device_model_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_model_res *res, maybe_unused struct svc_req *req)
+driver_get_device_model_1_svc(ptr_t ctxptr, u_int dev, driver_get_device_model_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        struct driver_device *handle = (struct driver_device *)dev;
+        struct driver_device *handle;
         char buf[NVML_DEVICE_NAME_BUFFER_SIZE];
 
         memset(res, 0, sizeof(*res));
+        if ((handle = lookup_device(ctx, dev)) == NULL)
+                goto fail;
         if (call_nvml(ctx, nvmlDeviceGetName, handle->nvml, buf, sizeof(buf)) < 0)
                 goto fail;
         if ((res->driver_get_device_model_res_u.model = xstrdup(ctx->err, buf)) == NULL)
@@ -618,12 +1173,12 @@ driver_get_device_model_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_model_r
 }
 
 int
-driver_get_device_arch(struct driver *ctx, struct driver_device *dev, char **arch)
+driver_get_device_arch(struct driver *ctx, unsigned int dev, char **arch)
 {
         struct driver_get_device_arch_res res = {0};
         int rv = -1;
 
-        if (call_rpc(ctx, &res, driver_get_device_arch_1, (ptr_t)dev) < 0)
+        if (call_rpc(ctx, &res, driver_get_device_arch_1, dev) < 0)
                 goto fail;
         if (xasprintf(ctx->err, arch, "%u.%u", res.driver_get_device_arch_res_u.arch.major,
             res.driver_get_device_arch_res_u.arch.minor) < 0)
@@ -636,13 +1191,15 @@ driver_get_device_arch(struct driver *ctx, struct driver_device *dev, char **arc
 }
 
 bool_t
-driver_get_device_arch_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_arch_res *res, maybe_unused struct svc_req *req)
+driver_get_device_arch_1_svc(ptr_t ctxptr, u_int dev, driver_get_device_arch_res *res, maybe_unused struct svc_req *req)
 {
         struct driver *ctx = (struct driver *)ctxptr;
-        struct driver_device *handle = (struct driver_device *)dev;
+        struct driver_device *handle;
         int major, minor;
 
         memset(res, 0, sizeof(*res));
+        if ((handle = lookup_device(ctx, dev)) == NULL)
+                goto fail;
         if (call_cuda(ctx, cuDeviceGetAttribute, &major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, handle->cuda) < 0)
                 goto fail;
         if (call_cuda(ctx, cuDeviceGetAttribute, &minor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, handle->cuda) < 0)
@@ -655,3 +1212,163 @@ driver_get_device_arch_1_svc(ptr_t ctxptr, ptr_t dev, driver_get_device_arch_res
         error_to_xdr(ctx->err, res);
         return (true);
 }
+
+static const char *
+lookup_name(const char * const names[], size_t size, int val)
+{
+        if (val < 0 || (size_t)val >= size || names[val] == NULL)
+                return ("Unknown");
+        return (names[val]);
+}
+
+int
+driver_get_device_props(struct driver *ctx, const unsigned int idxs[], unsigned int size, struct driver_props *props)
+{
+        static const char * const brands[] = {
+                [NVML_BRAND_UNKNOWN] = "Unknown",
+                [NVML_BRAND_QUADRO]  = "Quadro",
+                [NVML_BRAND_TESLA]   = "Tesla",
+                [NVML_BRAND_NVS]     = "NVS",
+                [NVML_BRAND_GRID]    = "GRID",
+                [NVML_BRAND_GEFORCE] = "GeForce",
+        };
+        static const char * const compute_modes[] = {
+                [NVML_COMPUTEMODE_DEFAULT]           = "Default",
+                [NVML_COMPUTEMODE_EXCLUSIVE_THREAD]  = "Exclusive_Thread",
+                [NVML_COMPUTEMODE_PROHIBITED]        = "Prohibited",
+                [NVML_COMPUTEMODE_EXCLUSIVE_PROCESS] = "Exclusive_Process",
+        };
+        struct driver_get_device_props_res res = {0};
+        driver_device_indices arg = {size, (u_int *)idxs};
+        driver_device_props *ptr;
+        int rv = -1;
+
+        if (call_rpc(ctx, &res, driver_get_device_props_1, arg) < 0)
+                goto fail;
+        if (res.driver_get_device_props_res_u.props.props_len != size) {
+                error_setx(ctx->err, "invalid device properties");
+                goto fail;
+        }
+        ptr = res.driver_get_device_props_res_u.props.props_val;
+        for (unsigned int i = 0; i < size; ++i) {
+                props[i].memory = ptr[i].memory;
+                props[i].brand = lookup_name(brands, nitems(brands), ptr[i].brand);
+                props[i].compute_mode = lookup_name(compute_modes, nitems(compute_modes), ptr[i].compute_mode);
+                props[i].ecc = (ptr[i].ecc != 0);
+        }
+        rv = 0;
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_get_device_props_res, (caddr_t)&res);
+        return (rv);
+}
+
+/*
+ * Query the properties of several devices at once (given by index), such that checking them doesn't cost
+ * a round trip per device.
+ */
+bool_t
+driver_get_device_props_1_svc(ptr_t ctxptr, driver_device_indices idxs, driver_get_device_props_res *res, maybe_unused struct svc_req *req)
+{
+        struct driver *ctx = (struct driver *)ctxptr;
+        struct driver_device *handle;
+        driver_device_props *props;
+        nvmlMemory_t mem;
+        nvmlBrandType_t brand;
+        nvmlComputeMode_t mode;
+        nvmlEnableState_t ecc, pending;
+        CUdevice cuda;
+        unsigned int dev;
+
+        memset(res, 0, sizeof(*res));
+        if (idxs.driver_device_indices_len == 0)
+                return (true);
+        if ((props = xcalloc(ctx->err, idxs.driver_device_indices_len, sizeof(*props))) == NULL)
+                goto fail;
+        res->driver_get_device_props_res_u.props.props_val = props;
+        res->driver_get_device_props_res_u.props.props_len = idxs.driver_device_indices_len;
+
+        for (u_int i = 0; i < idxs.driver_device_indices_len; ++i, ++props) {
+                if (idxs.driver_device_indices_val[i] > INT_MAX) {
+                        error_setx(ctx->err, "invalid device index: %u", idxs.driver_device_indices_val[i]);
+                        goto fail;
+                }
+                if (call_cuda(ctx, cuDeviceGet, &cuda, (int)idxs.driver_device_indices_val[i]) < 0)
+                        goto fail;
+                if (open_device(ctx, cuda, &dev) < 0)
+                        goto fail;
+                if ((handle = lookup_device(ctx, dev)) == NULL)
+                        goto fail;
+
+                if (call_nvml(ctx, nvmlDeviceGetMemoryInfo, handle->nvml, &mem) < 0)
+                        goto fail;
+                if (call_nvml(ctx, nvmlDeviceGetBrand, handle->nvml, &brand) < 0)
+                        goto fail;
+                if (call_nvml(ctx, nvmlDeviceGetComputeMode, handle->nvml, &mode) < 0)
+                        goto fail;
+                /* Consumer devices don't support ECC. */
+                if (call_nvml(ctx, nvmlDeviceGetEccMode, handle->nvml, &ecc, &pending) < 0) {
+                        if (ctx->err->code != NVML_ERROR_NOT_SUPPORTED)
+                                goto fail;
+                        error_reset(ctx->err);
+                        ecc = NVML_FEATURE_DISABLED;
+                }
+                props->memory = mem.total;
+                props->brand = (int)brand;
+                props->compute_mode = (int)mode;
+                props->ecc = (ecc == NVML_FEATURE_ENABLED);
+        }
+        return (true);
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_get_device_props_res, (caddr_t)res);
+        memset(res, 0, sizeof(*res));
+        error_to_xdr(ctx->err, res);
+        return (true);
+}
+
+int
+driver_get_stats(struct driver *ctx, struct driver_stats *stats)
+{
+        struct driver_get_stats_res res = {0};
+        struct driver_stats *ptr = &res.driver_get_stats_res_u.stats;
+
+        if (call_rpc(ctx, &res, driver_get_stats_1) < 0)
+                goto fail;
+        if (copy_stats(ctx->err, &ptr->rpcs.rpcs_len, &ptr->rpcs.rpcs_val, ctx->nrpcs, ctx->rpcs) < 0)
+                goto fail;
+        *stats = *ptr;
+        return (0);
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_get_stats_res, (caddr_t)&res);
+        return (-1);
+}
+
+void
+driver_free_stats(struct driver_stats *stats)
+{
+        xdr_free((xdrproc_t)xdr_driver_stats, (caddr_t)stats);
+}
+
+bool_t
+driver_get_stats_1_svc(ptr_t ctxptr, driver_get_stats_res *res, maybe_unused struct svc_req *req)
+{
+        struct driver *ctx = (struct driver *)ctxptr;
+        struct driver_stats *ptr = &res->driver_get_stats_res_u.stats;
+
+        memset(res, 0, sizeof(*res));
+        if (copy_stats(ctx->err, &ptr->procs.procs_len, &ptr->procs.procs_val,
+            stats_registry.procs.procs_len, stats_registry.procs.procs_val) < 0)
+                goto fail;
+        if (copy_stats(ctx->err, &ptr->calls.calls_len, &ptr->calls.calls_val,
+            stats_registry.calls.calls_len, stats_registry.calls.calls_val) < 0)
+                goto fail;
+        return (true);
+
+ fail:
+        xdr_free((xdrproc_t)xdr_driver_stats, (caddr_t)ptr);
+        memset(res, 0, sizeof(*res));
+        error_to_xdr(ctx->err, res);
+        return (true);
+}
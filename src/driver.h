@@ -15,13 +15,22 @@ SVCXPRT *svcunixfd_create(int, u_int, u_int);
 #endif /* WITH_TIRPC */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "error.h"
 
 #define SOCK_CLT 0
 #define SOCK_SVC 1
 
-struct driver_device;
+struct driver_stat;
+struct driver_stats;
+
+struct driver_props {
+        uint64_t memory;
+        const char *brand;
+        const char *compute_mode;
+        bool ecc;
+};
 
 struct driver {
         struct error *err;
@@ -31,6 +40,9 @@ struct driver {
         pid_t pid;
         SVCXPRT *rpc_svc;
         CLIENT *rpc_clt;
+        bool initialized;
+        struct driver_stat *rpcs; /* RPCs made by this client, see driver_get_stats. */
+        unsigned int nrpcs;
 };
 
 void driver_program_1(struct svc_req *, register SVCXPRT *);
@@ -40,11 +52,16 @@ int driver_shutdown(struct driver *);
 int driver_get_rm_version(struct driver *, char **);
 int driver_get_cuda_version(struct driver *, char **);
 int driver_get_device_count(struct driver *, unsigned int *);
-int driver_get_device(struct driver *, unsigned int, struct driver_device **);
-int driver_get_device_minor(struct driver *, struct driver_device *, unsigned int *);
-int driver_get_device_busid(struct driver *, struct driver_device *, char **);
-int driver_get_device_uuid(struct driver *, struct driver_device *, char **);
-int driver_get_device_arch(struct driver *, struct driver_device *, char **);
-int driver_get_device_model(struct driver *, struct driver_device *, char **);
+int driver_get_device(struct driver *, unsigned int, unsigned int *);
+int driver_get_device_by_uuid(struct driver *, const char *, unsigned int *);
+int driver_get_device_by_busid(struct driver *, const char *, unsigned int *);
+int driver_get_device_minor(struct driver *, unsigned int, unsigned int *);
+int driver_get_device_busid(struct driver *, unsigned int, char **);
+int driver_get_device_uuid(struct driver *, unsigned int, char **);
+int driver_get_device_arch(struct driver *, unsigned int, char **);
+int driver_get_device_model(struct driver *, unsigned int, char **);
+int driver_get_device_props(struct driver *, const unsigned int [], unsigned int, struct driver_props *);
+int driver_get_stats(struct driver *, struct driver_stats *);
+void driver_free_stats(struct driver_stats *);
 
 #endif /* HEADER_DRIVER_H */
@@ -8,6 +8,8 @@
 
 typedef int64_t ptr_t;
 
+const DRIVER_STATS_BUCKETS = 20;
+
 union driver_init_res switch (int errcode) {
         case 0:
                 void;
@@ -62,7 +64,21 @@ union driver_get_device_count_res switch (int errcode) {
 
 union driver_get_device_res switch (int errcode) {
         case 0:
-                ptr_t dev;
+                unsigned int dev;
+        default:
+                string errmsg<>;
+};
+
+union driver_get_device_by_uuid_res switch (int errcode) {
+        case 0:
+                unsigned int dev;
+        default:
+                string errmsg<>;
+};
+
+union driver_get_device_by_busid_res switch (int errcode) {
+        case 0:
+                unsigned int dev;
         default:
                 string errmsg<>;
 };
@@ -95,6 +111,43 @@ union driver_get_device_model_res switch (int errcode) {
                 string errmsg<>;
 };
 
+typedef unsigned int driver_device_indices<>;
+
+struct driver_device_props {
+        unsigned hyper memory;
+        int brand;
+        int compute_mode;
+        int ecc;
+};
+
+union driver_get_device_props_res switch (int errcode) {
+        case 0:
+                driver_device_props props<>;
+        default:
+                string errmsg<>;
+};
+
+struct driver_stat {
+        string name<>;
+        unsigned hyper count;
+        unsigned hyper errors;
+        unsigned hyper total;
+        unsigned hyper buckets[DRIVER_STATS_BUCKETS];
+};
+
+struct driver_stats {
+        driver_stat rpcs<>;
+        driver_stat procs<>;
+        driver_stat calls<>;
+};
+
+union driver_get_stats_res switch (int errcode) {
+        case 0:
+                driver_stats stats;
+        default:
+                string errmsg<>;
+};
+
 program DRIVER_PROGRAM {
         version DRIVER_VERSION {
                 driver_init_res DRIVER_INIT(ptr_t) = 1;
@@ -103,10 +156,14 @@ program DRIVER_PROGRAM {
                 driver_get_cuda_version_res DRIVER_GET_CUDA_VERSION(ptr_t) = 4;
                 driver_get_device_count_res DRIVER_GET_DEVICE_COUNT(ptr_t) = 5;
                 driver_get_device_res DRIVER_GET_DEVICE(ptr_t, unsigned int) = 6;
-                driver_get_device_minor_res DRIVER_GET_DEVICE_MINOR(ptr_t, ptr_t) = 7;
-                driver_get_device_busid_res DRIVER_GET_DEVICE_BUSID(ptr_t, ptr_t) = 8;
-                driver_get_device_uuid_res DRIVER_GET_DEVICE_UUID(ptr_t, ptr_t) = 9;
-                driver_get_device_arch_res DRIVER_GET_DEVICE_ARCH(ptr_t, ptr_t) = 10;
-                driver_get_device_model_res DRIVER_GET_DEVICE_MODEL(ptr_t, ptr_t) = 11;
+                driver_get_device_minor_res DRIVER_GET_DEVICE_MINOR(ptr_t, unsigned int) = 7;
+                driver_get_device_busid_res DRIVER_GET_DEVICE_BUSID(ptr_t, unsigned int) = 8;
+                driver_get_device_uuid_res DRIVER_GET_DEVICE_UUID(ptr_t, unsigned int) = 9;
+                driver_get_device_arch_res DRIVER_GET_DEVICE_ARCH(ptr_t, unsigned int) = 10;
+                driver_get_device_model_res DRIVER_GET_DEVICE_MODEL(ptr_t, unsigned int) = 11;
+                driver_get_device_by_uuid_res DRIVER_GET_DEVICE_BY_UUID(ptr_t, string) = 12;
+                driver_get_device_by_busid_res DRIVER_GET_DEVICE_BY_BUSID(ptr_t, string) = 13;
+                driver_get_stats_res DRIVER_GET_STATS(ptr_t) = 14;
+                driver_get_device_props_res DRIVER_GET_DEVICE_PROPS(ptr_t, driver_device_indices) = 15;
         } = 1;
 } = 0x1;
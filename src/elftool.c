@@ -165,3 +165,34 @@ elftool_has_abi(struct elftool *ctx, uint32_t abi[3])
 
         return (desc[0] == ELF_NOTE_OS_LINUX && !memcmp(&desc[1], abi, 3 * sizeof(uint32_t)));
 }
+
+/* The SONAME returned is valid until the file is closed, NULL if the object has none. */
+int
+elftool_get_soname(struct elftool *ctx, const char **soname)
+{
+        GElf_Shdr shdr;
+        Elf_Scn *scn;
+        Elf_Data *data;
+        GElf_Dyn dyn;
+
+        *soname = NULL;
+        if (lookup_section(ctx, &shdr, &scn, SHT_DYNAMIC, NULL) < 0)
+                return (-1);
+        if ((data = elf_getdata(scn, NULL)) == NULL)
+                goto fail;
+
+        for (size_t i = 0; i < data->d_size / shdr.sh_entsize; ++i) {
+                if (gelf_getdyn(data, (int)i, &dyn) == NULL)
+                        goto fail;
+                if (dyn.d_tag == DT_SONAME) {
+                        if ((*soname = elf_strptr(ctx->elf, shdr.sh_link, dyn.d_un.d_val)) == NULL)
+                                goto fail;
+                        break;
+                }
+        }
+        return (0);
+
+ fail:
+        error_set_elf(ctx->err, "elf data read error: %s", ctx->path);
+        return (-1);
+}
@@ -43,5 +43,6 @@ int  elftool_open(struct elftool *, const char *);
 void elftool_close(struct elftool *);
 int  elftool_has_dependency(struct elftool *, const char *);
 int  elftool_has_abi(struct elftool *, uint32_t [3]);
+int  elftool_get_soname(struct elftool *, const char **);
 
 #endif /* HEADER_ELFTOOL_H */
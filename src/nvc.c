@@ -223,7 +223,15 @@ copy_config(struct error *err, struct nvc_context *ctx, const struct nvc_config
                 ctx->cfg.gid = (gid_t)gid;
         }
 
+        /* Results of ldconfig are cached in this directory if set. */
+        if (cfg->ldcache_dir != NULL) {
+                if ((ctx->cfg.ldcache_dir = xrealpath(err, cfg->ldcache_dir, NULL)) == NULL)
+                        return (-1);
+        }
+
         log_infof("using ldcache %s", ctx->cfg.ldcache);
+        if (ctx->cfg.ldcache_dir != NULL)
+                log_infof("using ldcache directory %s", ctx->cfg.ldcache_dir);
         log_infof("using unprivileged user %"PRIu32":%"PRIu32, (uint32_t)ctx->cfg.uid, (uint32_t)ctx->cfg.gid);
         return (0);
 }
@@ -232,22 +240,39 @@ int
 nvc_init(struct nvc_context *ctx, const struct nvc_config *cfg, const char *opts)
 {
         int32_t flags;
+
+        if (ctx == NULL)
+                return (-1);
+        if (ctx->initialized)
+                return (0);
+        if (opts == NULL)
+                opts = default_library_opts;
+        if (options_init(&ctx->err) < 0)
+                return (-1);
+        if ((flags = options_parse(&ctx->err, opts, &library_opts)) < 0)
+                return (-1);
+        return (nvc_init_flags(ctx, cfg, (uint32_t)flags));
+}
+
+int
+nvc_init_flags(struct nvc_context *ctx, const struct nvc_config *cfg, uint32_t flags)
+{
         char path[PATH_MAX];
+        const char *fmt;
 
         if (ctx == NULL)
                 return (-1);
         if (ctx->initialized)
                 return (0);
         if (cfg == NULL)
-                cfg = &(struct nvc_config){NULL, (uid_t)-1, (gid_t)-1};
-        if (validate_args(ctx, !strempty(cfg->ldcache)) < 0)
+                cfg = &(struct nvc_config){NULL, (uid_t)-1, (gid_t)-1, NULL};
+        if (options_init(&ctx->err) < 0)
                 return (-1);
-        if (opts == NULL)
-                opts = default_library_opts;
-        if ((flags = options_parse(&ctx->err, opts, library_opts, nitems(library_opts))) < 0)
+        if (validate_args(ctx, !strempty(cfg->ldcache) && !(flags & ~(uint32_t)options_mask(&library_opts))) < 0)
                 return (-1);
 
-        log_open(secure_getenv("NVC_DEBUG_FILE"));
+        fmt = secure_getenv("NVC_DEBUG_FORMAT");
+        log_open(secure_getenv("NVC_DEBUG_FILE"), fmt != NULL && !strcmp(fmt, "binary"));
         log_infof("initializing library context (version=%s, build=%s)", NVC_VERSION, BUILD_REVISION);
 
         if (flags & OPT_LOAD_KMODS) {
@@ -268,11 +293,14 @@ nvc_init(struct nvc_context *ctx, const struct nvc_config *cfg, const char *opts
                 goto fail;
 
         ctx->initialized = true;
+        log_flush();
         return (0);
 
  fail:
         free(ctx->cfg.ldcache);
+        free(ctx->cfg.ldcache_dir);
         xclose(ctx->mnt_ns);
+        log_flush();
         return (-1);
 }
 
@@ -288,9 +316,13 @@ nvc_shutdown(struct nvc_context *ctx)
         if (driver_shutdown(&ctx->drv) < 0)
                 return (-1);
         free(ctx->cfg.ldcache);
+        free(ctx->cfg.ldcache_dir);
+        free(ctx->devs);
         xclose(ctx->mnt_ns);
 
         memset(&ctx->cfg, 0, sizeof(ctx->cfg));
+        ctx->devs = NULL;
+        ctx->ndevs = 0;
         ctx->mnt_ns = -1;
 
         log_close();
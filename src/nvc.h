@@ -7,6 +7,7 @@
 
 #include <sys/types.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -14,14 +15,70 @@ extern "C" {
 #endif /* __cplusplus */
 
 #define NVC_MAJOR   1
-#define NVC_MINOR   0
+#define NVC_MINOR   1
 #define NVC_PATCH   0
-#define NVC_VERSION "1.0.0"
+#define NVC_VERSION "1.1.0"
 
 #define NVC_ARG_MAX 256
 
+#define NVC_STATS_BUCKETS 20
+
+#define NVC_INFO_PATH "/dev/shm/nvidia-container-info"
+
 struct nvc_context;
 struct nvc_container;
+struct nvc_watch;
+struct nvc_ldcache_job;
+
+enum {
+        NVC_WATCH_DRIVER = 1 << 0,
+        NVC_WATCH_DEVICE = 1 << 1,
+};
+
+/* Library flags (i.e. the options of nvc_init) */
+enum {
+        NVC_INIT_LOAD_KMODS = 1 << 0,
+};
+
+/* Driver flags (i.e. the options of nvc_driver_info_new) */
+enum {
+        NVC_DRIVER_NO_GLVND        = 1 << 0,
+        NVC_DRIVER_NO_UVM          = 1 << 1,
+        NVC_DRIVER_NO_MPS          = 1 << 2,
+        NVC_DRIVER_NO_PERSISTENCED = 1 << 3,
+};
+
+/* Device flags (i.e. the options of nvc_device_info_new) */
+enum {
+        NVC_DEVICE_NO_MODEL = 1 << 0,
+        NVC_DEVICE_NO_UUID  = 1 << 1,
+        NVC_DEVICE_NO_BUSID = 1 << 2,
+        NVC_DEVICE_NO_ARCH  = 1 << 3,
+        NVC_DEVICE_LAZY     = NVC_DEVICE_NO_MODEL|NVC_DEVICE_NO_UUID|NVC_DEVICE_NO_BUSID|NVC_DEVICE_NO_ARCH,
+};
+
+/* Container flags (i.e. the options of nvc_container_new) */
+enum {
+        NVC_CONTAINER_SUPERVISED    = 1 << 0,
+        NVC_CONTAINER_STANDALONE    = 1 << 1,
+        NVC_CONTAINER_NO_CGROUPS    = 1 << 2,
+        NVC_CONTAINER_NO_DEVBIND    = 1 << 3,
+        NVC_CONTAINER_UTILITY_LIBS  = 1 << 4,
+        NVC_CONTAINER_COMPUTE_LIBS  = 1 << 5,
+        NVC_CONTAINER_VIDEO_LIBS    = 1 << 6,
+        NVC_CONTAINER_GRAPHICS_LIBS = 1 << 7,
+        NVC_CONTAINER_UTILITY_BINS  = 1 << 8,
+        NVC_CONTAINER_COMPUTE_BINS  = 1 << 9,
+#if defined(__powerpc64__) /* ppc64le doesn't support compat32. */
+        NVC_CONTAINER_COMPAT32      = 1 << 0,
+#else
+        NVC_CONTAINER_COMPAT32      = 1 << 10,
+#endif /* defined(__powerpc64__) */
+        NVC_CONTAINER_UTILITY       = NVC_CONTAINER_UTILITY_BINS|NVC_CONTAINER_UTILITY_LIBS,
+        NVC_CONTAINER_COMPUTE       = NVC_CONTAINER_COMPUTE_BINS|NVC_CONTAINER_COMPUTE_LIBS,
+        NVC_CONTAINER_VIDEO         = NVC_CONTAINER_VIDEO_LIBS|NVC_CONTAINER_COMPUTE_LIBS,
+        NVC_CONTAINER_GRAPHICS      = NVC_CONTAINER_GRAPHICS_LIBS,
+};
 
 struct nvc_version {
         unsigned int major;
@@ -34,6 +91,7 @@ struct nvc_config {
         char *ldcache;
         uid_t uid;
         gid_t gid;
+        char *ldcache_dir;
 };
 
 struct nvc_device_node {
@@ -64,11 +122,39 @@ struct nvc_device {
         struct nvc_device_node node;
 };
 
+struct nvc_device_props {
+        uint64_t memory;
+        const char *brand;
+        const char *compute_mode;
+        bool ecc;
+};
+
 struct nvc_device_info {
         struct nvc_device *gpus;
         size_t ngpus;
 };
 
+struct nvc_stats_entry {
+        char *name;
+        uint64_t count;
+        uint64_t errors;
+        uint64_t total_ns;
+        uint64_t buckets[NVC_STATS_BUCKETS];
+};
+
+struct nvc_stats {
+        struct nvc_stats_entry *rpcs;
+        size_t nrpcs;
+        struct nvc_stats_entry *procs;
+        size_t nprocs;
+        struct nvc_stats_entry *calls;
+        size_t ncalls;
+        uint64_t mounts;
+        uint64_t libs_selected;
+        uint64_t libs_skipped;
+        uint64_t ldconfig_ns;
+};
+
 struct nvc_container_config {
         pid_t pid;
         char *rootfs;
@@ -87,25 +173,53 @@ struct nvc_config *nvc_config_new(void);
 void nvc_config_free(struct nvc_config *);
 
 int nvc_init(struct nvc_context *, const struct nvc_config *, const char *);
+int nvc_init_flags(struct nvc_context *, const struct nvc_config *, uint32_t);
 int nvc_shutdown(struct nvc_context *);
 
 struct nvc_container_config *nvc_container_config_new(pid_t, const char *);
 void nvc_container_config_free(struct nvc_container_config *);
 
 struct nvc_container *nvc_container_new(struct nvc_context *, const struct nvc_container_config *, const char *);
+struct nvc_container *nvc_container_new_flags(struct nvc_context *, const struct nvc_container_config *, uint32_t);
 void nvc_container_free(struct nvc_container *);
 
 struct nvc_driver_info *nvc_driver_info_new(struct nvc_context *, const char *);
+struct nvc_driver_info *nvc_driver_info_new_flags(struct nvc_context *, uint32_t);
 void nvc_driver_info_free(struct nvc_driver_info *);
 
 struct nvc_device_info *nvc_device_info_new(struct nvc_context *, const char *);
+struct nvc_device_info *nvc_device_info_new_flags(struct nvc_context *, uint32_t);
+struct nvc_device_info *nvc_device_info_lookup(struct nvc_context *, const char *, const char *);
+struct nvc_device_info *nvc_device_info_lookup_flags(struct nvc_context *, const char *, uint32_t);
 void nvc_device_info_free(struct nvc_device_info *);
 
-int nvc_driver_mount(struct nvc_context *, const struct nvc_container *, const struct nvc_driver_info *);
+int nvc_info_publish(struct nvc_context *, const char *, const struct nvc_driver_info *, const struct nvc_device_info *);
+int nvc_info_load(struct nvc_context *, const char *, struct nvc_driver_info **, struct nvc_device_info **);
+
+struct nvc_watch *nvc_watch_new(struct nvc_context *, const struct nvc_driver_info *);
+void nvc_watch_free(struct nvc_watch *);
+int nvc_watch_fd(const struct nvc_watch *);
+int nvc_watch_read(struct nvc_context *, struct nvc_watch *);
+
+const char *nvc_device_get_model(struct nvc_context *, struct nvc_device *);
+const char *nvc_device_get_uuid(struct nvc_context *, struct nvc_device *);
+const char *nvc_device_get_busid(struct nvc_context *, struct nvc_device *);
+const char *nvc_device_get_arch(struct nvc_context *, struct nvc_device *);
+int nvc_device_get_props(struct nvc_context *, struct nvc_device * const [], size_t, struct nvc_device_props []);
 
-int nvc_device_mount(struct nvc_context *, const struct nvc_container *, const struct nvc_device *);
+int nvc_driver_mount(struct nvc_context *, struct nvc_container *, const struct nvc_driver_info *);
+int nvc_driver_unmount(struct nvc_context *, struct nvc_container *);
+
+int nvc_device_mount(struct nvc_context *, struct nvc_container *, const struct nvc_device *);
 
 int nvc_ldcache_update(struct nvc_context *, const struct nvc_container *);
+struct nvc_ldcache_job *nvc_ldcache_update_start(struct nvc_context *, const struct nvc_container *);
+int nvc_ldcache_update_fd(const struct nvc_ldcache_job *);
+int nvc_ldcache_update_poll(struct nvc_context *, struct nvc_ldcache_job *);
+int nvc_ldcache_update_wait(struct nvc_context *, struct nvc_ldcache_job *);
+
+struct nvc_stats *nvc_stats_new(struct nvc_context *);
+void nvc_stats_free(struct nvc_stats *);
 
 const char *nvc_error(struct nvc_context *);
 
@@ -4,6 +4,8 @@
 
 #include <sys/types.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
@@ -19,15 +21,31 @@
 #include "utils.h"
 #include "xfuncs.h"
 
-typedef char *(*parse_fn)(char *, char *, const char *);
-
-static char *cgroup_mount(char *, char *, const char *);
-static char *cgroup_root(char *, char *, const char *);
-static char *parse_proc_file(struct error *, const char *, parse_fn, char *, const char *);
-static char *find_cgroup_path(struct error *, const struct nvc_container *, const char *);
-static char *find_namespace_path(struct error *, const struct nvc_container *, const char *);
+#define PROC_READ_SIZE (64 * 1024)
+
+/* Returns 1 to stop parsing, 0 to continue and -1 on error. */
+typedef int (*parse_fn)(struct error *, char *, void *);
+
+struct cgroup_lookup {
+        const char *subsys;
+        int version;
+        char *mount[2];  /* Legacy hierarchy at index 1, unified one at index 0. */
+        char *root[2];
+        char *path;
+};
+
+static bool has_subsys(const char *, const char *);
+static int  cgroup_mount(struct error *, char *, void *);
+static int  cgroup_root(struct error *, char *, void *);
+static int  mount_point(struct error *, char *, void *);
+static int  parse_proc_file(struct error *, int, const char *, parse_fn, void *);
+static char *find_cgroup_path(struct error *, const struct nvc_container *, const char *, int *);
+static int  open_process(struct error *, struct nvc_container *);
 static int  lookup_owner(struct error *, struct nvc_container *);
+static int  lookup_mounts(struct error *, struct nvc_container *);
+static void unescape_octal(char *);
 static int  copy_config(struct error *, struct nvc_container *, const struct nvc_container_config *);
+static struct nvc_container *new_container(struct nvc_context *, const struct nvc_container_config *, int32_t);
 
 struct nvc_container_config *
 nvc_container_config_new(pid_t pid, const char *rootfs)
@@ -50,153 +68,276 @@ nvc_container_config_free(struct nvc_container_config *cfg)
         free(cfg);
 }
 
-static char *
-cgroup_mount(char *line, char *prefix, const char *subsys)
+static bool
+has_subsys(const char *list, const char *subsys)
+{
+        size_t len;
+
+        len = strlen(subsys);
+        for (const char *ptr = list; ptr != NULL; ptr = strchr(ptr, ',')) {
+                if (*ptr == ',')
+                        ++ptr;
+                if (!strncmp(ptr, subsys, len) && (ptr[len] == ',' || ptr[len] == '\0'))
+                        return (true);
+        }
+        return (false);
+}
+
+static int
+cgroup_mount(struct error *err, char *line, void *data)
 {
+        struct cgroup_lookup *cg = data;
         char *root, *mount, *fstype, *substr;
+        int v;
 
         for (int i = 0; i < 4; ++i)
                 root = strsep(&line, " ");
         mount = strsep(&line, " ");
-        line = strchr(line, '-');
-        for (int i = 0; i < 2; ++i)
-                fstype = strsep(&line, " ");
+        if (line == NULL || (line = strstr(line, " - ")) == NULL)
+                return (0);
+        line += 3;
+        fstype = strsep(&line, " ");
         for (int i = 0; i < 2; ++i)
                 substr = strsep(&line, " ");
 
         if (root == NULL || mount == NULL || fstype == NULL || substr == NULL)
-                return (NULL);
-        if (*root == '\0' || *mount == '\0' || *fstype == '\0' || *substr == '\0')
-                return (NULL);
-        if (strcmp(fstype, "cgroup"))
-                return (NULL);
-        if (strstr(substr, subsys) == NULL)
-                return (NULL);
+                return (0);
+        if (*root == '\0' || *mount == '\0')
+                return (0);
+        if (!strcmp(fstype, "cgroup") && has_subsys(substr, cg->subsys))
+                v = 1;
+        else if (!strcmp(fstype, "cgroup2") && cg->mount[0] == NULL)
+                v = 0;
+        else
+                return (0);
         if (strlen(root) >= PATH_MAX || !strpcmp(root, "/.."))
-                return (NULL);
-        strcpy(prefix, root);
+                return (0);
 
-        return (mount);
+        if ((cg->mount[v] = xstrdup(err, mount)) == NULL)
+                return (-1);
+        if ((cg->root[v] = xstrdup(err, root)) == NULL)
+                return (-1);
+        /* A legacy hierarchy can't be shadowed, stop there. */
+        return (v == 1);
 }
 
-static char *
-cgroup_root(char *line, char *prefix, const char *subsys)
+static int
+cgroup_root(struct error *err, char *line, void *data)
 {
-        char *root, *substr;
-
-        for (int i = 0; i < 2; ++i)
-                substr = strsep(&line, ":");
-        root = strsep(&line, ":");
-
-        if (root == NULL || substr == NULL)
-                return (NULL);
-        if (*root == '\0' || *substr == '\0')
-                return (NULL);
-        if (strstr(substr, subsys) == NULL)
-                return (NULL);
+        struct cgroup_lookup *cg = data;
+        const char *prefix;
+        char *id, *root, *substr;
+
+        id = strsep(&line, ":");
+        substr = strsep(&line, ":");
+        root = line;
+
+        if (id == NULL || substr == NULL || root == NULL || *root == '\0')
+                return (0);
+        if (cg->version == 1 && (*substr == '\0' || !has_subsys(substr, cg->subsys)))
+                return (0);
+        if (cg->version == 2 && (strcmp(id, "0") || *substr != '\0'))
+                return (0);
         if (strlen(root) >= PATH_MAX || !strpcmp(root, "/.."))
-                return (NULL);
+                return (0);
+
+        prefix = cg->root[cg->version & 1];
         if (strcmp(prefix, "/") && !strpcmp(root, prefix))
                 root += strlen(prefix);
+        if ((cg->path = xstrdup(err, root)) == NULL)
+                return (-1);
+        return (1);
+}
 
-        return (root);
+static int
+mount_point(struct error *err, char *line, void *data)
+{
+        struct nvc_container *cnt = data;
+        char *mount;
+
+        for (int i = 0; i < 5; ++i)
+                mount = strsep(&line, " ");
+        if (mount == NULL || *mount == '\0')
+                return (0);
+        unescape_octal(mount);
+        return (strset_add(err, &cnt->mounts, mount));
 }
 
-static char *
-parse_proc_file(struct error *err, const char *procf, parse_fn parse, char *prefix, const char *subsys)
+/*
+ * Feed the file line by line to the given parser, reading it through a large buffer since procfs files like
+ * mountinfo can span thousands of lines. Parsing stops as soon as the parser is satisfied.
+ */
+static int
+parse_proc_file(struct error *err, int dirfd, const char *procf, parse_fn parse, void *data)
 {
-        FILE *fs;
-        ssize_t n;
-        char *buf = NULL;
+        int fd;
+        char *buf, *ptr, *line, *end;
+        size_t size = PROC_READ_SIZE;
         size_t len = 0;
-        char *ptr = NULL;
-        char *path = NULL;
+        ssize_t n;
+        int rv = -1;
 
-        if ((fs = xfopen(err, procf, "r")) == NULL)
-                return (NULL);
-        while ((n = getline(&buf, &len, fs)) >= 0) {
-                ptr = buf;
-                ptr[strcspn(ptr, "\n")] = '\0';
-                if (n == 0 || *ptr == '\0')
-                        continue;
-                if ((ptr = parse(ptr, prefix, subsys)) != NULL)
-                        break;
-        }
-        if (ferror(fs)) {
-                error_set(err, "read error: %s", procf);
-                goto fail;
-        }
-        if (ptr == NULL || feof(fs)) {
-                error_setx(err, "cgroup subsystem %s not found", subsys);
+        if ((fd = xopenat(err, dirfd, procf, O_RDONLY|O_CLOEXEC)) < 0)
+                return (-1);
+        if ((buf = xcalloc(err, size + 1, 1)) == NULL)
                 goto fail;
+
+        for (;;) {
+                /* Lines longer than the buffer are unlikely but legitimate, grow it to fit them. */
+                if (len == size) {
+                        if ((ptr = xrealloc(err, buf, size * 2 + 1)) == NULL)
+                                goto fail;
+                        buf = ptr;
+                        size *= 2;
+                }
+                if ((n = read(fd, buf + len, size - len)) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        error_set(err, "read error: %s", procf);
+                        goto fail;
+                }
+                len += (size_t)n;
+                end = buf + len;
+                if (n == 0 && len > 0 && end[-1] != '\n')
+                        *end++ = '\n';
+
+                for (line = buf; (ptr = memchr(line, '\n', (size_t)(end - line))) != NULL; line = ptr + 1) {
+                        *ptr = '\0';
+                        if (*line == '\0')
+                                continue;
+                        if ((rv = parse(err, line, data)) != 0)
+                                goto fail;
+                }
+                if (n == 0)
+                        break;
+                len = (size_t)(end - line);
+                memmove(buf, line, len);
         }
-        path = xstrdup(err, ptr);
+        rv = 0;
 
  fail:
         free(buf);
-        fclose(fs);
-        return (path);
+        xclose(fd);
+        return (rv < 0 ? -1 : 0);
 }
 
+/*
+ * Resolve the cgroup of the container for the given subsystem, preferring its legacy (v1) hierarchy and falling
+ * back to the unified (v2) one.
+ */
 static char *
-find_cgroup_path(struct error *err, const struct nvc_container *cnt, const char *subsys)
+find_cgroup_path(struct error *err, const struct nvc_container *cnt, const char *subsys, int *version)
 {
-        pid_t pid;
         const char *prefix;
-        char path[PATH_MAX];
-        char root_prefix[PATH_MAX];
-        char *mount = NULL;
-        char *root = NULL;
+        struct cgroup_lookup cg = {.subsys = subsys};
         char *cgroup = NULL;
+        int rv;
 
-        pid = (cnt->flags & OPT_STANDALONE) ? cnt->cfg.pid : getpid();
         prefix = (cnt->flags & OPT_STANDALONE) ? cnt->cfg.rootfs : "";
 
-        if (xsnprintf(err, path, sizeof(path), "%s"PROC_MOUNTS_PATH(PROC_PID), prefix, (int32_t)pid) < 0)
+        /* In supervised mode, the cgroup hierarchies are the ones mounted in our namespace. */
+        if (cnt->flags & OPT_STANDALONE)
+                rv = parse_proc_file(err, cnt->proc_fd, "mountinfo", cgroup_mount, &cg);
+        else
+                rv = parse_proc_file(err, AT_FDCWD, PROC_MOUNTS_PATH(PROC_SELF), cgroup_mount, &cg);
+        if (rv < 0)
                 goto fail;
-        if ((mount = parse_proc_file(err, path, cgroup_mount, root_prefix, subsys)) == NULL)
+        if (cg.mount[1] != NULL)
+                cg.version = 1;
+        else if (cg.mount[0] != NULL)
+                cg.version = 2;
+        else {
+                error_setx(err, "cgroup subsystem %s not found", subsys);
                 goto fail;
-        if (xsnprintf(err, path, sizeof(path), "%s"PROC_CGROUP_PATH(PROC_PID), prefix, (int32_t)cnt->cfg.pid) < 0)
+        }
+
+        if (parse_proc_file(err, cnt->proc_fd, "cgroup", cgroup_root, &cg) < 0)
                 goto fail;
-        if ((root = parse_proc_file(err, path, cgroup_root, root_prefix, subsys)) == NULL)
+        if (cg.path == NULL) {
+                error_setx(err, "cgroup subsystem %s not found", subsys);
                 goto fail;
+        }
 
-        xasprintf(err, &cgroup, "%s%s%s", prefix, mount, root);
+        if (xasprintf(err, &cgroup, "%s%s%s", prefix, cg.mount[cg.version & 1], cg.path) < 0)
+                goto fail;
+        *version = cg.version;
 
  fail:
-        free(mount);
-        free(root);
+        for (size_t i = 0; i < nitems(cg.mount); ++i) {
+                free(cg.mount[i]);
+                free(cg.root[i]);
+        }
+        free(cg.path);
         return (cgroup);
 }
 
-static char *
-find_namespace_path(struct error *err, const struct nvc_container *cnt, const char *namespace)
+/*
+ * Hold on to the process directory and mount namespace of the container, such that its namespace is entered
+ * through the same descriptor every time and a recycled PID can't redirect us (lookups through the directory
+ * fail once the process is gone).
+ */
+static int
+open_process(struct error *err, struct nvc_container *cnt)
 {
         const char *prefix;
-        char *ns = NULL;
+        char path[PATH_MAX];
 
         prefix = (cnt->flags & OPT_STANDALONE) ? cnt->cfg.rootfs : "";
-        xasprintf(err, &ns, "%s"PROC_NS_PATH(PROC_PID), prefix, (int32_t)cnt->cfg.pid, namespace);
-        return (ns);
+        if (xsnprintf(err, path, sizeof(path), "%s"PROC_PID, prefix, (int32_t)cnt->cfg.pid) < 0)
+                return (-1);
+        if ((cnt->proc_fd = xopen(err, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+                return (-1);
+        if ((cnt->mnt_ns = xopenat(err, cnt->proc_fd, "ns/mnt", O_RDONLY|O_CLOEXEC)) < 0)
+                return (-1);
+        return (0);
 }
 
 static int
 lookup_owner(struct error *err, struct nvc_container *cnt)
 {
-        const char *prefix;
-        char path[PATH_MAX];
         struct stat s;
 
-        prefix = (cnt->flags & OPT_STANDALONE) ? cnt->cfg.rootfs : "";
-        if (xsnprintf(err, path, sizeof(path), "%s"PROC_PID, prefix, (int32_t)cnt->cfg.pid) < 0)
-                return (-1);
-        if (xstat(err, path, &s) < 0)
+        if (fstat(cnt->proc_fd, &s) < 0) {
+                error_set(err, "stat failed: %s"PROC_PID, (cnt->flags & OPT_STANDALONE) ? cnt->cfg.rootfs : "",
+                    (int32_t)cnt->cfg.pid);
                 return (-1);
+        }
         cnt->uid = s.st_uid;
         cnt->gid = s.st_gid;
         return (0);
 }
 
+/* Decode the octal escapes (e.g. \040) used by the kernel for whitespace in mount paths. */
+static void
+unescape_octal(char *str)
+{
+        char *dst = str;
+
+        for (char *src = str; *src != '\0'; ++dst) {
+                if (src[0] == '\\' && src[1] >= '0' && src[1] <= '3' && src[2] >= '0' && src[2] <= '7' &&
+                    src[3] >= '0' && src[3] <= '7') {
+                        *dst = (char)(((src[1] - '0') << 6) | ((src[2] - '0') << 3) | (src[3] - '0'));
+                        src += 4;
+                } else {
+                        *dst = *src++;
+                }
+        }
+        *dst = '\0';
+}
+
+/*
+ * Record every mount point of the container such that mounts already performed by a previous invocation
+ * (e.g. a restarted container) can be detected without rescanning the mount table for each of them.
+ */
+static int
+lookup_mounts(struct error *err, struct nvc_container *cnt)
+{
+        if (parse_proc_file(err, cnt->proc_fd, "mountinfo", mount_point, cnt) < 0)
+                return (-1);
+        log_infof("found %zu mount points in the container", cnt->mounts.count);
+        return (0);
+}
+
 static int
 copy_config(struct error *err, struct nvc_container *cnt, const struct nvc_container_config *cfg)
 {
@@ -276,40 +417,45 @@ copy_config(struct error *err, struct nvc_container *cnt, const struct nvc_conta
         return (0);
 }
 
-struct nvc_container *
-nvc_container_new(struct nvc_context *ctx, const struct nvc_container_config *cfg, const char *opts)
+static struct nvc_container *
+new_container(struct nvc_context *ctx, const struct nvc_container_config *cfg, int32_t flags)
 {
         struct nvc_container *cnt;
-        int32_t flags;
+        int version;
 
-        if (validate_context(ctx) < 0)
-                return (NULL);
         if (validate_args(ctx, cfg != NULL && cfg->pid > 0 && cfg->rootfs != NULL && !strempty(cfg->rootfs) &&
             !strempty(cfg->bins_dir) && !strempty(cfg->libs_dir) && !strempty(cfg->libs32_dir) && !strempty(cfg->ldconfig)) < 0)
                 return (NULL);
-        if (opts == NULL)
-                opts = default_container_opts;
-        if ((flags = options_parse(&ctx->err, opts, container_opts, nitems(container_opts))) < 0)
-                return (NULL);
         if ((!(flags & OPT_SUPERVISED) ^ !(flags & OPT_STANDALONE)) == 0) {
                 error_setx(&ctx->err, "invalid mode of operation");
                 return (NULL);
         }
 
-        log_infof("configuring container with '%s'", opts);
         if ((cnt = xcalloc(&ctx->err, 1, sizeof(*cnt))) == NULL)
                 return (NULL);
 
         cnt->flags = flags;
+        cnt->proc_fd = -1;
+        cnt->mnt_ns = -1;
         if (copy_config(&ctx->err, cnt, cfg) < 0)
                 goto fail;
+        if (open_process(&ctx->err, cnt) < 0)
+                goto fail;
         if (lookup_owner(&ctx->err, cnt) < 0)
                 goto fail;
-        if ((cnt->mnt_ns = find_namespace_path(&ctx->err, cnt, "mnt")) == NULL)
+        if (lookup_mounts(&ctx->err, cnt) < 0)
                 goto fail;
         if (!(flags & OPT_NO_CGROUPS)) {
-                if ((cnt->dev_cg = find_cgroup_path(&ctx->err, cnt, "devices")) == NULL)
+                if ((cnt->dev_cg = find_cgroup_path(&ctx->err, cnt, "devices", &version)) == NULL)
+                        goto fail;
+                /*
+                 * XXX The unified hierarchy controls devices through BPF programs which we don't manage, silently
+                 * skipping the whitelisting would leave the container without access to its devices.
+                 */
+                if (version == 2) {
+                        error_setx(&ctx->err, "unified devices cgroup not supported: %s (use no-cgroups)", cnt->dev_cg);
                         goto fail;
+                }
         }
 
         log_infof("setting pid to %"PRId32, (int32_t)cnt->cfg.pid);
@@ -319,16 +465,47 @@ nvc_container_new(struct nvc_context *ctx, const struct nvc_container_config *cf
         log_infof("setting libs directory to %s", cnt->cfg.libs_dir);
         log_infof("setting libs32 directory to %s", cnt->cfg.libs32_dir);
         log_infof("setting ldconfig to %s%s", cnt->cfg.ldconfig, (cnt->cfg.ldconfig[0] == '@') ? " (host relative)" : "");
-        log_infof("setting mount namespace to %s", cnt->mnt_ns);
-        if (!(flags & OPT_NO_CGROUPS))
+        log_infof("setting mount namespace to %s"PROC_NS_PATH(PROC_PID), (cnt->flags & OPT_STANDALONE) ? cnt->cfg.rootfs : "",
+            (int32_t)cnt->cfg.pid, "mnt");
+        if (!(cnt->flags & OPT_NO_CGROUPS))
                 log_infof("setting devices cgroup to %s", cnt->dev_cg);
+        log_flush();
         return (cnt);
 
  fail:
         nvc_container_free(cnt);
+        log_flush();
         return (NULL);
 }
 
+struct nvc_container *
+nvc_container_new(struct nvc_context *ctx, const struct nvc_container_config *cfg, const char *opts)
+{
+        int32_t flags;
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (opts == NULL)
+                opts = default_container_opts;
+        if ((flags = options_parse(&ctx->err, opts, &container_opts)) < 0)
+                return (NULL);
+
+        log_infof("configuring container with '%s'", opts);
+        return (new_container(ctx, cfg, flags));
+}
+
+struct nvc_container *
+nvc_container_new_flags(struct nvc_context *ctx, const struct nvc_container_config *cfg, uint32_t flags)
+{
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, !(flags & ~(uint32_t)options_mask(&container_opts))) < 0)
+                return (NULL);
+
+        log_infof("configuring container with flags 0x%"PRIx32, flags);
+        return (new_container(ctx, cfg, (int32_t)flags));
+}
+
 void
 nvc_container_free(struct nvc_container *cnt)
 {
@@ -339,7 +516,12 @@ nvc_container_free(struct nvc_container *cnt)
         free(cnt->cfg.libs_dir);
         free(cnt->cfg.libs32_dir);
         free(cnt->cfg.ldconfig);
-        free(cnt->mnt_ns);
+        xclose(cnt->mnt_ns);
+        xclose(cnt->proc_fd);
         free(cnt->dev_cg);
+        strset_free(&cnt->mounts);
+        array_free(cnt->mnts, cnt->nmnts);
+        array_free(cnt->files, cnt->nfiles);
+        free(cnt->devs);
         free(cnt);
 }
@@ -2,15 +2,22 @@
  * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/sysmacros.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#pragma GCC diagnostic push
+#include "driver_rpc.h"
+#pragma GCC diagnostic pop
+
 #include "nvc_internal.h"
 
 #include "driver.h"
@@ -30,15 +37,111 @@
                   nitems(graphics_libs_glvnd) + \
                   nitems(graphics_libs_compat))
 
+/*
+ * Info objects are backed by an arena holding all of their arrays and strings, such that building them only takes a
+ * few allocations and freeing them doesn't need to walk their content.
+ */
+struct driver_info {
+        struct nvc_driver_info info;
+        struct arena arena;
+        void *map;
+        size_t mapsize;
+};
+
+struct device_info {
+        struct nvc_device_info info;
+        struct arena arena;
+        int32_t flags;
+        void *map;
+        size_t mapsize;
+};
+
+/*
+ * Published info image (see nvc_info_publish), a flat copy of the info objects where pointers are replaced by offsets
+ * from the start of the image (zero standing for NULL), such that any process can map it read-only at any address.
+ */
+#define INFO_IMAGE_MAGIC   "NVCINFO"
+#define INFO_IMAGE_VERSION 2
+
+struct image_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t generation;
+        uint64_t size;
+        uint64_t driver;
+        uint64_t gpus;
+        uint64_t ngpus;
+        char banner[256]; /* Kernel module version line of the driver which published the image. */
+};
+
+struct image_driver {
+        uint64_t nvrm_version;
+        uint64_t cuda_version;
+        uint64_t bins;
+        uint64_t nbins;
+        uint64_t libs;
+        uint64_t nlibs;
+        uint64_t libs32;
+        uint64_t nlibs32;
+        uint64_t ipcs;
+        uint64_t nipcs;
+        uint64_t devs;
+        uint64_t ndevs;
+};
+
+struct image_node {
+        uint64_t path;
+        uint64_t id;
+};
+
+struct image_gpu {
+        uint64_t model;
+        uint64_t uuid;
+        uint64_t busid;
+        uint64_t arch;
+        struct image_node node;
+        uint64_t index;
+};
+
+struct image {
+        char *data;
+        size_t size;
+        size_t capacity;
+};
+
+static int move_string(struct error *, struct arena *, char **);
 static int select_libraries(struct error *, void *, const char *, const char *);
-static int find_library_paths(struct error *, struct nvc_driver_info *, const char *, const char * const [], size_t);
-static int find_binary_paths(struct error *, struct nvc_driver_info *, const char * const [], size_t);
+static int find_library_paths(struct error *, struct arena *, struct nvc_driver_info *, const char *,
+    const char * const [], size_t);
+static int find_binary_paths(struct error *, struct arena *, struct nvc_driver_info *, const char * const [], size_t);
 static int find_device_node(struct error *, const char *, struct nvc_device_node *);
-static int find_ipc_path(struct error *, const char *, char **);
-static int lookup_libraries(struct error *, struct nvc_driver_info *, int32_t, const char *);
-static int lookup_binaries(struct error *, struct nvc_driver_info *, int32_t);
-static int lookup_devices(struct error *, struct nvc_driver_info *, int32_t);
-static int lookup_ipcs(struct error *, struct nvc_driver_info *, int32_t);
+static int find_ipc_path(struct error *, struct arena *, const char *, char **);
+static int lookup_libraries(struct error *, struct arena *, struct nvc_driver_info *, int32_t, const char *);
+static int lookup_binaries(struct error *, struct arena *, struct nvc_driver_info *, int32_t);
+static int lookup_devices(struct error *, struct arena *, struct nvc_driver_info *, int32_t);
+static int lookup_ipcs(struct error *, struct arena *, struct nvc_driver_info *, int32_t);
+static int query_device_attributes(struct nvc_context *, struct arena *, struct nvc_device *, unsigned int, int32_t);
+static int query_device(struct nvc_context *, struct arena *, struct nvc_device *, unsigned int, int32_t);
+static int record_device(struct nvc_context *, dev_t, unsigned int);
+static const char *get_device_attribute(struct nvc_context *, struct nvc_device *, int32_t);
+static struct nvc_driver_info *new_driver_info(struct nvc_context *, int32_t);
+static struct nvc_device_info *new_device_info(struct nvc_context *, int32_t);
+static struct nvc_device_info *lookup_device_info(struct nvc_context *, const char *, int32_t);
+static bool device_info_owns(const struct device_info *, const void *);
+static int image_reserve(struct error *, struct image *, size_t, uint64_t *);
+static int image_put_str(struct error *, struct image *, const char *, uint64_t *);
+static int image_put_strs(struct error *, struct image *, char * const [], size_t, uint64_t *);
+static int image_put_nodes(struct error *, struct image *, const struct nvc_device_node *, size_t, uint64_t *);
+static int image_build(struct error *, struct image *, const struct nvc_driver_info *, const struct nvc_device_info *,
+    const unsigned int *);
+static int image_get(struct error *, const char *, size_t, uint64_t, void *, size_t);
+static int image_get_str(struct error *, const char *, size_t, uint64_t, char **);
+static int image_get_strs(struct error *, struct arena *, const char *, size_t, uint64_t, uint64_t, char ***);
+static int image_get_nodes(struct error *, struct arena *, const char *, size_t, uint64_t, uint64_t,
+    struct nvc_device_node **);
+static void *image_map(struct error *, int, size_t);
+static struct nvc_driver_info *image_load_driver(struct error *, int, size_t);
+static struct nvc_device_info *image_load_device(struct nvc_context *, int, size_t);
 
 /*
  * Display libraries are not needed.
@@ -110,6 +213,20 @@ static const char * const graphics_libs_compat[] = {
         "libGLESv2.so",                     /* OpenGL ES v2 legacy _or_ ICD loader (GLVND) */
 };
 
+/* Move a string returned by the driver into the arena, a NULL arena leaves it on the heap. */
+static int
+move_string(struct error *err, struct arena *arena, char **str)
+{
+        char *ptr;
+
+        if (arena == NULL || *str == NULL)
+                return (0);
+        ptr = arena_strdup(err, arena, *str);
+        free(*str);
+        *str = ptr;
+        return ((ptr == NULL) ? -1 : 0);
+}
+
 static int
 select_libraries(struct error *err, void *ptr, const char *orig_path, const char *alt_path)
 {
@@ -150,46 +267,54 @@ select_libraries(struct error *err, void *ptr, const char *orig_path, const char
 }
 
 static int
-find_library_paths(struct error *err, struct nvc_driver_info *info,
+find_library_paths(struct error *err, struct arena *arena, struct nvc_driver_info *info,
     const char *ldcache, const char * const libs[], size_t size)
 {
         struct ldcache ld;
+        char **paths = NULL;
+        char ***arrs[] = {&info->libs, &info->libs32};
+        size_t *sizes[] = {&info->nlibs, &info->nlibs32};
+        uint32_t archs[] = {LIB_ARCH, LIB32_ARCH};
         int rv = -1;
 
         ldcache_init(&ld, err, ldcache);
         if (ldcache_open(&ld) < 0)
                 return (-1);
 
-        info->nlibs = size;
-        info->libs = array_new(err, size);
-        if (info->libs == NULL)
-                goto fail;
-        if (ldcache_resolve(&ld, LIB_ARCH, libs,
-            info->libs, info->nlibs, select_libraries, info) < 0)
-                goto fail;
-
-        info->nlibs32 = size;
-        info->libs32 = array_new(err, size);
-        if (info->libs32 == NULL)
-                goto fail;
-        if (ldcache_resolve(&ld, LIB32_ARCH, libs,
-            info->libs32, info->nlibs32, select_libraries, info) < 0)
+        /* The cache resolves into heap allocated paths, copy them over once the selection is made. */
+        if ((paths = array_new(err, size)) == NULL)
                 goto fail;
+        for (size_t i = 0; i < nitems(arrs); ++i) {
+                *sizes[i] = size;
+                if ((*arrs[i] = arena_alloc(err, arena, size * sizeof(**arrs[i]))) == NULL)
+                        goto fail;
+                if (ldcache_resolve(&ld, archs[i], libs, paths, size, select_libraries, info) < 0)
+                        goto fail;
+                for (size_t j = 0; j < size; ++j) {
+                        if (paths[j] == NULL)
+                                continue;
+                        if (((*arrs[i])[j] = arena_strdup(err, arena, paths[j])) == NULL)
+                                goto fail;
+                        free(paths[j]);
+                        paths[j] = NULL;
+                }
+        }
         rv = 0;
 
  fail:
+        array_free(paths, size);
         if (ldcache_close(&ld) < 0)
                 return (-1);
         return (rv);
 }
 
 static int
-find_binary_paths(struct error *err, struct nvc_driver_info *info,
+find_binary_paths(struct error *err, struct arena *arena, struct nvc_driver_info *info,
     const char * const bins[], size_t size)
 {
         char *env, *ptr;
         const char *dir;
-        char path[PATH_MAX];
+        char path[PATH_MAX], real[PATH_MAX];
         int rv = -1;
 
         if ((env = secure_getenv("PATH")) == NULL) {
@@ -200,7 +325,7 @@ find_binary_paths(struct error *err, struct nvc_driver_info *info,
                 return (-1);
 
         info->nbins = size;
-        info->bins = array_new(err, size);
+        info->bins = arena_alloc(err, arena, size * sizeof(*info->bins));
         if (info->bins == NULL)
                 goto fail;
 
@@ -213,8 +338,9 @@ find_binary_paths(struct error *err, struct nvc_driver_info *info,
                         if (path_join(NULL, path, dir, bins[i]) < 0)
                                 continue;
                         if (!access(path, X_OK)) {
-                                info->bins[i] = xrealpath(err, path, NULL);
-                                if (info->bins[i] == NULL)
+                                if (xrealpath(err, path, real) == NULL)
+                                        goto fail;
+                                if ((info->bins[i] = arena_strdup(err, arena, real)) == NULL)
                                         goto fail;
                                 log_infof("selecting %s", path);
                         }
@@ -244,8 +370,9 @@ find_device_node(struct error *err, const char *path, struct nvc_device_node *no
 }
 
 static int
-find_ipc_path(struct error *err, const char *path, char **ipc)
+find_ipc_path(struct error *err, struct arena *arena, const char *path, char **ipc)
 {
+        char real[PATH_MAX];
         int ret;
 
         if ((ret = file_exists(err, path)) < 0)
@@ -255,14 +382,16 @@ find_ipc_path(struct error *err, const char *path, char **ipc)
                 log_warnf("missing ipc %s", path);
         else {
                 log_infof("listing ipc %s", path);
-                if ((*ipc = xrealpath(err, path, NULL)) == NULL)
+                if (xrealpath(err, path, real) == NULL)
+                        return (-1);
+                if ((*ipc = arena_strdup(err, arena, real)) == NULL)
                         return (-1);
         }
         return (0);
 }
 
 static int
-lookup_libraries(struct error *err, struct nvc_driver_info *info, int32_t flags, const char *ldcache)
+lookup_libraries(struct error *err, struct arena *arena, struct nvc_driver_info *info, int32_t flags, const char *ldcache)
 {
         const char *libs[MAX_LIBS];
         const char **ptr = libs;
@@ -276,7 +405,7 @@ lookup_libraries(struct error *err, struct nvc_driver_info *info, int32_t flags,
         else
                 ptr = array_append(ptr, graphics_libs_glvnd, nitems(graphics_libs_glvnd));
 
-        if (find_library_paths(err, info, ldcache, libs, (size_t)(ptr - libs)) < 0)
+        if (find_library_paths(err, arena, info, ldcache, libs, (size_t)(ptr - libs)) < 0)
                 return (-1);
 
         for (size_t i = 0; info->libs != NULL && i < info->nlibs; ++i) {
@@ -293,7 +422,7 @@ lookup_libraries(struct error *err, struct nvc_driver_info *info, int32_t flags,
 }
 
 static int
-lookup_binaries(struct error *err, struct nvc_driver_info *info, int32_t flags)
+lookup_binaries(struct error *err, struct arena *arena, struct nvc_driver_info *info, int32_t flags)
 {
         const char *bins[MAX_BINS];
         const char **ptr = bins;
@@ -302,7 +431,7 @@ lookup_binaries(struct error *err, struct nvc_driver_info *info, int32_t flags)
         if (!(flags & OPT_NO_MPS))
                 ptr = array_append(ptr, compute_bins, nitems(compute_bins));
 
-        if (find_binary_paths(err, info, bins, (size_t)(ptr - bins)) < 0)
+        if (find_binary_paths(err, arena, info, bins, (size_t)(ptr - bins)) < 0)
                 return (-1);
 
         for (size_t i = 0; info->bins != NULL && i < info->nbins; ++i) {
@@ -314,7 +443,7 @@ lookup_binaries(struct error *err, struct nvc_driver_info *info, int32_t flags)
 }
 
 static int
-lookup_devices(struct error *err, struct nvc_driver_info *info, int32_t flags)
+lookup_devices(struct error *err, struct arena *arena, struct nvc_driver_info *info, int32_t flags)
 {
         struct nvc_device_node uvm, uvm_tools, *node;
         int has_uvm = 0;
@@ -328,7 +457,7 @@ lookup_devices(struct error *err, struct nvc_driver_info *info, int32_t flags)
         }
 
         info->ndevs = (size_t)(1 + has_uvm + has_uvm_tools);
-        info->devs = node = xcalloc(err, info->ndevs, sizeof(*info->devs));
+        info->devs = node = arena_alloc(err, arena, info->ndevs * sizeof(*info->devs));
         if (info->devs == NULL)
                 return (-1);
 
@@ -345,24 +474,24 @@ lookup_devices(struct error *err, struct nvc_driver_info *info, int32_t flags)
 }
 
 static int
-lookup_ipcs(struct error *err, struct nvc_driver_info *info, int32_t flags)
+lookup_ipcs(struct error *err, struct arena *arena, struct nvc_driver_info *info, int32_t flags)
 {
         char **ptr;
         const char *mps;
 
         info->nipcs = 2;
-        info->ipcs = ptr = array_new(err, info->nipcs);
+        info->ipcs = ptr = arena_alloc(err, arena, info->nipcs * sizeof(*info->ipcs));
         if (info->ipcs == NULL)
                 return (-1);
 
         if (!(flags & OPT_NO_PERSISTENCED)) {
-                if (find_ipc_path(err, NV_PERSISTENCED_SOCKET, ptr++) < 0)
+                if (find_ipc_path(err, arena, NV_PERSISTENCED_SOCKET, ptr++) < 0)
                         return (-1);
         }
         if (!(flags & OPT_NO_MPS)) {
                 if ((mps = secure_getenv("CUDA_MPS_PIPE_DIRECTORY")) == NULL)
                         mps = NV_MPS_PIPE_DIR;
-                if (find_ipc_path(err, mps, ptr++) < 0)
+                if (find_ipc_path(err, arena, mps, ptr++) < 0)
                         return (-1);
         }
         array_pack(info->ipcs, &info->nipcs);
@@ -395,102 +524,828 @@ match_library_flags(const char *lib, int32_t flags)
         return (false);
 }
 
-struct nvc_driver_info *
-nvc_driver_info_new(struct nvc_context *ctx, const char *opts)
+static struct nvc_driver_info *
+new_driver_info(struct nvc_context *ctx, int32_t flags)
 {
+        struct driver_info *impl;
         struct nvc_driver_info *info;
-        int32_t flags;
 
-        if (validate_context(ctx) < 0)
-                return (NULL);
-        if (opts == NULL)
-                opts = default_driver_opts;
-        if ((flags = options_parse(&ctx->err, opts, driver_opts, nitems(driver_opts))) < 0)
+        if ((impl = xcalloc(&ctx->err, 1, sizeof(*impl))) == NULL)
                 return (NULL);
+        info = &impl->info;
 
-        log_infof("requesting driver information with '%s'", opts);
-        if ((info = xcalloc(&ctx->err, 1, sizeof(*info))) == NULL)
-                return (NULL);
-
-        if (driver_get_rm_version(&ctx->drv, &info->nvrm_version) < 0)
+        /*
+         * Start with the lookups which don't depend on the driver service, this gives it a chance to finish
+         * initializing before we block on it.
+         */
+        if (lookup_binaries(&ctx->err, &impl->arena, info, flags) < 0)
                 goto fail;
-        if (driver_get_cuda_version(&ctx->drv, &info->cuda_version) < 0)
+        if (lookup_devices(&ctx->err, &impl->arena, info, flags) < 0)
                 goto fail;
-        if (lookup_libraries(&ctx->err, info, flags, ctx->cfg.ldcache) < 0)
+        if (lookup_ipcs(&ctx->err, &impl->arena, info, flags) < 0)
                 goto fail;
-        if (lookup_binaries(&ctx->err, info, flags) < 0)
+        if (driver_get_rm_version(&ctx->drv, &info->nvrm_version) < 0 ||
+            move_string(&ctx->err, &impl->arena, &info->nvrm_version) < 0)
                 goto fail;
-        if (lookup_devices(&ctx->err, info, flags) < 0)
+        if (driver_get_cuda_version(&ctx->drv, &info->cuda_version) < 0 ||
+            move_string(&ctx->err, &impl->arena, &info->cuda_version) < 0)
                 goto fail;
-        if (lookup_ipcs(&ctx->err, info, flags) < 0)
+        if (lookup_libraries(&ctx->err, &impl->arena, info, flags, ctx->cfg.ldcache) < 0)
                 goto fail;
+        log_flush();
         return (info);
 
  fail:
         nvc_driver_info_free(info);
+        log_flush();
         return (NULL);
 }
 
+struct nvc_driver_info *
+nvc_driver_info_new(struct nvc_context *ctx, const char *opts)
+{
+        int32_t flags;
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (opts == NULL)
+                opts = default_driver_opts;
+        if ((flags = options_parse(&ctx->err, opts, &driver_opts)) < 0)
+                return (NULL);
+
+        log_infof("requesting driver information with '%s'", opts);
+        return (new_driver_info(ctx, flags));
+}
+
+struct nvc_driver_info *
+nvc_driver_info_new_flags(struct nvc_context *ctx, uint32_t flags)
+{
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, !(flags & ~(uint32_t)options_mask(&driver_opts))) < 0)
+                return (NULL);
+
+        log_infof("requesting driver information with flags 0x%"PRIx32, flags);
+        return (new_driver_info(ctx, (int32_t)flags));
+}
+
 void
 nvc_driver_info_free(struct nvc_driver_info *info)
 {
+        struct driver_info *impl;
+
         if (info == NULL)
                 return;
-        free(info->nvrm_version);
-        free(info->cuda_version);
-        array_free(info->bins, info->nbins);
-        array_free(info->libs, info->nlibs);
-        array_free(info->libs32, info->nlibs32);
-        array_free(info->ipcs, info->nipcs);
-        free(info->devs);
-        free(info);
+        impl = container_of(info, struct driver_info, info);
+        if (impl->map != NULL)
+                munmap(impl->map, impl->mapsize);
+        arena_free(&impl->arena);
+        free(impl);
 }
 
-struct nvc_device_info *
-nvc_device_info_new(struct nvc_context *ctx, const char *opts)
+static struct nvc_device_info *
+new_device_info(struct nvc_context *ctx, int32_t flags)
 {
+        struct device_info *impl;
         struct nvc_device_info *info;
         struct nvc_device *gpu;
-        unsigned int n, minor;
-        struct driver_device *dev;
+        unsigned int n;
+        unsigned int dev;
+
+        if ((impl = xcalloc(&ctx->err, 1, sizeof(*impl))) == NULL)
+                return (NULL);
+        info = &impl->info;
+        impl->flags = flags;
+
+        if (driver_get_device_count(&ctx->drv, &n) < 0)
+                goto fail;
+        info->ngpus = n;
+        info->gpus = gpu = arena_alloc(&ctx->err, &impl->arena, info->ngpus * sizeof(*info->gpus));
+        if (info->gpus == NULL)
+                goto fail;
+
+        for (unsigned int i = 0; i < n; ++i, ++gpu) {
+                if (driver_get_device(&ctx->drv, i, &dev) < 0)
+                        goto fail;
+                if (query_device(ctx, &impl->arena, gpu, dev, flags) < 0)
+                        goto fail;
+        }
+        log_flush();
+        return (info);
+
+ fail:
+        nvc_device_info_free(info);
+        log_flush();
+        return (NULL);
+}
+
+struct nvc_device_info *
+nvc_device_info_new(struct nvc_context *ctx, const char *opts)
+{
         int32_t flags;
 
         if (validate_context(ctx) < 0)
                 return (NULL);
         if (opts == NULL)
                 opts = default_device_opts;
-        if ((flags = options_parse(&ctx->err, opts, device_opts, nitems(device_opts))) < 0)
+        if ((flags = options_parse(&ctx->err, opts, &device_opts)) < 0)
                 return (NULL);
 
         log_infof("requesting device information with '%s'", opts);
-        if ((info = xcalloc(&ctx->err, 1, sizeof(*info))) == NULL)
+        return (new_device_info(ctx, flags));
+}
+
+struct nvc_device_info *
+nvc_device_info_new_flags(struct nvc_context *ctx, uint32_t flags)
+{
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, !(flags & ~(uint32_t)options_mask(&device_opts))) < 0)
                 return (NULL);
 
-        if (driver_get_device_count(&ctx->drv, &n) < 0)
+        log_infof("requesting device information with flags 0x%"PRIx32, flags);
+        return (new_device_info(ctx, (int32_t)flags));
+}
+
+static struct nvc_device_info *
+lookup_device_info(struct nvc_context *ctx, const char *ids, int32_t flags)
+{
+        struct device_info *impl;
+        struct nvc_device_info *info;
+        char *buf = NULL;
+        char *ptr, *id;
+        unsigned int *devs = NULL;
+        unsigned int dev;
+        size_t i, n;
+        int ret;
+
+        if ((impl = xcalloc(&ctx->err, 1, sizeof(*impl))) == NULL)
+                return (NULL);
+        info = &impl->info;
+        impl->flags = flags;
+
+        for (n = 1, ptr = (char *)ids; (ptr = strchr(ptr, ',')) != NULL; ++ptr, ++n);
+        if ((info->gpus = arena_alloc(&ctx->err, &impl->arena, n * sizeof(*info->gpus))) == NULL)
                 goto fail;
-        info->ngpus = n;
-        info->gpus = gpu = xcalloc(&ctx->err, info->ngpus, sizeof(*info->gpus));
-        if (info->gpus == NULL)
+        if ((devs = xcalloc(&ctx->err, n, sizeof(*devs))) == NULL)
+                goto fail;
+        if ((buf = ptr = xstrdup(&ctx->err, ids)) == NULL)
                 goto fail;
 
-        for (unsigned int i = 0; i < n; ++i, ++gpu) {
-                if (driver_get_device(&ctx->drv, i, &dev) < 0)
-                        goto fail;
-                if (driver_get_device_model(&ctx->drv, dev, &gpu->model) < 0)
+        while ((id = strsep(&ptr, ",")) != NULL) {
+                if (*id == '\0')
+                        continue;
+                if (!strncasecmp(id, "GPU-", strlen("GPU-")))
+                        ret = driver_get_device_by_uuid(&ctx->drv, id, &dev);
+                else
+                        ret = driver_get_device_by_busid(&ctx->drv, id, &dev);
+                if (ret < 0)
                         goto fail;
-                if (driver_get_device_uuid(&ctx->drv, dev, &gpu->uuid) < 0)
+
+                for (i = 0; i < info->ngpus && devs[i] != dev; ++i);
+                if (i < info->ngpus)
+                        continue;
+                devs[info->ngpus] = dev;
+                if (query_device(ctx, &impl->arena, &info->gpus[info->ngpus++], dev, flags) < 0)
                         goto fail;
-                if (driver_get_device_busid(&ctx->drv, dev, &gpu->busid) < 0)
+        }
+        free(devs);
+        free(buf);
+        log_flush();
+        return (info);
+
+ fail:
+        free(devs);
+        free(buf);
+        nvc_device_info_free(info);
+        log_flush();
+        return (NULL);
+}
+
+struct nvc_device_info *
+nvc_device_info_lookup(struct nvc_context *ctx, const char *ids, const char *opts)
+{
+        int32_t flags;
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, ids != NULL) < 0)
+                return (NULL);
+        if (opts == NULL)
+                opts = default_device_opts;
+        if ((flags = options_parse(&ctx->err, opts, &device_opts)) < 0)
+                return (NULL);
+
+        log_infof("looking up devices %s with '%s'", ids, opts);
+        return (lookup_device_info(ctx, ids, flags));
+}
+
+struct nvc_device_info *
+nvc_device_info_lookup_flags(struct nvc_context *ctx, const char *ids, uint32_t flags)
+{
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, ids != NULL && !(flags & ~(uint32_t)options_mask(&device_opts))) < 0)
+                return (NULL);
+
+        log_infof("looking up devices %s with flags 0x%"PRIx32, ids, flags);
+        return (lookup_device_info(ctx, ids, (int32_t)flags));
+}
+
+static bool
+device_info_owns(const struct device_info *impl, const void *ptr)
+{
+        if (impl->map != NULL && (const char *)ptr >= (const char *)impl->map &&
+            (const char *)ptr < (const char *)impl->map + impl->mapsize)
+                return (true);
+        return (arena_owns(&impl->arena, ptr));
+}
+
+void
+nvc_device_info_free(struct nvc_device_info *info)
+{
+        struct device_info *impl;
+        struct nvc_device *gpu;
+
+        if (info == NULL)
+                return;
+        impl = container_of(info, struct device_info, info);
+
+        /* Attributes skipped during enumeration are queried on demand and live outside of the arena. */
+        for (size_t i = 0; (impl->flags & OPT_LAZY_DEVICE) && info->gpus != NULL && i < info->ngpus; ++i) {
+                gpu = &info->gpus[i];
+                if (!device_info_owns(impl, gpu->model))
+                        free(gpu->model);
+                if (!device_info_owns(impl, gpu->uuid))
+                        free(gpu->uuid);
+                if (!device_info_owns(impl, gpu->busid))
+                        free(gpu->busid);
+                if (!device_info_owns(impl, gpu->arch))
+                        free(gpu->arch);
+        }
+        if (impl->map != NULL)
+                munmap(impl->map, impl->mapsize);
+        arena_free(&impl->arena);
+        free(impl);
+}
+
+static int
+query_device_attributes(struct nvc_context *ctx, struct arena *arena, struct nvc_device *gpu, unsigned int dev,
+    int32_t flags)
+{
+        if (!(flags & OPT_NO_MODEL) && gpu->model == NULL) {
+                if (driver_get_device_model(&ctx->drv, dev, &gpu->model) < 0 ||
+                    move_string(&ctx->err, arena, &gpu->model) < 0)
+                        return (-1);
+        }
+        if (!(flags & OPT_NO_UUID) && gpu->uuid == NULL) {
+                if (driver_get_device_uuid(&ctx->drv, dev, &gpu->uuid) < 0 ||
+                    move_string(&ctx->err, arena, &gpu->uuid) < 0)
+                        return (-1);
+        }
+        if (!(flags & OPT_NO_BUSID) && gpu->busid == NULL) {
+                if (driver_get_device_busid(&ctx->drv, dev, &gpu->busid) < 0 ||
+                    move_string(&ctx->err, arena, &gpu->busid) < 0)
+                        return (-1);
+        }
+        if (!(flags & OPT_NO_ARCH) && gpu->arch == NULL) {
+                if (driver_get_device_arch(&ctx->drv, dev, &gpu->arch) < 0 ||
+                    move_string(&ctx->err, arena, &gpu->arch) < 0)
+                        return (-1);
+        }
+        return (0);
+}
+
+static int
+query_device(struct nvc_context *ctx, struct arena *arena, struct nvc_device *gpu, unsigned int dev, int32_t flags)
+{
+        char path[PATH_MAX];
+        unsigned int minor;
+
+        if (query_device_attributes(ctx, arena, gpu, dev, flags) < 0)
+                return (-1);
+        if (driver_get_device_minor(&ctx->drv, dev, &minor) < 0)
+                return (-1);
+        if (xsnprintf(&ctx->err, path, sizeof(path), NV_DEVICE_PATH, minor) < 0)
+                return (-1);
+        if ((gpu->node.path = arena_strdup(&ctx->err, arena, path)) == NULL)
+                return (-1);
+        gpu->node.id = makedev(NV_DEVICE_MAJOR, minor);
+        if (record_device(ctx, gpu->node.id, dev) < 0)
+                return (-1);
+
+        log_infof("listing device %s (%s at %s)", gpu->node.path,
+            (gpu->uuid != NULL) ? gpu->uuid : "?", (gpu->busid != NULL) ? gpu->busid : "?");
+        return (0);
+}
+
+/*
+ * Device handles are kept out of the public device structure, the context remembers them by device node instead.
+ */
+static int
+record_device(struct nvc_context *ctx, dev_t id, unsigned int dev)
+{
+        struct device_index *ptr;
+
+        for (size_t i = 0; i < ctx->ndevs; ++i) {
+                if (ctx->devs[i].id == id) {
+                        ctx->devs[i].index = dev;
+                        return (0);
+                }
+        }
+        if ((ptr = xrealloc(&ctx->err, ctx->devs, (ctx->ndevs + 1) * sizeof(*ptr))) == NULL)
+                return (-1);
+        ctx->devs = ptr;
+        ctx->devs[ctx->ndevs++] = (struct device_index){id, dev};
+        return (0);
+}
+
+int
+get_device_index(struct nvc_context *ctx, const struct nvc_device *gpu, unsigned int *dev)
+{
+        for (size_t i = 0; i < ctx->ndevs; ++i) {
+                if (ctx->devs[i].id == gpu->node.id) {
+                        *dev = ctx->devs[i].index;
+                        return (0);
+                }
+        }
+        error_setx(&ctx->err, "unknown device: %s", (gpu->node.path != NULL) ? gpu->node.path : "?");
+        return (-1);
+}
+
+static const char *
+get_device_attribute(struct nvc_context *ctx, struct nvc_device *gpu, int32_t attr)
+{
+        unsigned int idx, dev;
+        char **val;
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, gpu != NULL) < 0)
+                return (NULL);
+
+        switch (attr) {
+        case OPT_NO_MODEL:
+                val = &gpu->model;
+                break;
+        case OPT_NO_UUID:
+                val = &gpu->uuid;
+                break;
+        case OPT_NO_BUSID:
+                val = &gpu->busid;
+                break;
+        default:
+                val = &gpu->arch;
+                break;
+        }
+        if (*val != NULL)
+                return (*val);
+
+        /* The attribute was skipped during enumeration, query it now (it is freed along with its info). */
+        if (get_device_index(ctx, gpu, &idx) < 0)
+                return (NULL);
+        if (driver_get_device(&ctx->drv, idx, &dev) < 0)
+                return (NULL);
+        if (query_device_attributes(ctx, NULL, gpu, dev, OPT_LAZY_DEVICE & ~attr) < 0)
+                return (NULL);
+        return (*val);
+}
+
+const char *
+nvc_device_get_model(struct nvc_context *ctx, struct nvc_device *gpu)
+{
+        return (get_device_attribute(ctx, gpu, OPT_NO_MODEL));
+}
+
+const char *
+nvc_device_get_uuid(struct nvc_context *ctx, struct nvc_device *gpu)
+{
+        return (get_device_attribute(ctx, gpu, OPT_NO_UUID));
+}
+
+const char *
+nvc_device_get_busid(struct nvc_context *ctx, struct nvc_device *gpu)
+{
+        return (get_device_attribute(ctx, gpu, OPT_NO_BUSID));
+}
+
+const char *
+nvc_device_get_arch(struct nvc_context *ctx, struct nvc_device *gpu)
+{
+        return (get_device_attribute(ctx, gpu, OPT_NO_ARCH));
+}
+
+/*
+ * Fill in the properties of the given devices, they are all queried with a single call to the driver service
+ * regardless of their number.
+ */
+int
+nvc_device_get_props(struct nvc_context *ctx, struct nvc_device * const gpus[], size_t size, struct nvc_device_props props[])
+{
+        struct driver_props *res = NULL;
+        unsigned int *idxs = NULL;
+        int rv = -1;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, (size == 0 || (gpus != NULL && props != NULL)) && size <= UINT_MAX) < 0)
+                return (-1);
+        if (size == 0)
+                return (0);
+
+        if ((idxs = xcalloc(&ctx->err, size, sizeof(*idxs))) == NULL)
+                return (-1);
+        if ((res = xcalloc(&ctx->err, size, sizeof(*res))) == NULL)
+                goto fail;
+        for (size_t i = 0; i < size; ++i) {
+                if (validate_args(ctx, gpus[i] != NULL) < 0)
                         goto fail;
-                if (driver_get_device_arch(&ctx->drv, dev, &gpu->arch) < 0)
+                if (get_device_index(ctx, gpus[i], &idxs[i]) < 0)
                         goto fail;
-                if (driver_get_device_minor(&ctx->drv, dev, &minor) < 0)
+        }
+
+        log_infof("requesting properties of %zu device(s)", size);
+        if (driver_get_device_props(&ctx->drv, idxs, (unsigned int)size, res) < 0)
+                goto fail;
+        for (size_t i = 0; i < size; ++i) {
+                props[i].memory = res[i].memory;
+                props[i].brand = res[i].brand;
+                props[i].compute_mode = res[i].compute_mode;
+                props[i].ecc = res[i].ecc;
+        }
+        rv = 0;
+
+ fail:
+        free(res);
+        free(idxs);
+        return (rv);
+}
+
+static int
+image_reserve(struct error *err, struct image *img, size_t len, uint64_t *off)
+{
+        size_t size, capacity;
+        char *ptr;
+
+        *off = (img->size + 7) & ~(size_t)7;
+        size = *off + len;
+        if (size > img->capacity) {
+                capacity = MAX(size, img->capacity * 2);
+                if ((ptr = xrealloc(err, img->data, capacity)) == NULL)
+                        return (-1);
+                memset(ptr + img->capacity, 0, capacity - img->capacity);
+                img->data = ptr;
+                img->capacity = capacity;
+        }
+        img->size = size;
+        return (0);
+}
+
+static int
+image_put_str(struct error *err, struct image *img, const char *str, uint64_t *off)
+{
+        size_t len;
+
+        *off = 0;
+        if (str == NULL)
+                return (0);
+        len = strlen(str) + 1;
+        if (image_reserve(err, img, len, off) < 0)
+                return (-1);
+        memcpy(img->data + *off, str, len);
+        return (0);
+}
+
+static int
+image_put_strs(struct error *err, struct image *img, char * const strs[], size_t size, uint64_t *off)
+{
+        uint64_t str;
+
+        if (image_reserve(err, img, size * sizeof(str), off) < 0)
+                return (-1);
+        for (size_t i = 0; i < size; ++i) {
+                if (image_put_str(err, img, strs[i], &str) < 0)
+                        return (-1);
+                memcpy(img->data + *off + i * sizeof(str), &str, sizeof(str));
+        }
+        return (0);
+}
+
+static int
+image_put_nodes(struct error *err, struct image *img, const struct nvc_device_node *nodes, size_t size, uint64_t *off)
+{
+        struct image_node node;
+
+        if (image_reserve(err, img, size * sizeof(node), off) < 0)
+                return (-1);
+        for (size_t i = 0; i < size; ++i) {
+                node.id = nodes[i].id;
+                if (image_put_str(err, img, nodes[i].path, &node.path) < 0)
+                        return (-1);
+                memcpy(img->data + *off + i * sizeof(node), &node, sizeof(node));
+        }
+        return (0);
+}
+
+static int
+image_build(struct error *err, struct image *img, const struct nvc_driver_info *drv, const struct nvc_device_info *dev,
+    const unsigned int *idxs)
+{
+        struct image_header hdr = {.magic = INFO_IMAGE_MAGIC, .version = INFO_IMAGE_VERSION};
+        struct image_driver d = {0};
+        struct image_gpu g;
+        uint64_t off;
+
+        if (image_reserve(err, img, sizeof(hdr), &off) < 0)
+                return (-1);
+
+        if (image_put_str(err, img, drv->nvrm_version, &d.nvrm_version) < 0 ||
+            image_put_str(err, img, drv->cuda_version, &d.cuda_version) < 0 ||
+            image_put_strs(err, img, drv->bins, drv->nbins, &d.bins) < 0 ||
+            image_put_strs(err, img, drv->libs, drv->nlibs, &d.libs) < 0 ||
+            image_put_strs(err, img, drv->libs32, drv->nlibs32, &d.libs32) < 0 ||
+            image_put_strs(err, img, drv->ipcs, drv->nipcs, &d.ipcs) < 0 ||
+            image_put_nodes(err, img, drv->devs, drv->ndevs, &d.devs) < 0)
+                return (-1);
+        d.nbins = drv->nbins;
+        d.nlibs = drv->nlibs;
+        d.nlibs32 = drv->nlibs32;
+        d.nipcs = drv->nipcs;
+        d.ndevs = drv->ndevs;
+        if (image_reserve(err, img, sizeof(d), &hdr.driver) < 0)
+                return (-1);
+        memcpy(img->data + hdr.driver, &d, sizeof(d));
+
+        if (image_reserve(err, img, dev->ngpus * sizeof(g), &hdr.gpus) < 0)
+                return (-1);
+        for (size_t i = 0; i < dev->ngpus; ++i) {
+                g = (struct image_gpu){.index = idxs[i], .node.id = dev->gpus[i].node.id};
+                if (image_put_str(err, img, dev->gpus[i].model, &g.model) < 0 ||
+                    image_put_str(err, img, dev->gpus[i].uuid, &g.uuid) < 0 ||
+                    image_put_str(err, img, dev->gpus[i].busid, &g.busid) < 0 ||
+                    image_put_str(err, img, dev->gpus[i].arch, &g.arch) < 0 ||
+                    image_put_str(err, img, dev->gpus[i].node.path, &g.node.path) < 0)
+                        return (-1);
+                memcpy(img->data + hdr.gpus + i * sizeof(g), &g, sizeof(g));
+        }
+        hdr.ngpus = dev->ngpus;
+        hdr.size = img->size;
+        memcpy(img->data, &hdr, sizeof(hdr));
+        return (0);
+}
+
+/*
+ * Publish a position-independent image of the driver and device information for other processes to load instead
+ * of querying the driver. The image is written next to its destination and renamed over it, readers which already
+ * mapped the previous generation keep it until they release their info objects.
+ */
+int
+nvc_info_publish(struct nvc_context *ctx, const char *path, const struct nvc_driver_info *drv,
+    const struct nvc_device_info *dev)
+{
+        struct image img = {0};
+        struct image_header hdr = {0};
+        unsigned int *idxs = NULL;
+        char banner[sizeof(hdr.banner)] = {0};
+        char *tmp = NULL;
+        uint32_t generation = 1;
+        ssize_t n;
+        int fd = -1;
+        int rv = -1;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, drv != NULL && dev != NULL) < 0)
+                return (-1);
+        if (path == NULL)
+                path = NVC_INFO_PATH;
+
+        if ((fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW)) >= 0) {
+                if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && !memcmp(hdr.magic, INFO_IMAGE_MAGIC, sizeof(hdr.magic)))
+                        generation = hdr.generation + 1;
+                close(fd);
+                fd = -1;
+        }
+
+        log_infof("publishing driver information to %s (generation %"PRIu32")", path, generation);
+        if (file_read_line(&ctx->err, NV_PROC_DRIVER "/version", banner, sizeof(banner)) < 0)
+                goto fail;
+        if (dev->ngpus > 0 && (idxs = xcalloc(&ctx->err, dev->ngpus, sizeof(*idxs))) == NULL)
+                goto fail;
+        for (size_t i = 0; i < dev->ngpus; ++i) {
+                if (get_device_index(ctx, &dev->gpus[i], &idxs[i]) < 0)
                         goto fail;
-                if (xasprintf(&ctx->err, &gpu->node.path, NV_DEVICE_PATH, minor) < 0)
+        }
+        if (image_build(&ctx->err, &img, drv, dev, idxs) < 0)
+                goto fail;
+        memcpy(img.data + offsetof(struct image_header, generation), &generation, sizeof(generation));
+        memcpy(img.data + offsetof(struct image_header, banner), banner, sizeof(banner));
+
+        if (xasprintf(&ctx->err, &tmp, "%s.XXXXXX", path) < 0)
+                goto fail;
+        if ((fd = mkostemp(tmp, O_CLOEXEC)) < 0) {
+                error_set(&ctx->err, "file creation failed: %s", tmp);
+                free(tmp);
+                tmp = NULL;
+                goto fail;
+        }
+        if (fchmod(fd, 0644) < 0) {
+                error_set(&ctx->err, "change permissions failed: %s", tmp);
+                goto fail;
+        }
+        for (size_t off = 0; off < img.size; off += (size_t)n) {
+                if ((n = write(fd, img.data + off, img.size - off)) < 0) {
+                        if (errno == EINTR) {
+                                n = 0;
+                                continue;
+                        }
+                        error_set(&ctx->err, "write error: %s", tmp);
                         goto fail;
-                gpu->node.id = makedev(NV_DEVICE_MAJOR, minor);
+                }
+        }
+        if (rename(tmp, path) < 0) {
+                error_set(&ctx->err, "file rename failed: %s", path);
+                goto fail;
+        }
+        rv = 0;
+
+ fail:
+        if (rv < 0 && tmp != NULL)
+                unlink(tmp);
+        xclose(fd);
+        free(tmp);
+        free(idxs);
+        free(img.data);
+        return (rv);
+}
+
+static int
+image_get(struct error *err, const char *map, size_t size, uint64_t off, void *data, size_t len)
+{
+        if (off > size || size - off < len) {
+                error_setx(err, "invalid info image");
+                return (-1);
+        }
+        memcpy(data, map + off, len);
+        return (0);
+}
+
+static int
+image_get_str(struct error *err, const char *map, size_t size, uint64_t off, char **str)
+{
+        *str = NULL;
+        if (off == 0)
+                return (0);
+        if (off >= size || memchr(map + off, '\0', size - off) == NULL) {
+                error_setx(err, "invalid info image");
+                return (-1);
+        }
+        *str = (char *)map + off;
+        return (0);
+}
+
+static int
+image_get_strs(struct error *err, struct arena *arena, const char *map, size_t size, uint64_t off, uint64_t n,
+    char ***strs)
+{
+        uint64_t str;
+
+        *strs = NULL;
+        if (n == 0)
+                return (0);
+        if (off > size || (size - off) / sizeof(str) < n) {
+                error_setx(err, "invalid info image");
+                return (-1);
+        }
+        if ((*strs = arena_alloc(err, arena, n * sizeof(**strs))) == NULL)
+                return (-1);
+        for (size_t i = 0; i < n; ++i) {
+                memcpy(&str, map + off + i * sizeof(str), sizeof(str));
+                if (image_get_str(err, map, size, str, &(*strs)[i]) < 0)
+                        return (-1);
+        }
+        return (0);
+}
+
+static int
+image_get_nodes(struct error *err, struct arena *arena, const char *map, size_t size, uint64_t off, uint64_t n,
+    struct nvc_device_node **nodes)
+{
+        struct image_node node;
+
+        *nodes = NULL;
+        if (n == 0)
+                return (0);
+        if (off > size || (size - off) / sizeof(node) < n) {
+                error_setx(err, "invalid info image");
+                return (-1);
+        }
+        if ((*nodes = arena_alloc(err, arena, n * sizeof(**nodes))) == NULL)
+                return (-1);
+        for (size_t i = 0; i < n; ++i) {
+                memcpy(&node, map + off + i * sizeof(node), sizeof(node));
+                (*nodes)[i].id = (dev_t)node.id;
+                if (image_get_str(err, map, size, node.path, &(*nodes)[i].path) < 0)
+                        return (-1);
+        }
+        return (0);
+}
+
+static void *
+image_map(struct error *err, int fd, size_t size)
+{
+        void *map;
+
+        if ((map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+                error_set(err, "mmap failed");
+                return (NULL);
+        }
+        return (map);
+}
+
+static struct nvc_driver_info *
+image_load_driver(struct error *err, int fd, size_t size)
+{
+        struct driver_info *impl;
+        struct nvc_driver_info *info;
+        struct image_header hdr;
+        struct image_driver d;
+        const char *map;
+
+        if ((impl = xcalloc(err, 1, sizeof(*impl))) == NULL)
+                return (NULL);
+        info = &impl->info;
+        if ((impl->map = image_map(err, fd, size)) == NULL)
+                goto fail;
+        impl->mapsize = size;
+        map = impl->map;
 
-                log_infof("listing device %s (%s at %s)", gpu->node.path, gpu->uuid, gpu->busid);
+        if (image_get(err, map, size, 0, &hdr, sizeof(hdr)) < 0 ||
+            image_get(err, map, size, hdr.driver, &d, sizeof(d)) < 0)
+                goto fail;
+        if (image_get_str(err, map, size, d.nvrm_version, &info->nvrm_version) < 0 ||
+            image_get_str(err, map, size, d.cuda_version, &info->cuda_version) < 0 ||
+            image_get_strs(err, &impl->arena, map, size, d.bins, d.nbins, &info->bins) < 0 ||
+            image_get_strs(err, &impl->arena, map, size, d.libs, d.nlibs, &info->libs) < 0 ||
+            image_get_strs(err, &impl->arena, map, size, d.libs32, d.nlibs32, &info->libs32) < 0 ||
+            image_get_strs(err, &impl->arena, map, size, d.ipcs, d.nipcs, &info->ipcs) < 0 ||
+            image_get_nodes(err, &impl->arena, map, size, d.devs, d.ndevs, &info->devs) < 0)
+                goto fail;
+        info->nbins = (size_t)d.nbins;
+        info->nlibs = (size_t)d.nlibs;
+        info->nlibs32 = (size_t)d.nlibs32;
+        info->nipcs = (size_t)d.nipcs;
+        info->ndevs = (size_t)d.ndevs;
+        return (info);
+
+ fail:
+        nvc_driver_info_free(info);
+        return (NULL);
+}
+
+static struct nvc_device_info *
+image_load_device(struct nvc_context *ctx, int fd, size_t size)
+{
+        struct error *err = &ctx->err;
+        struct device_info *impl;
+        struct nvc_device_info *info;
+        struct nvc_device *gpu;
+        struct image_header hdr;
+        struct image_gpu g;
+        const char *map;
+
+        if ((impl = xcalloc(err, 1, sizeof(*impl))) == NULL)
+                return (NULL);
+        info = &impl->info;
+        /* Attributes missing from the image can still be queried lazily. */
+        impl->flags = OPT_LAZY_DEVICE;
+        if ((impl->map = image_map(err, fd, size)) == NULL)
+                goto fail;
+        impl->mapsize = size;
+        map = impl->map;
+
+        if (image_get(err, map, size, 0, &hdr, sizeof(hdr)) < 0)
+                goto fail;
+        if (hdr.ngpus > 0) {
+                if (hdr.gpus > size || (size - hdr.gpus) / sizeof(g) < hdr.ngpus) {
+                        error_setx(err, "invalid info image");
+                        goto fail;
+                }
+                if ((info->gpus = arena_alloc(err, &impl->arena, hdr.ngpus * sizeof(*info->gpus))) == NULL)
+                        goto fail;
+        }
+        for (size_t i = 0; i < hdr.ngpus; ++i, ++info->ngpus) {
+                gpu = &info->gpus[i];
+                memcpy(&g, map + hdr.gpus + i * sizeof(g), sizeof(g));
+                gpu->node.id = (dev_t)g.node.id;
+                if (record_device(ctx, gpu->node.id, (unsigned int)g.index) < 0)
+                        goto fail;
+                if (image_get_str(err, map, size, g.model, &gpu->model) < 0 ||
+                    image_get_str(err, map, size, g.uuid, &gpu->uuid) < 0 ||
+                    image_get_str(err, map, size, g.busid, &gpu->busid) < 0 ||
+                    image_get_str(err, map, size, g.arch, &gpu->arch) < 0 ||
+                    image_get_str(err, map, size, g.node.path, &gpu->node.path) < 0)
+                        goto fail;
         }
         return (info);
 
@@ -499,18 +1354,69 @@ nvc_device_info_new(struct nvc_context *ctx, const char *opts)
         return (NULL);
 }
 
-void
-nvc_device_info_free(struct nvc_device_info *info)
+/*
+ * Load the driver and/or device information published by nvc_info_publish.
+ * The strings of the resulting objects point directly into the read-only mapping of the image.
+ */
+int
+nvc_info_load(struct nvc_context *ctx, const char *path, struct nvc_driver_info **drv, struct nvc_device_info **dev)
 {
-        if (info == NULL)
-                return;
-        for (size_t i = 0; info->gpus != NULL && i < info->ngpus; ++i) {
-                free(info->gpus[i].model);
-                free(info->gpus[i].uuid);
-                free(info->gpus[i].busid);
-                free(info->gpus[i].arch);
-                free(info->gpus[i].node.path);
-        }
-        free(info->gpus);
-        free(info);
+        struct image_header hdr;
+        struct stat s;
+        char banner[sizeof(hdr.banner)] = {0};
+        int fd;
+        int rv = -1;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, drv != NULL || dev != NULL) < 0)
+                return (-1);
+        if (path == NULL)
+                path = NVC_INFO_PATH;
+        if (drv != NULL)
+                *drv = NULL;
+        if (dev != NULL)
+                *dev = NULL;
+
+        if ((fd = xopen(&ctx->err, path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW)) < 0)
+                return (-1);
+        if (fstat(fd, &s) < 0) {
+                error_set(&ctx->err, "stat failed: %s", path);
+                goto fail;
+        }
+        /* The image dictates what gets mounted into containers, only trust what we or root could have written. */
+        if (!S_ISREG(s.st_mode) || (s.st_uid != 0 && s.st_uid != geteuid()) || (s.st_mode & (S_IWGRP|S_IWOTH))) {
+                error_setx(&ctx->err, "untrusted info image: %s", path);
+                goto fail;
+        }
+        if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, INFO_IMAGE_MAGIC, sizeof(hdr.magic)) ||
+            hdr.version != INFO_IMAGE_VERSION || hdr.size != (uint64_t)s.st_size) {
+                error_setx(&ctx->err, "invalid info image: %s", path);
+                goto fail;
+        }
+        /*
+         * The image is only valid for the driver which published it, an upgrade or a rebuild of the kernel module
+         * changes its version line (which includes the build date) and invalidates everything the image holds.
+         */
+        if (file_read_line(&ctx->err, NV_PROC_DRIVER "/version", banner, sizeof(banner)) < 0)
+                goto fail;
+        if (strncmp(hdr.banner, banner, sizeof(banner))) {
+                error_setx(&ctx->err, "stale info image: %s", path);
+                goto fail;
+        }
+
+        log_infof("loading driver information from %s (generation %"PRIu32")", path, hdr.generation);
+        if (drv != NULL && (*drv = image_load_driver(&ctx->err, fd, (size_t)s.st_size)) == NULL)
+                goto fail;
+        if (dev != NULL && (*dev = image_load_device(ctx, fd, (size_t)s.st_size)) == NULL)
+                goto fail;
+        rv = 0;
+
+ fail:
+        if (rv < 0 && drv != NULL) {
+                nvc_driver_info_free(*drv);
+                *drv = NULL;
+        }
+        close(fd);
+        return (rv);
 }
@@ -40,6 +40,17 @@ struct nvc_context {
         struct nvc_config cfg;
         int mnt_ns;
         struct driver drv;
+        struct {
+                uint64_t mounts;
+                uint64_t libs_selected;
+                uint64_t libs_skipped;
+                uint64_t ldconfig_ns;
+        } stats;
+        struct device_index {
+                dev_t id;
+                unsigned int index;
+        } *devs;       /* Driver handle of the devices seen so far, by device node. */
+        size_t ndevs;
 };
 
 struct nvc_container {
@@ -47,8 +58,16 @@ struct nvc_container {
         struct nvc_container_config cfg;
         uid_t uid;
         gid_t gid;
-        char *mnt_ns;
+        int proc_fd;
+        int mnt_ns;
         char *dev_cg;
+        struct strset mounts;
+        char **mnts;   /* Mounts performed through this handle, in order. */
+        size_t nmnts;
+        char **files;  /* Files created through this handle, in order. */
+        size_t nfiles;
+        dev_t *devs;   /* Device nodes whitelisted through this handle. */
+        size_t ndevs;
 };
 
 enum {
@@ -133,5 +152,6 @@ void nvc_entrypoint(void);
 /* Prototypes from nvc_info.c */
 bool match_binary_flags(const char *, int32_t);
 bool match_library_flags(const char *, int32_t);
+int get_device_index(struct nvc_context *, const struct nvc_device *, unsigned int *);
 
 #endif /* HEADER_NVC_INTERNAL_H */
@@ -13,29 +13,119 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
 #include <paths.h>
+#include <poll.h>
 #include <sched.h>
 #ifdef WITH_SECCOMP
 #include <seccomp.h>
 #endif /* WITH_SECCOMP */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "nvc_internal.h"
 
+#include "elftool.h"
 #include "error.h"
+#include "sha256.h"
 #include "utils.h"
 #include "xfuncs.h"
 
+#ifndef CLONE_PIDFD
+# define CLONE_PIDFD 0x00001000
+#endif /* CLONE_PIDFD */
+
+#define LDCACHE_KEY_SIZE    (2 * SHA256_SIZE + 1)
+#define LDCACHE_INCLUDE_MAX 8
+
+struct nvc_ldcache_job {
+        pid_t pid;        /* Zero if the result came from the cache directory. */
+        int pidfd;
+        int output;
+        char *name;
+        char *binary;     /* Identity of the host ldconfig (device, inode, size and modification time). */
+        struct timespec start;
+        int cache_fd;     /* Cache directory, -1 if the result isn't to be cached. */
+        int mnt_ns;
+        char *rootfs;
+        char *dirs[2];    /* Library directories given to ldconfig. */
+        char *version;
+        char key[LDCACHE_KEY_SIZE];
+};
+
+struct ldcache_link {
+        char *path;
+        char *target;
+};
+
+/* Everything ldconfig reads while building the DSO cache of a container, see cache_key. */
+struct ldcache_scan {
+        struct sha256 h;
+        const char *rootfs;
+        struct strset dirs;         /* Directories hashed so far. */
+        bool want_links;
+        struct ldcache_link *links; /* Soname links ldconfig would create or update. */
+        size_t nlinks;
+};
+
+struct ldcache_entry {
+        struct stat s;
+        char *soname;
+        bool hwcap;
+};
+
+struct ldcache_soname {
+        const char *soname;
+        const char *name;
+};
+
+/* Version 0 of the clone3 arguments, see linux/sched.h */
+struct clone3_args {
+        uint64_t flags;
+        uint64_t pidfd;
+        uint64_t child_tid;
+        uint64_t parent_tid;
+        uint64_t exit_signal;
+        uint64_t stack;
+        uint64_t stack_size;
+        uint64_t tls;
+};
+
 static inline bool secure_mode(void);
-static pid_t create_process(struct error *, int);
+static pid_t clone_process(int, int *);
+static pid_t create_process(struct error *, int, int *, int *);
+static int   reap_process(struct error *, pid_t, int, int, int *);
 static int   change_rootfs(struct error *, const char *, bool, bool *);
 static int   ajust_capabilities(struct error *, uid_t, bool);
 static int   ajust_privileges(struct error *, uid_t, gid_t, bool);
 static int   limit_resources(struct error *);
 static int   limit_syscalls(struct error *);
+static inline bool is_dso(const char *);
+static int   compare_names(const struct dirent **, const struct dirent **);
+static int   compare_entry(const void *, const void *);
+static int   compare_sonames(const void *, const void *);
+static int   read_soname(struct error *, const char *, char **);
+static int   add_link(struct error *, struct ldcache_scan *, const char *, const char *);
+static void  free_links(struct ldcache_scan *);
+static int   scan_links(struct error *, struct ldcache_scan *, const char *, struct dirent **,
+    const struct ldcache_entry *, int);
+static int   hash_dir(struct error *, struct ldcache_scan *, const char *, int);
+static int   scan_dir(struct error *, struct ldcache_scan *, const char *);
+static int   scan_include(struct error *, struct ldcache_scan *, const char *, int);
+static int   scan_conf(struct error *, struct ldcache_scan *, const char *, int);
+static int   cache_key(struct error *, const struct nvc_ldcache_job *, struct ldcache_scan *, char *);
+static int   cache_install(struct error *, int, const struct nvc_container *, const char *, const struct ldcache_scan *);
+static int   cache_lookup(struct nvc_context *, const struct nvc_container *, struct nvc_ldcache_job *, int);
+static int   cache_store(struct nvc_context *, const struct nvc_ldcache_job *);
+static void  free_job(struct nvc_ldcache_job *);
 
 static inline bool
 secure_mode(void)
@@ -46,16 +136,56 @@ secure_mode(void)
         return (s == NULL || !strcmp(s, "0") || !strcasecmp(s, "false") || !strcasecmp(s, "no"));
 }
 
+/*
+ * Clone a child process and get a descriptor referring to it if the kernel supports clone3 (i.e. Linux 5.3 and
+ * above), otherwise pidfd is set to -1.
+ */
+static pid_t
+clone_process(int flags, int *pidfd)
+{
+        pid_t child;
+
+        *pidfd = -1;
+        /* Raw clones bypass the pthread_atfork handlers, hold the log ourselves. */
+        log_fork_prepare();
+#ifdef SYS_clone3
+        struct clone3_args args = {
+                .flags = (uint64_t)(flags|CLONE_PIDFD),
+                .pidfd = (uint64_t)(uintptr_t)pidfd,
+                .exit_signal = SIGCHLD,
+        };
+
+        if ((child = (pid_t)syscall(SYS_clone3, &args, sizeof(args))) < 0 && errno == ENOSYS) {
+                *pidfd = -1;
+                child = (pid_t)syscall(SYS_clone, SIGCHLD|flags, NULL, NULL, NULL, NULL);
+        }
+#else
+        child = (pid_t)syscall(SYS_clone, SIGCHLD|flags, NULL, NULL, NULL, NULL);
+#endif /* SYS_clone3 */
+        if (child == 0)
+                log_fork_child();
+        else
+                log_fork_parent();
+        return (child);
+}
+
+/*
+ * Spawn a child with its output redirected to a pipe if logging is enabled.
+ * The parent gets the read end back in output and is expected to consume it with log_pipe_output, as well as a
+ * process descriptor in pidfd when available.
+ */
 static pid_t
-create_process(struct error *err, int flags)
+create_process(struct error *err, int flags, int *output, int *pidfd)
 {
         pid_t child;
         int fd[2] = {-1, -1};
         int null = -1;
         int rv = -1;
 
-        if ((log_active() && pipe(fd) < 0) ||
-            (child = (pid_t)syscall(SYS_clone, SIGCHLD|flags, NULL, NULL, NULL, NULL)) < 0) {
+        *output = -1;
+        log_flush();
+        if ((log_active() && pipe2(fd, O_CLOEXEC) < 0) ||
+            (child = clone_process(flags, pidfd)) < 0) {
                 error_set(err, "process creation failed");
                 xclose(fd[0]);
                 xclose(fd[1]);
@@ -72,8 +202,9 @@ create_process(struct error *err, int flags)
                         goto fail;
                 }
         } else {
-                if (log_pipe_output(err, fd) < 0)
-                        goto fail;
+                /* Leave the output in the pipe for now, it gets logged as the child is being reaped. */
+                *output = fd[0];
+                fd[0] = -1;
         }
         rv = 0;
 
@@ -88,6 +219,48 @@ create_process(struct error *err, int flags)
         return (child);
 }
 
+/*
+ * Wait for the child to terminate while moving its output into the log. With a process descriptor, the output is
+ * consumed as it comes and the child is reaped as soon as it exits, regardless of what its pipe holds.
+ */
+static int
+reap_process(struct error *err, pid_t child, int pidfd, int output, int *status)
+{
+        struct pollfd fds[2];
+        int rv;
+
+        while (pidfd >= 0) {
+                fds[0] = (struct pollfd){pidfd, POLLIN, 0};
+                fds[1] = (struct pollfd){output, POLLIN, 0};
+                if (poll(fds, nitems(fds), -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        error_set(err, "poll failed");
+                        return (-1);
+                }
+                if (fds[1].revents != 0) {
+                        if ((rv = log_pipe_output(err, output, false)) < 0) {
+                                log_errf("could not capture process output: %s", err->msg);
+                                error_reset(err);
+                        }
+                        if (rv != 0)
+                                output = -1;
+                }
+                if (fds[0].revents != 0)
+                        break;
+        }
+        if (output >= 0 && log_pipe_output(err, output, true) < 0) {
+                log_errf("could not capture process output: %s", err->msg);
+                error_reset(err);
+        }
+        /* The descriptor keeps the PID from being recycled until the child is reaped. */
+        if (waitpid(child, status, 0) < 0) {
+                error_set(err, "process reaping failed");
+                return (-1);
+        }
+        return (0);
+}
+
 static int
 change_rootfs(struct error *err, const char *rootfs, bool mount_proc, bool *drop_groups)
 {
@@ -298,20 +471,573 @@ limit_syscalls(struct error *err)
 }
 #endif /* WITH_SECCOMP */
 
-int
-nvc_ldcache_update(struct nvc_context *ctx, const struct nvc_container *cnt)
+/* Mirror the filter of ldconfig, no other entry of a library directory can affect its result. */
+static inline bool
+is_dso(const char *name)
+{
+        return ((!strpcmp(name, "lib") || !strpcmp(name, "ld-")) && strstr(name, ".so") != NULL);
+}
+
+/* Unlike alphasort, the order doesn't depend on the locale. */
+static int
+compare_names(const struct dirent **a, const struct dirent **b)
+{
+        return (strcmp((*a)->d_name, (*b)->d_name));
+}
+
+static int
+compare_entry(const void *name, const void *ent)
+{
+        return (strcmp(name, (*(struct dirent * const *)ent)->d_name));
+}
+
+/* Group libraries by SONAME, highest version first. */
+static int
+compare_sonames(const void *a, const void *b)
+{
+        const struct ldcache_soname *x = a, *y = b;
+        int rv;
+
+        if ((rv = strcmp(x->soname, y->soname)) != 0)
+                return (rv);
+        return (strverscmp(y->name, x->name));
+}
+
+/* Files which aren't shared objects (e.g. linker scripts) have no SONAME, ldconfig ignores them. */
+static int
+read_soname(struct error *err, const char *path, char **soname)
+{
+        struct error elferr = {0};
+        struct elftool elf;
+        const char *name = NULL;
+        int rv = 0;
+
+        *soname = NULL;
+        elftool_init(&elf, &elferr);
+        if (elftool_open(&elf, path) < 0)
+                goto done;
+        if (elftool_get_soname(&elf, &name) == 0 && name != NULL && (*soname = xstrdup(err, name)) == NULL)
+                rv = -1;
+        elftool_close(&elf);
+ done:
+        error_reset(&elferr);
+        return (rv);
+}
+
+static int
+add_link(struct error *err, struct ldcache_scan *sc, const char *path, const char *target)
 {
+        struct ldcache_link *ptr;
+
+        if ((ptr = xrealloc(err, sc->links, (sc->nlinks + 1) * sizeof(*ptr))) == NULL)
+                return (-1);
+        sc->links = ptr;
+        ptr = &sc->links[sc->nlinks];
+        *ptr = (struct ldcache_link){NULL, NULL};
+        if ((ptr->path = xstrdup(err, path)) == NULL || (ptr->target = xstrdup(err, target)) == NULL) {
+                free(ptr->path);
+                return (-1);
+        }
+        ++sc->nlinks;
+        return (0);
+}
+
+static void
+free_links(struct ldcache_scan *sc)
+{
+        for (size_t i = 0; i < sc->nlinks; ++i) {
+                free(sc->links[i].path);
+                free(sc->links[i].target);
+        }
+        free(sc->links);
+        sc->links = NULL;
+        sc->nlinks = 0;
+}
+
+/*
+ * Record the soname links ldconfig would create or update in a directory, that is, a link named after the SONAME
+ * of a library pointing to its highest version. Existing files which aren't links are left alone like ldconfig does.
+ */
+static int
+scan_links(struct error *err, struct ldcache_scan *sc, const char *dir, struct dirent **ents,
+    const struct ldcache_entry *info, int n)
+{
+        struct ldcache_soname *libs;
+        struct dirent **ent;
+        char path[PATH_MAX];
+        char target[PATH_MAX];
+        ssize_t len;
+        size_t nlibs = 0;
+        int rv = -1;
+
+        if ((libs = xcalloc(err, (size_t)n + 1, sizeof(*libs))) == NULL)
+                return (-1);
+        for (int i = 0; i < n; ++i) {
+                if (info[i].soname != NULL && strcmp(info[i].soname, ents[i]->d_name))
+                        libs[nlibs++] = (struct ldcache_soname){info[i].soname, ents[i]->d_name};
+        }
+        qsort(libs, nlibs, sizeof(*libs), compare_sonames);
+
+        for (size_t i = 0; i < nlibs; ++i) {
+                if (i > 0 && !strcmp(libs[i].soname, libs[i - 1].soname))
+                        continue;
+                if (path_join(err, path, dir, libs[i].soname) < 0)
+                        goto fail;
+                if ((ent = bsearch(libs[i].soname, ents, (size_t)n, sizeof(*ents), compare_entry)) != NULL) {
+                        if (!S_ISLNK(info[ent - ents].s.st_mode))
+                                continue;
+                        if ((len = readlink(path, target, sizeof(target) - 1)) >= 0) {
+                                target[len] = '\0';
+                                if (!strcmp(target, libs[i].name))
+                                        continue;
+                        }
+                }
+                if (add_link(err, sc, path, libs[i].name) < 0)
+                        goto fail;
+        }
+        rv = 0;
+
+ fail:
+        free(libs);
+        return (rv);
+}
+
+/*
+ * Hash the libraries of a directory as ldconfig sees them: their names, types, sizes, modification times and
+ * SONAMEs, along with the targets of the symlinks. The soname links ldconfig maintains are left out since they
+ * derive from the rest (and get created by ldconfig itself). Hardware capability subdirectories are hashed as
+ * well, the level tells whether we are at the top (0), under glibc-hwcaps (1) or in a subdirectory (2).
+ */
+static int
+hash_dir(struct error *err, struct ldcache_scan *sc, const char *dir, int level)
+{
+        struct dirent **ents = NULL;
+        struct ldcache_entry *info = NULL;
+        struct dirent **ent;
+        char path[PATH_MAX];
+        char target[PATH_MAX];
+        const char *name;
+        ssize_t len;
+        int n;
+        int rv = -1;
+
+        if ((n = scandir(dir, &ents, NULL, compare_names)) < 0) {
+                if (errno != ENOENT && errno != ENOTDIR) {
+                        error_set(err, "directory listing failed: %s", dir);
+                        return (-1);
+                }
+                sha256_update(&sc->h, "", 1);
+                return (0);
+        }
+        if ((info = xcalloc(err, (size_t)n + 1, sizeof(*info))) == NULL)
+                goto fail;
+
+        for (int i = 0; i < n; ++i) {
+                name = ents[i]->d_name;
+                info[i].hwcap = (level == 0 && (!strcmp(name, "tls") || !strcmp(name, "glibc-hwcaps"))) ||
+                    (level == 1 && strcmp(name, ".") && strcmp(name, ".."));
+                if (!is_dso(name) && !info[i].hwcap)
+                        continue;
+                if (path_join(err, path, dir, name) < 0)
+                        goto fail;
+                if (lstat(path, &info[i].s) < 0) {
+                        error_set(err, "stat failed: %s", path);
+                        goto fail;
+                }
+                if (S_ISREG(info[i].s.st_mode) && is_dso(name) && read_soname(err, path, &info[i].soname) < 0)
+                        goto fail;
+        }
+
+        for (int i = 0; i < n; ++i) {
+                name = ents[i]->d_name;
+                if (info[i].s.st_mode == 0)
+                        continue;
+                if (path_join(err, path, dir, name) < 0)
+                        goto fail;
+                if (S_ISLNK(info[i].s.st_mode)) {
+                        if ((len = readlink(path, target, sizeof(target) - 1)) < 0) {
+                                error_set(err, "symlink resolution failed: %s", path);
+                                goto fail;
+                        }
+                        target[len] = '\0';
+                        /* Soname links of a library in the same directory are maintained by ldconfig. */
+                        ent = bsearch(target, ents, (size_t)n, sizeof(*ents), compare_entry);
+                        if (ent != NULL && info[ent - ents].soname != NULL && !strcmp(info[ent - ents].soname, name))
+                                continue;
+                        sha256_update(&sc->h, name, strlen(name) + 1);
+                        sha256_update(&sc->h, &info[i].s.st_mode, sizeof(info[i].s.st_mode));
+                        sha256_update(&sc->h, target, (size_t)len + 1);
+                } else if (S_ISREG(info[i].s.st_mode)) {
+                        sha256_update(&sc->h, name, strlen(name) + 1);
+                        sha256_update(&sc->h, &info[i].s.st_mode, sizeof(info[i].s.st_mode));
+                        sha256_update(&sc->h, &info[i].s.st_size, sizeof(info[i].s.st_size));
+                        sha256_update(&sc->h, &info[i].s.st_mtim, sizeof(info[i].s.st_mtim));
+                        name = (info[i].soname != NULL) ? info[i].soname : "";
+                        sha256_update(&sc->h, name, strlen(name) + 1);
+                } else if (S_ISDIR(info[i].s.st_mode) && info[i].hwcap) {
+                        sha256_update(&sc->h, name, strlen(name) + 1);
+                        if (hash_dir(err, sc, path, (!strcmp(name, "glibc-hwcaps") && level == 0) ? 1 : 2) < 0)
+                                goto fail;
+                }
+        }
+        sha256_update(&sc->h, "", 1);
+        if (sc->want_links && scan_links(err, sc, dir, ents, info, n) < 0)
+                goto fail;
+        rv = 0;
+
+ fail:
+        for (int i = 0; i < n; ++i) {
+                if (info != NULL)
+                        free(info[i].soname);
+                free(ents[i]);
+        }
+        free(info);
+        free(ents);
+        return (rv);
+}
+
+/* Hash a library directory of the container once, ldconfig ignores duplicates as well. */
+static int
+scan_dir(struct error *err, struct ldcache_scan *sc, const char *dir)
+{
+        char path[PATH_MAX];
+
+        if (path_resolve(err, path, sc->rootfs, dir) < 0)
+                return (-1);
+        if (strset_contains(&sc->dirs, path))
+                return (0);
+        if (strset_add(err, &sc->dirs, path) < 0)
+                return (-1);
+        sha256_update(&sc->h, dir, strlen(dir) + 1);
+        return (hash_dir(err, sc, path, 0));
+}
+
+/* Hash the configuration files matching an include directive, in order. */
+static int
+scan_include(struct error *err, struct ldcache_scan *sc, const char *pattern, int depth)
+{
+        const char *prefix;
+        char path[PATH_MAX];
+        glob_t gl;
+        int rv = -1;
+
+        prefix = strcmp(sc->rootfs, "/") ? sc->rootfs : "";
+        if (xsnprintf(err, path, sizeof(path), "%s%s", prefix, pattern) < 0)
+                return (-1);
+        if (glob(path, 0, NULL, &gl) != 0) {
+                globfree(&gl);
+                sha256_update(&sc->h, "", 1);
+                return (0);
+        }
+        for (size_t i = 0; i < gl.gl_pathc; ++i) {
+                if (scan_conf(err, sc, gl.gl_pathv[i] + strlen(prefix), depth) < 0)
+                        goto fail;
+        }
+        rv = 0;
+
+ fail:
+        globfree(&gl);
+        return (rv);
+}
+
+/*
+ * Hash a configuration file of the container along with the directories it lists, following its include
+ * directives the way ldconfig does (i.e. relative patterns are relative to the directory of the file).
+ */
+static int
+scan_conf(struct error *err, struct ldcache_scan *sc, const char *conf, int depth)
+{
+        char path[PATH_MAX];
+        char pattern[PATH_MAX];
+        char *txt = NULL;
+        char *line, *ptr, *end, *save;
+        int rv = -1;
+
+        if (depth > LDCACHE_INCLUDE_MAX) {
+                error_setx(err, "too many nested includes: %s", conf);
+                return (-1);
+        }
+        if (path_resolve(err, path, sc->rootfs, conf) < 0)
+                return (-1);
+        if (file_read_text(err, path, &txt) < 0) {
+                if (err->code != ENOENT && err->code != ENOTDIR)
+                        return (-1);
+                error_reset(err);
+                sha256_update(&sc->h, "", 1);
+                return (0);
+        }
+        sha256_update(&sc->h, conf, strlen(conf) + 1);
+        sha256_update(&sc->h, txt, strlen(txt) + 1);
+
+        for (line = strtok_r(txt, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+                line[strcspn(line, "#")] = '\0';
+                line += strspn(line, " \t");
+                for (end = line + strlen(line); end > line && isspace((unsigned char)end[-1]); *--end = '\0');
+                if (*line == '\0')
+                        continue;
+
+                if (!strncmp(line, "include", 7) && isspace((unsigned char)line[7])) {
+                        ptr = line + 7 + strspn(line + 7, " \t");
+                        if (xsnprintf(err, pattern, sizeof(pattern), "%.*s%s", (*ptr == '/') ? 0 :
+                            (int)(strrchr(conf, '/') - conf + 1), conf, ptr) < 0)
+                                goto fail;
+                        if (scan_include(err, sc, pattern, depth + 1) < 0)
+                                goto fail;
+                } else if (!strncmp(line, "hwcap", 5) && isspace((unsigned char)line[5])) {
+                        continue;
+                } else {
+                        /* Old configurations can specify the library type, e.g. "/usr/lib=libc5". */
+                        line[strcspn(line, "=")] = '\0';
+                        if (scan_dir(err, sc, line) < 0)
+                                goto fail;
+                }
+        }
+        rv = 0;
+
+ fail:
+        free(txt);
+        return (rv);
+}
+
+/*
+ * Compute the key of the ldconfig result, that is, a hash of everything it depends upon: the ldconfig binary
+ * (its path and identity, which changes whenever the host upgrades it), the driver version, the configuration of the container and the libraries of every directory scanned (the ones
+ * given on the command line, the configured ones and the trusted ones). The previous DSO cache isn't an input.
+ * Must be called from within the mount namespace of the container.
+ */
+static int
+cache_key(struct error *err, const struct nvc_ldcache_job *job, struct ldcache_scan *sc, char *key)
+{
+        uint8_t digest[SHA256_SIZE];
+        const char *trusted[] = {"/lib", "/usr/lib", "/lib64", "/usr/lib64", "/lib32", "/usr/lib32"};
+        int rv = -1;
+
+        sha256_init(&sc->h);
+        sc->rootfs = job->rootfs;
+        sha256_update(&sc->h, job->name, strlen(job->name) + 1);
+        sha256_update(&sc->h, job->binary, strlen(job->binary) + 1);
+        sha256_update(&sc->h, job->version, strlen(job->version) + 1);
+        for (size_t i = 0; i < nitems(job->dirs); ++i) {
+                if (scan_dir(err, sc, job->dirs[i]) < 0)
+                        goto fail;
+        }
+        if (scan_conf(err, sc, "/etc/ld.so.conf", 0) < 0)
+                goto fail;
+        for (size_t i = 0; i < nitems(trusted); ++i) {
+                if (scan_dir(err, sc, trusted[i]) < 0)
+                        goto fail;
+        }
+        sha256_final(&sc->h, digest);
+
+        for (size_t i = 0; i < SHA256_SIZE; ++i)
+                sprintf(key + i * 2, "%02x", digest[i]);
+        rv = 0;
+
+ fail:
+        strset_free(&sc->dirs);
+        return (rv);
+}
+
+/*
+ * Install the cached result in the container if any, along with the soname links ldconfig would have created.
+ * Returns 1 on a cache hit, 0 otherwise.
+ */
+static int
+cache_install(struct error *err, int cache_fd, const struct nvc_container *cnt, const char *key,
+    const struct ldcache_scan *sc)
+{
+        char path[PATH_MAX];
+        struct stat s;
+        void *data = NULL;
+        ssize_t n;
+        int fd;
+        int rv = -1;
+
+        if ((fd = openat(cache_fd, key, O_RDONLY|O_CLOEXEC)) < 0) {
+                if (errno == ENOENT)
+                        return (0);
+                error_set(err, "open failed: %s", key);
+                return (-1);
+        }
+        if (fstat(fd, &s) < 0 || s.st_size <= 0) {
+                error_setx(err, "invalid cache entry: %s", key);
+                goto fail;
+        }
+        if ((data = xcalloc(err, 1, (size_t)s.st_size)) == NULL)
+                goto fail;
+        if ((n = read(fd, data, (size_t)s.st_size)) != s.st_size) {
+                error_set(err, "read error: %s", key);
+                goto fail;
+        }
+        for (size_t i = 0; i < sc->nlinks; ++i) {
+                log_infof("creating symlink %s -> %s", sc->links[i].path, sc->links[i].target);
+                if (unlink(sc->links[i].path) < 0 && errno != ENOENT) {
+                        error_set(err, "file removal failed: %s", sc->links[i].path);
+                        goto fail;
+                }
+                if (file_create(err, sc->links[i].path, sc->links[i].target, cnt->uid, cnt->gid, MODE_LNK(0777)) < 0)
+                        goto fail;
+        }
+        if (path_resolve(err, path, cnt->cfg.rootfs, "/etc/ld.so.cache") < 0)
+                goto fail;
+        if (file_replace(err, path, data, (size_t)s.st_size, cnt->uid, cnt->gid, MODE_REG(0644)) < 0)
+                goto fail;
+        rv = 1;
+
+ fail:
+        free(data);
+        close(fd);
+        return (rv);
+}
+
+static int
+cache_lookup(struct nvc_context *ctx, const struct nvc_container *cnt, struct nvc_ldcache_job *job, int fd)
+{
+        struct ldcache_scan sc = {.want_links = true};
+        struct stat s;
+        int rv = -1;
+
+        if (fstat(fd, &s) < 0) {
+                error_set(&ctx->err, "stat failed: %s", job->name);
+                return (-1);
+        }
+        if (xasprintf(&ctx->err, &job->binary, "%ju:%ju:%jd:%jd.%09ld", (uintmax_t)s.st_dev, (uintmax_t)s.st_ino,
+            (intmax_t)s.st_size, (intmax_t)s.st_mtim.tv_sec, s.st_mtim.tv_nsec) < 0)
+                return (-1);
+
+        /* The driver version is read first, the procfs of the container might not be the host one. */
+        if (file_read_text(NULL, NV_PROC_DRIVER "/version", &job->version) < 0)
+                job->version = NULL;
+        if (job->version == NULL && (job->version = xstrdup(&ctx->err, "")) == NULL)
+                return (-1);
+
+        if ((job->cache_fd = xopen(&ctx->err, ctx->cfg.ldcache_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+                return (-1);
+        if ((job->mnt_ns = fcntl(cnt->mnt_ns, F_DUPFD_CLOEXEC, 0)) < 0) {
+                error_set(&ctx->err, "file duplication failed");
+                return (-1);
+        }
+        if ((job->rootfs = xstrdup(&ctx->err, cnt->cfg.rootfs)) == NULL ||
+            (job->dirs[0] = xstrdup(&ctx->err, cnt->cfg.libs_dir)) == NULL ||
+            (job->dirs[1] = xstrdup(&ctx->err, cnt->cfg.libs32_dir)) == NULL)
+                return (-1);
+
+        if (nsenterat(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
+                return (-1);
+        if ((rv = cache_key(&ctx->err, job, &sc, job->key)) == 0)
+                rv = cache_install(&ctx->err, job->cache_fd, cnt, job->key, &sc);
+        if (rv < 0)
+                assert_func(nsenterat(NULL, ctx->mnt_ns, CLONE_NEWNS));
+        else if (nsenterat(&ctx->err, ctx->mnt_ns, CLONE_NEWNS) < 0)
+                rv = -1;
+        free_links(&sc);
+        return (rv);
+}
+
+/*
+ * Save the DSO cache generated by ldconfig under its key. The key is computed again beforehand, the result is
+ * discarded if the libraries of the container changed while ldconfig was running.
+ */
+static int
+cache_store(struct nvc_context *ctx, const struct nvc_ldcache_job *job)
+{
+        struct ldcache_scan sc = {0};
+        char key[LDCACHE_KEY_SIZE];
+        char path[PATH_MAX];
+        char tmp[LDCACHE_KEY_SIZE + 16];
+        void *addr = NULL;
+        size_t size = 0;
+        const char *ptr;
+        ssize_t n;
+        int fd = -1;
+        int rv = -1;
+
+        if (nsenterat(&ctx->err, job->mnt_ns, CLONE_NEWNS) < 0)
+                return (-1);
+        if (cache_key(&ctx->err, job, &sc, key) < 0)
+                goto fail;
+        if (strcmp(key, job->key)) {
+                error_setx(&ctx->err, "libraries changed during the update");
+                goto fail;
+        }
+        if (path_resolve(&ctx->err, path, job->rootfs, "/etc/ld.so.cache") < 0)
+                goto fail;
+        if ((addr = file_map(&ctx->err, path, &size)) == NULL)
+                goto fail;
+        if (xsnprintf(&ctx->err, tmp, sizeof(tmp), "%s.%"PRId32, job->key, (int32_t)getpid()) < 0)
+                goto fail;
+        if ((fd = openat(job->cache_fd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0644)) < 0) {
+                error_set(&ctx->err, "file creation failed: %s/%s", ctx->cfg.ldcache_dir, tmp);
+                goto fail;
+        }
+        for (ptr = addr; ptr < (const char *)addr + size; ptr += n) {
+                if ((n = write(fd, ptr, (size_t)((const char *)addr + size - ptr))) < 0) {
+                        if (errno == EINTR) {
+                                n = 0;
+                                continue;
+                        }
+                        error_set(&ctx->err, "write error: %s/%s", ctx->cfg.ldcache_dir, tmp);
+                        goto fail;
+                }
+        }
+        if (renameat(job->cache_fd, tmp, job->cache_fd, job->key) < 0) {
+                error_set(&ctx->err, "file rename failed: %s/%s", ctx->cfg.ldcache_dir, job->key);
+                goto fail;
+        }
+        log_infof("caching %s as %s/%s", path, ctx->cfg.ldcache_dir, job->key);
+        rv = 0;
+
+ fail:
+        if (fd >= 0) {
+                close(fd);
+                if (rv < 0)
+                        unlinkat(job->cache_fd, tmp, 0);
+        }
+        if (addr != NULL)
+                file_unmap(NULL, path, addr, size);
+        if (rv < 0)
+                assert_func(nsenterat(NULL, ctx->mnt_ns, CLONE_NEWNS));
+        else
+                rv = nsenterat(&ctx->err, ctx->mnt_ns, CLONE_NEWNS);
+        return (rv);
+}
+
+static void
+free_job(struct nvc_ldcache_job *job)
+{
+        if (job == NULL)
+                return;
+        xclose(job->output);
+        xclose(job->pidfd);
+        xclose(job->cache_fd);
+        xclose(job->mnt_ns);
+        free(job->rootfs);
+        free(job->dirs[0]);
+        free(job->dirs[1]);
+        free(job->version);
+        free(job->binary);
+        free(job->name);
+        free(job);
+}
+
+/*
+ * Spawn ldconfig in the container without waiting for it, several updates can be in flight at once.
+ * The returned job must be completed with nvc_ldcache_update_wait.
+ */
+struct nvc_ldcache_job *
+nvc_ldcache_update_start(struct nvc_context *ctx, const struct nvc_container *cnt)
+{
+        struct nvc_ldcache_job *job;
         char **argv;
         pid_t child;
-        int status;
         bool drop_groups = true;
         bool host_ldconfig = false;
         int fd = -1;
 
         if (validate_context(ctx) < 0)
-                return (-1);
+                return (NULL);
         if (validate_args(ctx, cnt != NULL) < 0)
-                return (-1);
+                return (NULL);
 
         argv = (char * []){cnt->cfg.ldconfig, cnt->cfg.libs_dir, cnt->cfg.libs32_dir, NULL};
         if (*argv[0] == '@') {
@@ -321,55 +1047,170 @@ nvc_ldcache_update(struct nvc_context *ctx, const struct nvc_container *cnt)
                  */
                 ++argv[0];
                 if ((fd = xopen(&ctx->err, argv[0], O_RDONLY|O_CLOEXEC)) < 0)
-                        return (-1);
+                        return (NULL);
                 host_ldconfig = true;
                 log_infof("executing %s from host at %s", argv[0], cnt->cfg.rootfs);
         } else {
                 log_infof("executing %s at %s", argv[0], cnt->cfg.rootfs);
         }
 
-        if ((child = create_process(&ctx->err, CLONE_NEWPID|CLONE_NEWIPC)) < 0) {
-                xclose(fd);
-                return (-1);
+        if ((job = xcalloc(&ctx->err, 1, sizeof(*job))) == NULL)
+                goto fail;
+        job->output = -1;
+        job->pidfd = -1;
+        job->cache_fd = -1;
+        job->mnt_ns = -1;
+        if ((job->name = xstrdup(&ctx->err, argv[0])) == NULL)
+                goto fail;
+
+        /* The container could run any ldconfig and write whatever it wants, only results from the host one are cached. */
+        if (ctx->cfg.ldcache_dir != NULL && host_ldconfig) {
+                switch (cache_lookup(ctx, cnt, job, fd)) {
+                case 1:
+                        log_infof("using cached DSO cache %s/%s", ctx->cfg.ldcache_dir, job->key);
+                        xclose(fd);
+                        return (job);
+                case 0:
+                        break;
+                default:
+                        log_warnf("not using the ldcache directory: %s", ctx->err.msg);
+                        error_reset(&ctx->err);
+                        xclose(job->cache_fd);
+                        job->cache_fd = -1;
+                        break;
+                }
         }
+
+        clock_gettime(CLOCK_MONOTONIC, &job->start);
+        if ((child = create_process(&ctx->err, CLONE_NEWPID|CLONE_NEWIPC, &job->output, &job->pidfd)) < 0)
+                goto fail;
         if (child == 0) {
                 prctl(PR_SET_NAME, (unsigned long)"nvc:[ldconfig]", 0, 0, 0);
 
-                if (nsenter(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
-                        goto fail;
+                if (nsenterat(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
+                        goto child_fail;
                 if (ajust_capabilities(&ctx->err, cnt->uid, host_ldconfig) < 0)
-                        goto fail;
+                        goto child_fail;
                 if (change_rootfs(&ctx->err, cnt->cfg.rootfs, host_ldconfig, &drop_groups) < 0)
-                        goto fail;
+                        goto child_fail;
                 if (limit_resources(&ctx->err) < 0)
-                        goto fail;
+                        goto child_fail;
                 if (ajust_privileges(&ctx->err, cnt->uid, cnt->gid, drop_groups) < 0)
-                        goto fail;
+                        goto child_fail;
                 if (limit_syscalls(&ctx->err) < 0)
-                        goto fail;
+                        goto child_fail;
 
+                log_flush();
                 if (fd < 0)
                         execve(argv[0], argv, (char * const []){NULL});
                 else
                         fexecve(fd, argv, (char * const []){NULL});
                 error_set(&ctx->err, "process execution failed");
-         fail:
+         child_fail:
                 log_errf("could not start %s: %s", argv[0], ctx->err.msg);
+                log_flush();
                 (ctx->err.code == ENOENT) ? _exit(EXIT_SUCCESS) : _exit(EXIT_FAILURE);
         }
+        job->pid = child;
+        xclose(fd);
+        return (job);
 
+ fail:
         xclose(fd);
-        if (waitpid(child, &status, 0) < 0) {
+        free_job(job);
+        return (NULL);
+}
+
+/* Returns a descriptor becoming readable once the update completes, or -1 if the kernel can't provide one. */
+int
+nvc_ldcache_update_fd(const struct nvc_ldcache_job *job)
+{
+        return ((job != NULL) ? job->pidfd : -1);
+}
+
+/*
+ * Move the output available into the log without blocking.
+ * Returns 1 if the update completed (i.e. nvc_ldcache_update_wait won't block), 0 if it is still running, -1 on error.
+ */
+int
+nvc_ldcache_update_poll(struct nvc_context *ctx, struct nvc_ldcache_job *job)
+{
+        siginfo_t info = {0};
+        int rv;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, job != NULL) < 0)
+                return (-1);
+
+        if (job->pid == 0)
+                return (1);
+        if (job->output >= 0) {
+                if ((rv = log_pipe_output(&ctx->err, job->output, false)) < 0) {
+                        log_errf("could not capture process output: %s", ctx->err.msg);
+                        error_reset(&ctx->err);
+                }
+                if (rv != 0) {
+                        xclose(job->output);
+                        job->output = -1;
+                }
+        }
+        /* Leave the child waitable, it gets reaped by nvc_ldcache_update_wait. */
+        if (waitid(P_PID, (id_t)job->pid, &info, WEXITED|WNOHANG|WNOWAIT) < 0) {
                 error_set(&ctx->err, "process reaping failed");
                 return (-1);
         }
-        if (WIFSIGNALED(status)) {
-                error_setx(&ctx->err, "process %s terminated with signal %d", argv[0], WTERMSIG(status));
+        return (info.si_pid != 0);
+}
+
+/* Wait for the update to complete and release the job. */
+int
+nvc_ldcache_update_wait(struct nvc_context *ctx, struct nvc_ldcache_job *job)
+{
+        struct timespec end;
+        int status;
+        int rv = -1;
+
+        if (validate_context(ctx) < 0)
                 return (-1);
+        if (validate_args(ctx, job != NULL) < 0)
+                return (-1);
+
+        if (job->pid == 0) {
+                rv = 0;
+                goto fail;
+        }
+        if (reap_process(&ctx->err, job->pid, job->pidfd, job->output, &status) < 0)
+                goto fail;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ctx->stats.ldconfig_ns += (uint64_t)(end.tv_sec - job->start.tv_sec) * 1000000000 +
+            (uint64_t)end.tv_nsec - (uint64_t)job->start.tv_nsec;
+        if (WIFSIGNALED(status)) {
+                error_setx(&ctx->err, "process %s terminated with signal %d", job->name, WTERMSIG(status));
+                goto fail;
         }
         if (WIFEXITED(status) && (status = WEXITSTATUS(status)) != 0) {
-                error_setx(&ctx->err, "process %s failed with error code: %d", argv[0], status);
-                return (-1);
+                error_setx(&ctx->err, "process %s failed with error code: %d", job->name, status);
+                goto fail;
         }
-        return (0);
+        if (job->cache_fd >= 0 && cache_store(ctx, job) < 0) {
+                log_warnf("could not cache the ldconfig result: %s", ctx->err.msg);
+                error_reset(&ctx->err);
+        }
+        rv = 0;
+
+ fail:
+        free_job(job);
+        log_flush();
+        return (rv);
+}
+
+int
+nvc_ldcache_update(struct nvc_context *ctx, const struct nvc_container *cnt)
+{
+        struct nvc_ldcache_job *job;
+
+        if ((job = nvc_ldcache_update_start(ctx, cnt)) == NULL)
+                return (-1);
+        return (nvc_ldcache_update_wait(ctx, job));
 }
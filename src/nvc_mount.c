@@ -4,7 +4,11 @@
 
 #include <sys/sysmacros.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
+
+#include <linux/magic.h>
 
 #include <errno.h>
 #include <libgen.h>
@@ -17,25 +21,70 @@
 
 #include "nvc_internal.h"
 
+#include "driver.h"
 #include "error.h"
 #include "options.h"
 #include "utils.h"
 #include "xfuncs.h"
 
-static char **mount_files(struct error *, const struct nvc_container *, const char *, char *[], size_t);
-static char *mount_device(struct error *, const struct nvc_container *, const char *);
-static char *mount_ipc(struct error *, const struct nvc_container *, const char *);
+static bool is_mounted(const struct nvc_container *, const char *, const char *);
+static size_t count_mounts(const char * const [], size_t);
+static char **mount_files(struct error *, struct nvc_container *, const char *, char *[], size_t);
+static char *mount_device(struct error *, struct nvc_container *, const char *);
+static char *mount_ipc(struct error *, struct nvc_container *, const char *);
 static char *mount_procfs(struct error *, const struct nvc_container *);
 static char *mount_procfs_gpu(struct error *, const struct nvc_container *, const char *);
-static char *mount_app_profile(struct error *, const struct nvc_container *);
+static char *mount_app_profile(struct error *, struct nvc_container *);
 static int  update_app_profile(struct error *, const struct nvc_container *, dev_t);
 static void unmount(const char *);
-static int  setup_cgroup(struct error *, const char *, dev_t);
-static int  symlink_library(struct error *, const char *, const char *, const char *, uid_t, gid_t);
-static int  symlink_libraries(struct error *, const struct nvc_container *, const char * const [], size_t);
+static int  setup_cgroup(struct error *, const char *, dev_t, bool);
+static int  record_mounts(struct error *, struct nvc_container *, const char * const [], size_t);
+static int  create_file(struct error *, struct nvc_container *, const char *, const char *, mode_t);
+static void remove_files(struct nvc_container *, size_t);
+static int  device_allowed(struct error *, const char *, dev_t, bool *);
+static int  allow_device(struct error *, struct nvc_container *, dev_t);
+static int  symlink_library(struct error *, struct nvc_container *, const char *, const char *, const char *);
+static int  symlink_libraries(struct error *, struct nvc_container *, const char * const [], size_t);
+
+/*
+ * Check whether the target was mounted by a previous invocation, that is, it is a mount point of the container
+ * bound to the same source. A NULL source stands for one of our tmpfs mounts.
+ */
+static bool
+is_mounted(const struct nvc_container *cnt, const char *src, const char *dst)
+{
+        const char *rel = dst;
+        struct stat s1, s2;
+        struct statfs fs;
+
+        /* Mount points are relative to the container root if it already pivoted. */
+        if (strcmp(cnt->cfg.rootfs, "/") && !strpcmp(dst, cnt->cfg.rootfs))
+                rel = dst + strlen(cnt->cfg.rootfs);
+        if (!strset_contains(&cnt->mounts, dst) && !strset_contains(&cnt->mounts, rel))
+                return (false);
+
+        if (src == NULL)
+                return (statfs(dst, &fs) == 0 && fs.f_type == TMPFS_MAGIC);
+        if (stat(src, &s1) < 0 || stat(dst, &s2) < 0)
+                return (false);
+        return (s1.st_dev == s2.st_dev && s1.st_ino == s2.st_ino);
+}
+
+/* Mounts skipped because they were already present are recorded as empty strings. */
+static size_t
+count_mounts(const char * const mnt[], size_t size)
+{
+        size_t n = 0;
+
+        for (size_t i = 0; i < size; ++i) {
+                if (mnt[i] != NULL && !strempty(mnt[i]))
+                        ++n;
+        }
+        return (n);
+}
 
 static char **
-mount_files(struct error *err, const struct nvc_container *cnt, const char *dir, char *paths[], size_t size)
+mount_files(struct error *err, struct nvc_container *cnt, const char *dir, char *paths[], size_t size)
 {
         char path[PATH_MAX];
         mode_t mode;
@@ -44,7 +93,7 @@ mount_files(struct error *err, const struct nvc_container *cnt, const char *dir,
 
         if (path_resolve(err, path, cnt->cfg.rootfs, dir) < 0)
                 return (NULL);
-        if (file_create(err, path, NULL, cnt->uid, cnt->gid, MODE_DIR(0755)) < 0)
+        if (create_file(err, cnt, path, NULL, MODE_DIR(0755)) < 0)
                 return (NULL);
 
         end = path + strlen(path);
@@ -58,9 +107,16 @@ mount_files(struct error *err, const struct nvc_container *cnt, const char *dir,
                         continue;
                 if (path_append(err, path, file) < 0)
                         goto fail;
+                if (is_mounted(cnt, paths[i], path)) {
+                        log_infof("skipping %s already mounted at %s", paths[i], path);
+                        if ((*ptr++ = xstrdup(err, "")) == NULL)
+                                goto fail;
+                        *end = '\0';
+                        continue;
+                }
                 if (file_mode(err, paths[i], &mode) < 0)
                         goto fail;
-                if (file_create(err, path, NULL, cnt->uid, cnt->gid, mode) < 0)
+                if (create_file(err, cnt, path, NULL, mode) < 0)
                         goto fail;
 
                 log_infof("mounting %s at %s", paths[i], path);
@@ -82,7 +138,7 @@ mount_files(struct error *err, const struct nvc_container *cnt, const char *dir,
 }
 
 static char *
-mount_device(struct error *err, const struct nvc_container *cnt, const char *dev)
+mount_device(struct error *err, struct nvc_container *cnt, const char *dev)
 {
         char path[PATH_MAX];
         mode_t mode;
@@ -90,9 +146,13 @@ mount_device(struct error *err, const struct nvc_container *cnt, const char *dev
 
         if (path_resolve(err, path, cnt->cfg.rootfs, dev) < 0)
                 return (NULL);
+        if (is_mounted(cnt, dev, path)) {
+                log_infof("skipping %s already mounted at %s", dev, path);
+                return (xstrdup(err, ""));
+        }
         if (file_mode(err, dev, &mode) < 0)
                 return (NULL);
-        if (file_create(err, path, NULL, cnt->uid, cnt->gid, mode) < 0)
+        if (create_file(err, cnt, path, NULL, mode) < 0)
                 return (NULL);
 
         log_infof("mounting %s at %s", dev, path);
@@ -110,7 +170,7 @@ mount_device(struct error *err, const struct nvc_container *cnt, const char *dev
 }
 
 static char *
-mount_ipc(struct error *err, const struct nvc_container *cnt, const char *ipc)
+mount_ipc(struct error *err, struct nvc_container *cnt, const char *ipc)
 {
         char path[PATH_MAX];
         mode_t mode;
@@ -118,9 +178,13 @@ mount_ipc(struct error *err, const struct nvc_container *cnt, const char *ipc)
 
         if (path_resolve(err, path, cnt->cfg.rootfs, ipc) < 0)
                 return (NULL);
+        if (is_mounted(cnt, ipc, path)) {
+                log_infof("skipping %s already mounted at %s", ipc, path);
+                return (xstrdup(err, ""));
+        }
         if (file_mode(err, ipc, &mode) < 0)
                 return (NULL);
-        if (file_create(err, path, NULL, cnt->uid, cnt->gid, mode) < 0)
+        if (create_file(err, cnt, path, NULL, mode) < 0)
                 return (NULL);
 
         log_infof("mounting %s at %s", ipc, path);
@@ -138,14 +202,18 @@ mount_ipc(struct error *err, const struct nvc_container *cnt, const char *ipc)
 }
 
 static char *
-mount_app_profile(struct error *err, const struct nvc_container *cnt)
+mount_app_profile(struct error *err, struct nvc_container *cnt)
 {
         char path[PATH_MAX];
         char *mnt;
 
         if (path_resolve(err, path, cnt->cfg.rootfs, NV_APP_PROFILE_DIR) < 0)
                 return (NULL);
-        if (file_create(err, path, NULL, cnt->uid, cnt->gid, MODE_DIR(0555)) < 0)
+        if (is_mounted(cnt, NULL, path)) {
+                log_infof("skipping tmpfs already mounted at %s", path);
+                return (xstrdup(err, ""));
+        }
+        if (create_file(err, cnt, path, NULL, MODE_DIR(0555)) < 0)
                 goto fail;
 
         log_infof("mounting tmpfs at %s", path);
@@ -222,6 +290,10 @@ mount_procfs(struct error *err, const struct nvc_container *cnt)
 
         if (path_resolve(err, path, cnt->cfg.rootfs, NV_PROC_DRIVER) < 0)
                 return (NULL);
+        if (is_mounted(cnt, NULL, path)) {
+                log_infof("skipping tmpfs already mounted at %s", path);
+                return (xstrdup(err, ""));
+        }
         log_infof("mounting tmpfs at %s", path);
         if (xmount(err, "tmpfs", path, "tmpfs", 0, "mode=0555") < 0)
                 return (NULL);
@@ -276,6 +348,13 @@ mount_procfs_gpu(struct error *err, const struct nvc_container *cnt, const char
                 goto fail;
         if (path_resolve(err, path, cnt->cfg.rootfs, gpu) < 0)
                 goto fail;
+        if (is_mounted(cnt, gpu, path)) {
+                log_infof("skipping %s already mounted at %s", gpu, path);
+                *path = '\0';
+                mnt = xstrdup(err, "");
+                goto fail;
+        }
+        /* The entry lives in our procfs tmpfs which goes away with it, there is no need to record it. */
         if (file_create(err, path, NULL, cnt->uid, cnt->gid, mode) < 0)
                 goto fail;
 
@@ -300,22 +379,21 @@ unmount(const char *path)
         if (path == NULL || strempty(path))
                 return;
         umount2(path, MNT_DETACH);
-        file_remove(NULL, path);
 }
 
 static int
-setup_cgroup(struct error *err, const char *cgroup, dev_t id)
+setup_cgroup(struct error *err, const char *cgroup, dev_t id, bool allow)
 {
         char path[PATH_MAX];
         FILE *fs;
         int rv = -1;
 
-        if (path_join(err, path, cgroup, "devices.allow") < 0)
+        if (path_join(err, path, cgroup, allow ? "devices.allow" : "devices.deny") < 0)
                 return (-1);
         if ((fs = xfopen(err, path, "a")) == NULL)
                 return (-1);
 
-        log_infof("whitelisting device node %u:%u", major(id), minor(id));
+        log_infof("%s device node %u:%u", allow ? "whitelisting" : "blacklisting", major(id), minor(id));
         /* XXX dprintf doesn't seem to catch the write errors, flush the stream explicitly instead. */
         if (fprintf(fs, "c %u:%u rw", major(id), minor(id)) < 0 || fflush(fs) == EOF || ferror(fs)) {
                 error_set(err, "write error: %s", path);
@@ -328,8 +406,135 @@ setup_cgroup(struct error *err, const char *cgroup, dev_t id)
         return (rv);
 }
 
+/* Remember the mounts performed such that nvc_driver_unmount can undo them. */
+static int
+record_mounts(struct error *err, struct nvc_container *cnt, const char * const mnt[], size_t size)
+{
+        char **ptr;
+        size_t n;
+
+        if ((n = count_mounts(mnt, size)) == 0)
+                return (0);
+        if ((ptr = xrealloc(err, cnt->mnts, (cnt->nmnts + n) * sizeof(*ptr))) == NULL)
+                return (-1);
+        cnt->mnts = ptr;
+
+        for (size_t i = 0; i < size; ++i) {
+                if (mnt[i] == NULL || strempty(mnt[i]))
+                        continue;
+                if ((cnt->mnts[cnt->nmnts] = xstrdup(err, mnt[i])) == NULL)
+                        return (-1);
+                ++cnt->nmnts;
+                if (strset_add(err, &cnt->mounts, mnt[i]) < 0)
+                        return (-1);
+        }
+        return (0);
+}
+
+/*
+ * Create a file in the container unless it exists already, in which case it belongs to the container image.
+ * Otherwise the file (or its topmost ancestor we had to create) is remembered such that it can be removed later.
+ */
+static int
+create_file(struct error *err, struct nvc_container *cnt, const char *path, const char *data, mode_t mode)
+{
+        char top[PATH_MAX];
+        char **ptr, *p;
+        struct stat s;
+
+        if (lstat(path, &s) == 0)
+                return (file_create(err, path, data, cnt->uid, cnt->gid, mode));
+        if (xsnprintf(err, top, sizeof(top), "%s", path) < 0)
+                return (-1);
+        while ((p = strrchr(top, '/')) != NULL && p != top) {
+                *p = '\0';
+                if (lstat(top, &s) == 0) {
+                        *p = '/';
+                        break;
+                }
+        }
+
+        if ((ptr = xrealloc(err, cnt->files, (cnt->nfiles + 1) * sizeof(*ptr))) == NULL)
+                return (-1);
+        cnt->files = ptr;
+        if ((cnt->files[cnt->nfiles] = xstrdup(err, top)) == NULL)
+                return (-1);
+        if (file_create(err, path, data, cnt->uid, cnt->gid, mode) < 0) {
+                free(cnt->files[cnt->nfiles]);
+                return (-1);
+        }
+        ++cnt->nfiles;
+        return (0);
+}
+
+/* Remove the files created through this handle past the given count, most recent first. */
+static void
+remove_files(struct nvc_container *cnt, size_t n)
+{
+        for (; cnt->nfiles > n; --cnt->nfiles) {
+                log_infof("removing %s", cnt->files[cnt->nfiles - 1]);
+                file_remove(NULL, cnt->files[cnt->nfiles - 1]);
+                free(cnt->files[cnt->nfiles - 1]);
+        }
+}
+
+static int
+device_allowed(struct error *err, const char *cgroup, dev_t id, bool *allowed)
+{
+        char path[PATH_MAX];
+        char maj[16], min[16];
+        char type, major_s[16], minor_s[16], access[4];
+        FILE *fs;
+
+        *allowed = false;
+        if (path_join(err, path, cgroup, "devices.list") < 0)
+                return (-1);
+        if ((fs = xfopen(err, path, "r")) == NULL)
+                return (-1);
+
+        snprintf(maj, sizeof(maj), "%u", major(id));
+        snprintf(min, sizeof(min), "%u", minor(id));
+        while (!*allowed && fscanf(fs, " %c %15[^:]:%15s %3s", &type, major_s, minor_s, access) == 4) {
+                *allowed = (type == 'a' || type == 'c') &&
+                    (!strcmp(major_s, "*") || !strcmp(major_s, maj)) &&
+                    (!strcmp(minor_s, "*") || !strcmp(minor_s, min)) &&
+                    strchr(access, 'r') != NULL && strchr(access, 'w') != NULL;
+        }
+        fclose(fs);
+        return (0);
+}
+
+/*
+ * Whitelist a device node in the container cgroup, remembering it unless the container had access to it already
+ * (e.g. granted by the runtime), so that nvc_driver_unmount only revokes what we granted.
+ */
 static int
-symlink_library(struct error *err, const char *src, const char *target, const char *linkname, uid_t uid, gid_t gid)
+allow_device(struct error *err, struct nvc_container *cnt, dev_t id)
+{
+        dev_t *ptr;
+        bool allowed;
+
+        for (size_t i = 0; i < cnt->ndevs; ++i) {
+                if (cnt->devs[i] == id)
+                        return (0);
+        }
+        if (device_allowed(err, cnt->dev_cg, id, &allowed) < 0)
+                return (-1);
+        if (allowed) {
+                log_infof("device node %u:%u already whitelisted", major(id), minor(id));
+                return (0);
+        }
+        if (setup_cgroup(err, cnt->dev_cg, id, true) < 0)
+                return (-1);
+        if ((ptr = xrealloc(err, cnt->devs, (cnt->ndevs + 1) * sizeof(*ptr))) == NULL)
+                return (-1);
+        cnt->devs = ptr;
+        cnt->devs[cnt->ndevs++] = id;
+        return (0);
+}
+
+static int
+symlink_library(struct error *err, struct nvc_container *cnt, const char *src, const char *target, const char *linkname)
 {
         char path[PATH_MAX];
         char *tmp;
@@ -341,7 +546,7 @@ symlink_library(struct error *err, const char *src, const char *target, const ch
                 goto fail;
 
         log_infof("creating symlink %s -> %s", path, target);
-        if (file_create(err, path, target, uid, gid, MODE_LNK(0777)) < 0)
+        if (create_file(err, cnt, path, target, MODE_LNK(0777)) < 0)
                 goto fail;
         rv = 0;
 
@@ -351,7 +556,7 @@ symlink_library(struct error *err, const char *src, const char *target, const ch
 }
 
 static int
-symlink_libraries(struct error *err, const struct nvc_container *cnt, const char * const paths[], size_t size)
+symlink_libraries(struct error *err, struct nvc_container *cnt, const char * const paths[], size_t size)
 {
         char *lib;
 
@@ -359,11 +564,11 @@ symlink_libraries(struct error *err, const struct nvc_container *cnt, const char
                 lib = basename(paths[i]);
                 if (!strpcmp(lib, "libcuda.so")) {
                         /* XXX Many applications wrongly assume that libcuda.so exists (e.g. with dlopen). */
-                        if (symlink_library(err, paths[i], lib, "libcuda.so", cnt->uid, cnt->gid) < 0)
+                        if (symlink_library(err, cnt, paths[i], lib, "libcuda.so") < 0)
                                 return (-1);
                 } else if (!strpcmp(lib, "libGLX_nvidia.so")) {
                         /* XXX GLVND requires this symlink for indirect GLX support. */
-                        if (symlink_library(err, paths[i], lib, "libGLX_indirect.so.0", cnt->uid, cnt->gid) < 0)
+                        if (symlink_library(err, cnt, paths[i], lib, "libGLX_indirect.so.0") < 0)
                                 return (-1);
                 }
         }
@@ -371,10 +576,10 @@ symlink_libraries(struct error *err, const struct nvc_container *cnt, const char
 }
 
 int
-nvc_driver_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const struct nvc_driver_info *info)
+nvc_driver_mount(struct nvc_context *ctx, struct nvc_container *cnt, const struct nvc_driver_info *info)
 {
         const char **mnt, **ptr, **tmp;
-        size_t nmnt;
+        size_t nmnt, nfiles;
         int rv = -1;
 
         if (validate_context(ctx) < 0)
@@ -382,9 +587,10 @@ nvc_driver_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const
         if (validate_args(ctx, cnt != NULL && info != NULL) < 0)
                 return (-1);
 
-        if (nsenter(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
+        if (nsenterat(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
                 return (-1);
 
+        nfiles = cnt->nfiles;
         nmnt = 2 + info->nbins + info->nlibs + info->nlibs32 + info->nipcs + info->ndevs;
         mnt = ptr = (const char **)array_new(&ctx->err, nmnt);
         if (mnt == NULL)
@@ -409,12 +615,16 @@ nvc_driver_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const
                 if ((tmp = (const char **)mount_files(&ctx->err, cnt, cnt->cfg.libs_dir, info->libs, info->nlibs)) == NULL)
                         goto fail;
                 ptr = array_append(ptr, tmp, array_size(tmp));
+                ctx->stats.libs_selected += array_size(tmp);
+                ctx->stats.libs_skipped += info->nlibs - array_size(tmp);
                 free(tmp);
         }
         if ((cnt->flags & OPT_COMPAT32) && info->libs32 != NULL && info->nlibs32 > 0) {
                 if ((tmp = (const char **)mount_files(&ctx->err, cnt, cnt->cfg.libs32_dir, info->libs32, info->nlibs32)) == NULL)
                         goto fail;
                 ptr = array_append(ptr, tmp, array_size(tmp));
+                ctx->stats.libs_selected += array_size(tmp);
+                ctx->stats.libs_skipped += info->nlibs32 - array_size(tmp);
                 free(tmp);
         }
         if (symlink_libraries(&ctx->err, cnt, mnt, (size_t)(ptr - mnt)) < 0)
@@ -440,30 +650,85 @@ nvc_driver_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const
                                 goto fail;
                 }
                 if (!(cnt->flags & OPT_NO_CGROUPS)) {
-                        if (setup_cgroup(&ctx->err, cnt->dev_cg, info->devs[i].id) < 0)
+                        if (allow_device(&ctx->err, cnt, info->devs[i].id) < 0)
                                 goto fail;
                 }
         }
+        if (record_mounts(&ctx->err, cnt, mnt, (size_t)(ptr - mnt)) < 0)
+                goto fail;
+        ctx->stats.mounts += count_mounts(mnt, (size_t)(ptr - mnt));
         rv = 0;
 
  fail:
         if (rv < 0) {
                 for (size_t i = 0; mnt != NULL && i < nmnt; ++i)
                         unmount(mnt[i]);
+                remove_files(cnt, nfiles);
                 assert_func(nsenterat(NULL, ctx->mnt_ns, CLONE_NEWNS));
         } else {
                 rv = nsenterat(&ctx->err, ctx->mnt_ns, CLONE_NEWNS);
         }
 
         array_free((char **)mnt, nmnt);
+        log_flush();
         return (rv);
 }
 
+/*
+ * Undo the mounts and the device whitelisting performed through this container handle such that it can be
+ * configured again (e.g. with different devices). Mounts are detached in the reverse order they were made, then
+ * the files and links we created are removed and the devices the container could not access before are revoked.
+ */
 int
-nvc_device_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const struct nvc_device *dev)
+nvc_driver_unmount(struct nvc_context *ctx, struct nvc_container *cnt)
+{
+        const char *mnt;
+        int rv = -1;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, cnt != NULL) < 0)
+                return (-1);
+
+        if (nsenterat(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
+                return (-1);
+
+        for (; cnt->nmnts > 0; --cnt->nmnts) {
+                mnt = cnt->mnts[cnt->nmnts - 1];
+                log_infof("unmounting %s", mnt);
+                /* Mounts nested under a detached one (e.g. procfs) are already gone. */
+                if (umount2(mnt, MNT_DETACH) < 0 && errno != EINVAL && errno != ENOENT) {
+                        error_set(&ctx->err, "unmount failed: %s", mnt);
+                        goto fail;
+                }
+                strset_remove(&cnt->mounts, mnt);
+                free(cnt->mnts[cnt->nmnts - 1]);
+        }
+        /* Only what we created goes away, mount points and links which came with the image are left alone. */
+        remove_files(cnt, 0);
+        for (; cnt->ndevs > 0; --cnt->ndevs) {
+                if (setup_cgroup(&ctx->err, cnt->dev_cg, cnt->devs[cnt->ndevs - 1], false) < 0)
+                        goto fail;
+        }
+        rv = 0;
+
+ fail:
+        if (rv < 0)
+                assert_func(nsenterat(NULL, ctx->mnt_ns, CLONE_NEWNS));
+        else
+                rv = nsenterat(&ctx->err, ctx->mnt_ns, CLONE_NEWNS);
+        log_flush();
+        return (rv);
+}
+
+int
+nvc_device_mount(struct nvc_context *ctx, struct nvc_container *cnt, const struct nvc_device *dev)
 {
         char *dev_mnt = NULL;
         char *proc_mnt = NULL;
+        char *busid = NULL;
+        unsigned int idx, handle;
+        size_t nfiles;
         struct stat s;
         int rv = -1;
 
@@ -472,41 +737,58 @@ nvc_device_mount(struct nvc_context *ctx, const struct nvc_container *cnt, const
         if (validate_args(ctx, cnt != NULL && dev != NULL) < 0)
                 return (-1);
 
-        if (nsenter(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
-                return (-1);
+        /* The bus location might not have been queried yet (lazy device information). */
+        if (dev->busid == NULL) {
+                if (get_device_index(ctx, dev, &idx) < 0)
+                        return (-1);
+                if (driver_get_device(&ctx->drv, idx, &handle) < 0)
+                        return (-1);
+                if (driver_get_device_busid(&ctx->drv, handle, &busid) < 0)
+                        return (-1);
+        }
+
+        nfiles = cnt->nfiles;
+        if (nsenterat(&ctx->err, cnt->mnt_ns, CLONE_NEWNS) < 0)
+                goto fail;
 
         if (!(cnt->flags & OPT_NO_DEVBIND)) {
                 if (xstat(&ctx->err, dev->node.path, &s) < 0)
-                        return (-1);
+                        goto fail;
                 if (s.st_rdev != dev->node.id) {
                         error_setx(&ctx->err, "invalid device node: %s", dev->node.path);
-                        return (-1);
+                        goto fail;
                 }
                 if ((dev_mnt = mount_device(&ctx->err, cnt, dev->node.path)) == NULL)
                         goto fail;
         }
-        if ((proc_mnt = mount_procfs_gpu(&ctx->err, cnt, dev->busid)) == NULL)
+        if ((proc_mnt = mount_procfs_gpu(&ctx->err, cnt, (busid != NULL) ? busid : dev->busid)) == NULL)
                 goto fail;
         if (cnt->flags & OPT_GRAPHICS_LIBS) {
                 if (update_app_profile(&ctx->err, cnt, dev->node.id) < 0)
                         goto fail;
         }
         if (!(cnt->flags & OPT_NO_CGROUPS)) {
-                if (setup_cgroup(&ctx->err, cnt->dev_cg, dev->node.id) < 0)
+                if (allow_device(&ctx->err, cnt, dev->node.id) < 0)
                         goto fail;
         }
+        if (record_mounts(&ctx->err, cnt, (const char * const []){dev_mnt, proc_mnt}, 2) < 0)
+                goto fail;
+        ctx->stats.mounts += count_mounts((const char * const []){dev_mnt, proc_mnt}, 2);
         rv = 0;
 
  fail:
         if (rv < 0) {
                 unmount(proc_mnt);
                 unmount(dev_mnt);
+                remove_files(cnt, nfiles);
                 assert_func(nsenterat(NULL, ctx->mnt_ns, CLONE_NEWNS));
         } else {
                 rv = nsenterat(&ctx->err, ctx->mnt_ns, CLONE_NEWNS);
         }
 
+        free(busid);
         free(proc_mnt);
         free(dev_mnt);
+        log_flush();
         return (rv);
 }
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#include "driver_rpc.h"
+#pragma GCC diagnostic pop
+
+#include "nvc_internal.h"
+
+#include "driver.h"
+#include "error.h"
+#include "utils.h"
+#include "xfuncs.h"
+
+static_assert(NVC_STATS_BUCKETS == DRIVER_STATS_BUCKETS, "incompatible histograms");
+
+static int copy_entries(struct error *, struct nvc_stats_entry **, size_t *, const driver_stat *, u_int);
+static void free_entries(struct nvc_stats_entry *, size_t);
+
+static int
+copy_entries(struct error *err, struct nvc_stats_entry **entries, size_t *size, const driver_stat *stats, u_int len)
+{
+        if (len == 0)
+                return (0);
+        if ((*entries = xcalloc(err, len, sizeof(**entries))) == NULL)
+                return (-1);
+        *size = len;
+
+        for (size_t i = 0; i < len; ++i) {
+                if (((*entries)[i].name = xstrdup(err, stats[i].name)) == NULL)
+                        return (-1);
+                (*entries)[i].count = stats[i].count;
+                (*entries)[i].errors = stats[i].errors;
+                (*entries)[i].total_ns = stats[i].total;
+                memcpy((*entries)[i].buckets, stats[i].buckets, sizeof((*entries)[i].buckets));
+        }
+        return (0);
+}
+
+static void
+free_entries(struct nvc_stats_entry *entries, size_t size)
+{
+        if (entries == NULL)
+                return;
+        for (size_t i = 0; i < size; ++i)
+                free(entries[i].name);
+        free(entries);
+}
+
+struct nvc_stats *
+nvc_stats_new(struct nvc_context *ctx)
+{
+        struct nvc_stats *stats;
+        struct driver_stats drv = {0};
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+
+        log_info("requesting driver statistics");
+        if ((stats = xcalloc(&ctx->err, 1, sizeof(*stats))) == NULL)
+                return (NULL);
+        if (driver_get_stats(&ctx->drv, &drv) < 0)
+                goto fail;
+
+        if (copy_entries(&ctx->err, &stats->rpcs, &stats->nrpcs, drv.rpcs.rpcs_val, drv.rpcs.rpcs_len) < 0)
+                goto fail;
+        if (copy_entries(&ctx->err, &stats->procs, &stats->nprocs, drv.procs.procs_val, drv.procs.procs_len) < 0)
+                goto fail;
+        if (copy_entries(&ctx->err, &stats->calls, &stats->ncalls, drv.calls.calls_val, drv.calls.calls_len) < 0)
+                goto fail;
+        driver_free_stats(&drv);
+
+        stats->mounts = ctx->stats.mounts;
+        stats->libs_selected = ctx->stats.libs_selected;
+        stats->libs_skipped = ctx->stats.libs_skipped;
+        stats->ldconfig_ns = ctx->stats.ldconfig_ns;
+        return (stats);
+
+ fail:
+        driver_free_stats(&drv);
+        nvc_stats_free(stats);
+        return (NULL);
+}
+
+void
+nvc_stats_free(struct nvc_stats *stats)
+{
+        if (stats == NULL)
+                return;
+        free_entries(stats->rpcs, stats->nrpcs);
+        free_entries(stats->procs, stats->nprocs);
+        free_entries(stats->calls, stats->ncalls);
+        free(stats);
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/inotify.h>
+
+#include <errno.h>
+#include <libgen.h>
+#undef basename /* Use the GNU version of basename. */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvc_internal.h"
+
+#include "error.h"
+#include "utils.h"
+#include "xfuncs.h"
+
+#define WATCH_DIR_EVENTS (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF)
+
+struct nvc_watch {
+        int fd;
+        struct watch_entry {
+                int wd;
+                char *prefix; /* Only consider entries starting with this prefix if not NULL. */
+                int stale;
+        } *entries;
+        size_t nentries;
+        char version[256];
+};
+
+static int add_watch(struct error *, struct nvc_watch *, const char *, const char *, int);
+static int add_parent_watch(struct error *, struct nvc_watch *, const char *, int);
+static int read_version(char *, size_t);
+
+static int
+add_watch(struct error *err, struct nvc_watch *w, const char *dir, const char *prefix, int stale)
+{
+        struct watch_entry *ptr;
+        int wd;
+
+        /* Directories watched more than once share their descriptor, accumulate their events. */
+        if ((wd = inotify_add_watch(w->fd, dir, WATCH_DIR_EVENTS|IN_ONLYDIR|IN_MASK_ADD)) < 0) {
+                if (errno == ENOENT || errno == ENOTDIR || errno == EACCES) {
+                        log_warnf("not watching %s: %s", dir, strerror(errno));
+                        return (0);
+                }
+                error_set(err, "inotify watch failed: %s", dir);
+                return (-1);
+        }
+        for (size_t i = 0; i < w->nentries; ++i) {
+                ptr = &w->entries[i];
+                if (ptr->wd == wd && ((ptr->prefix == NULL && prefix == NULL) ||
+                    (ptr->prefix != NULL && prefix != NULL && !strcmp(ptr->prefix, prefix)))) {
+                        ptr->stale |= stale;
+                        return (0);
+                }
+        }
+
+        if ((ptr = xrealloc(err, w->entries, (w->nentries + 1) * sizeof(*ptr))) == NULL)
+                return (-1);
+        w->entries = ptr;
+        ptr = &w->entries[w->nentries];
+        *ptr = (struct watch_entry){wd, NULL, stale};
+        if (prefix != NULL && (ptr->prefix = xstrdup(err, prefix)) == NULL)
+                return (-1);
+        ++w->nentries;
+
+        log_infof("watching %s%s%s", dir, (prefix != NULL) ? " for " : "", (prefix != NULL) ? prefix : "");
+        return (0);
+}
+
+static int
+add_parent_watch(struct error *err, struct nvc_watch *w, const char *path, int stale)
+{
+        char dir[PATH_MAX];
+
+        if (xsnprintf(err, dir, sizeof(dir), "%s", path) < 0)
+                return (-1);
+        return (add_watch(err, w, dirname(dir), NULL, stale));
+}
+
+static int
+read_version(char *buf, size_t size)
+{
+        *buf = '\0';
+        return (file_read_line(NULL, NV_PROC_DRIVER "/version", buf, size));
+}
+
+/*
+ * Watch everything the driver and device information depend upon (i.e. the DSO cache, the directories holding
+ * the driver components, the PATH directories and the device nodes). Callers are expected to poll on the
+ * descriptor returned by nvc_watch_fd and call nvc_watch_read to find out which information needs recomputing.
+ */
+struct nvc_watch *
+nvc_watch_new(struct nvc_context *ctx, const struct nvc_driver_info *drv)
+{
+        struct nvc_watch *w;
+        const char *dir;
+        char *env = NULL, *ptr;
+        char path[PATH_MAX];
+
+        if (validate_context(ctx) < 0)
+                return (NULL);
+        if (validate_args(ctx, drv != NULL) < 0)
+                return (NULL);
+
+        log_info("setting up driver watches");
+        if ((w = xcalloc(&ctx->err, 1, sizeof(*w))) == NULL)
+                return (NULL);
+        if ((w->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
+                error_set(&ctx->err, "inotify initialization failed");
+                free(w);
+                return (NULL);
+        }
+
+        /* The DSO cache is replaced atomically by ldconfig, watch its directory for its name. */
+        if (xsnprintf(&ctx->err, path, sizeof(path), "%s", ctx->cfg.ldcache) < 0)
+                goto fail;
+        if (add_watch(&ctx->err, w, dirname(path), basename(ctx->cfg.ldcache), NVC_WATCH_DRIVER) < 0)
+                goto fail;
+
+        for (size_t i = 0; i < drv->nlibs; ++i) {
+                if (add_parent_watch(&ctx->err, w, drv->libs[i], NVC_WATCH_DRIVER) < 0)
+                        goto fail;
+        }
+        for (size_t i = 0; i < drv->nlibs32; ++i) {
+                if (add_parent_watch(&ctx->err, w, drv->libs32[i], NVC_WATCH_DRIVER) < 0)
+                        goto fail;
+        }
+        for (size_t i = 0; i < drv->nbins; ++i) {
+                if (add_parent_watch(&ctx->err, w, drv->bins[i], NVC_WATCH_DRIVER) < 0)
+                        goto fail;
+        }
+
+        /* Binaries are looked up through PATH, any of its directories could provide a missing one. */
+        if ((ptr = secure_getenv("PATH")) != NULL) {
+                if ((env = ptr = xstrdup(&ctx->err, ptr)) == NULL)
+                        goto fail;
+                while ((dir = strsep(&ptr, ":")) != NULL) {
+                        if (*dir != '\0' && add_watch(&ctx->err, w, dir, NULL, NVC_WATCH_DRIVER) < 0)
+                                goto fail;
+                }
+        }
+
+        if (add_watch(&ctx->err, w, _PATH_DEV, "nvidia", NVC_WATCH_DRIVER|NVC_WATCH_DEVICE) < 0)
+                goto fail;
+
+        /* Procfs doesn't report changes through inotify, the driver version is compared on every read instead. */
+        read_version(w->version, sizeof(w->version));
+        free(env);
+        return (w);
+
+ fail:
+        free(env);
+        nvc_watch_free(w);
+        return (NULL);
+}
+
+void
+nvc_watch_free(struct nvc_watch *w)
+{
+        if (w == NULL)
+                return;
+        for (size_t i = 0; i < w->nentries; ++i)
+                free(w->entries[i].prefix);
+        free(w->entries);
+        xclose(w->fd);
+        free(w);
+}
+
+int
+nvc_watch_fd(const struct nvc_watch *w)
+{
+        return ((w != NULL) ? w->fd : -1);
+}
+
+/*
+ * Consume the pending events without blocking.
+ * Returns a mask of NVC_WATCH_* flags telling which information is stale, or -1 on error.
+ */
+int
+nvc_watch_read(struct nvc_context *ctx, struct nvc_watch *w)
+{
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        const struct inotify_event *ev;
+        char version[sizeof(w->version)];
+        int stale = 0;
+        ssize_t n;
+
+        if (validate_context(ctx) < 0)
+                return (-1);
+        if (validate_args(ctx, w != NULL) < 0)
+                return (-1);
+
+        for (;;) {
+                if ((n = read(w->fd, buf, sizeof(buf))) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                break;
+                        error_set(&ctx->err, "inotify read failed");
+                        return (-1);
+                }
+                for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+                        ev = (const struct inotify_event *)p;
+                        /* Events were lost or a watched directory went away, assume the worst. */
+                        if (ev->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF)) {
+                                stale |= NVC_WATCH_DRIVER|NVC_WATCH_DEVICE;
+                                continue;
+                        }
+                        for (size_t i = 0; i < w->nentries; ++i) {
+                                if (w->entries[i].wd != ev->wd)
+                                        continue;
+                                if (w->entries[i].prefix != NULL &&
+                                    (ev->len == 0 || strpcmp(ev->name, w->entries[i].prefix)))
+                                        continue;
+                                stale |= w->entries[i].stale;
+                        }
+                }
+        }
+
+        read_version(version, sizeof(version));
+        if (strcmp(version, w->version)) {
+                strcpy(w->version, version);
+                stale |= NVC_WATCH_DRIVER|NVC_WATCH_DEVICE;
+        }
+        if (stale != 0)
+                log_infof("driver watch reported stale information (driver=%d, device=%d)",
+                    !!(stale & NVC_WATCH_DRIVER), !!(stale & NVC_WATCH_DEVICE));
+        return (stale);
+}
@@ -2,6 +2,7 @@
  * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,34 +12,125 @@
 #include "options.h"
 #include "xfuncs.h"
 
+#define OPTION_SEED_MAX 4096
+
+static uint32_t hash_option(uint32_t, const char *, size_t);
+static const struct option *lookup_option(const struct option_table *, const char *, size_t);
+static bool build_table(struct option_table *);
+static void build_tables(void);
+
+struct option_table library_opts = {library_opts_list, nitems(library_opts_list), 0, {0}, 0};
+struct option_table driver_opts = {driver_opts_list, nitems(driver_opts_list), 0, {0}, 0};
+struct option_table device_opts = {device_opts_list, nitems(device_opts_list), 0, {0}, 0};
+struct option_table container_opts = {container_opts_list, nitems(container_opts_list), 0, {0}, 0};
+
+static bool tables_built;
+
+/* FNV-1a with the high bits folded in since only the low bits select the slot. */
+static uint32_t
+hash_option(uint32_t seed, const char *str, size_t len)
+{
+        uint32_t h = 2166136261u ^ seed;
+
+        for (size_t i = 0; i < len; ++i) {
+                h ^= (uint8_t)str[i];
+                h *= 16777619u;
+        }
+        return (h ^ (h >> 16));
+}
+
+static const struct option *
+lookup_option(const struct option_table *table, const char *str, size_t len)
+{
+        const struct option *opt;
+        uint8_t slot;
+
+        slot = table->slots[hash_option(table->seed, str, len) & (table->nslots - 1)];
+        if (slot == 0)
+                return (NULL);
+        opt = &table->opts[slot - 1];
+        if (strncmp(opt->name, str, len) || opt->name[len] != '\0')
+                return (NULL);
+        return (opt);
+}
+
 int32_t
-options_parse(struct error *err, const char *str, const struct option *opts, size_t nopts)
+options_parse(struct error *err, const char *str, const struct option_table *table)
 {
-        char buf[NVC_ARG_MAX];
-        char *ptr = buf;
+        const struct option *opt;
         int32_t flags = 0;
-        char *opt;
-        size_t i;
+        size_t len;
 
-        if (strlen(str) >= sizeof(buf)) {
-                error_setx(err, "too many options");
-                return (-1);
+        for (;;) {
+                str += strspn(str, " ");
+                if ((len = strcspn(str, " ")) == 0)
+                        break;
+                if ((opt = lookup_option(table, str, len)) == NULL) {
+                        error_setx(err, "invalid option: %.*s", (int)len, str);
+                        return (-1);
+                }
+                flags |= opt->value;
+                str += len;
         }
-        strcpy(buf, str);
+        return (flags);
+}
+
+int32_t
+options_mask(const struct option_table *table)
+{
+        int32_t mask = 0;
+
+        for (size_t i = 0; i < table->nopts; ++i)
+                mask |= table->opts[i].value;
+        return (mask);
+}
+
+/* Find the smallest table and the first seed for which every option hashes to its own slot. */
+static bool
+build_table(struct option_table *table)
+{
+        const char *name;
+        uint8_t *slot;
+        size_t i;
 
-        while ((opt = strsep(&ptr, " ")) != NULL) {
-                if (*opt == '\0')
+        for (size_t n = 1; n <= OPTION_SLOTS_MAX; n *= 2) {
+                if (n < table->nopts)
                         continue;
-                for (i = 0; i < nopts; ++i) {
-                        if (!strcmp(opt, opts[i].name)) {
-                                flags |= opts[i].value;
-                                break;
+                for (uint32_t seed = 0; seed < OPTION_SEED_MAX; ++seed) {
+                        memset(table->slots, 0, sizeof(table->slots));
+                        for (i = 0; i < table->nopts; ++i) {
+                                name = table->opts[i].name;
+                                slot = &table->slots[hash_option(seed, name, strlen(name)) & (n - 1)];
+                                if (*slot != 0)
+                                        break;
+                                *slot = (uint8_t)(i + 1);
+                        }
+                        if (i == table->nopts) {
+                                table->seed = seed;
+                                table->nslots = n;
+                                return (true);
                         }
-                }
-                if (i == nopts) {
-                        error_setx(err, "invalid option: %s", opt);
-                        return (-1);
                 }
         }
-        return (flags);
+        return (false);
+}
+
+static void
+build_tables(void)
+{
+        tables_built = build_table(&library_opts) && build_table(&driver_opts) &&
+            build_table(&device_opts) && build_table(&container_opts);
+}
+
+/* Build the option tables on first use, this must be called before parsing any option. */
+int
+options_init(struct error *err)
+{
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+        if (pthread_once(&once, build_tables) != 0 || !tables_built) {
+                error_setx(err, "option tables initialization failed");
+                return (-1);
+        }
+        return (0);
 }
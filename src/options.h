@@ -5,8 +5,11 @@
 #ifndef HEADER_OPTIONS_H
 #define HEADER_OPTIONS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "nvc.h"
+
 #include "error.h"
 
 struct option {
@@ -14,72 +17,106 @@ struct option {
         int32_t value;
 };
 
+#define OPTION_SLOTS_MAX 64
+
+/*
+ * Options are looked up through a perfect hash: every option name hashes with the table seed to its own slot,
+ * which holds the index of the option plus one (zero if empty). The tables are built by options_init.
+ */
+struct option_table {
+        const struct option *opts;
+        size_t nopts;
+        uint32_t seed;
+        uint8_t slots[OPTION_SLOTS_MAX];
+        size_t nslots; /* Power of two. */
+};
+
 /* Library options */
 enum {
-        OPT_LOAD_KMODS = 1 << 0,
+        OPT_LOAD_KMODS = NVC_INIT_LOAD_KMODS,
 };
 
-static const struct option library_opts[] = {
+static const struct option library_opts_list[] = {
         {"load-kmods", OPT_LOAD_KMODS},
 };
 
+extern struct option_table library_opts;
+
 static const char * const default_library_opts = "";
 
 /* Driver options */
 enum {
-        OPT_NO_GLVND        = 1 << 0,
-        OPT_NO_UVM          = 1 << 1,
-        OPT_NO_MPS          = 1 << 2,
-        OPT_NO_PERSISTENCED = 1 << 3,
+        OPT_NO_GLVND        = NVC_DRIVER_NO_GLVND,
+        OPT_NO_UVM          = NVC_DRIVER_NO_UVM,
+        OPT_NO_MPS          = NVC_DRIVER_NO_MPS,
+        OPT_NO_PERSISTENCED = NVC_DRIVER_NO_PERSISTENCED,
 };
 
-static const struct option driver_opts[] = {
+static const struct option driver_opts_list[] = {
         {"no-glvnd", OPT_NO_GLVND},
         {"no-uvm", OPT_NO_UVM},
         {"no-mps", OPT_NO_MPS},
         {"no-persistenced", OPT_NO_PERSISTENCED},
 };
 
+extern struct option_table driver_opts;
+
 static const char * const default_driver_opts = "";
 
 /* Device options */
-static const struct option device_opts[] = {};
+enum {
+        OPT_NO_MODEL    = NVC_DEVICE_NO_MODEL,
+        OPT_NO_UUID     = NVC_DEVICE_NO_UUID,
+        OPT_NO_BUSID    = NVC_DEVICE_NO_BUSID,
+        OPT_NO_ARCH     = NVC_DEVICE_NO_ARCH,
+        OPT_LAZY_DEVICE = NVC_DEVICE_LAZY,
+};
+
+static const struct option device_opts_list[] = {
+        {"no-model", OPT_NO_MODEL},
+        {"no-uuid", OPT_NO_UUID},
+        {"no-busid", OPT_NO_BUSID},
+        {"no-arch", OPT_NO_ARCH},
+        {"lazy", OPT_LAZY_DEVICE},
+};
+
+extern struct option_table device_opts;
 
 static const char * const default_device_opts = "";
 
 /* Container options */
 enum {
-        OPT_SUPERVISED    = 1 << 0,
-        OPT_STANDALONE    = 1 << 1,
-        OPT_NO_CGROUPS    = 1 << 2,
-        OPT_NO_DEVBIND    = 1 << 3,
-        OPT_UTILITY_LIBS  = 1 << 4,
-        OPT_COMPUTE_LIBS  = 1 << 5,
-        OPT_VIDEO_LIBS    = 1 << 6,
-        OPT_GRAPHICS_LIBS = 1 << 7,
-        OPT_UTILITY_BINS  = 1 << 8,
-        OPT_COMPUTE_BINS  = 1 << 9,
-#if defined(__powerpc64__) /* ppc64le doesn't support compat32. */
-        OPT_COMPAT32      = 1 << 0,
-#else
-        OPT_COMPAT32      = 1 << 10,
-#endif /* defined(__powerpc64__) */
+        OPT_SUPERVISED    = NVC_CONTAINER_SUPERVISED,
+        OPT_STANDALONE    = NVC_CONTAINER_STANDALONE,
+        OPT_NO_CGROUPS    = NVC_CONTAINER_NO_CGROUPS,
+        OPT_NO_DEVBIND    = NVC_CONTAINER_NO_DEVBIND,
+        OPT_UTILITY_LIBS  = NVC_CONTAINER_UTILITY_LIBS,
+        OPT_COMPUTE_LIBS  = NVC_CONTAINER_COMPUTE_LIBS,
+        OPT_VIDEO_LIBS    = NVC_CONTAINER_VIDEO_LIBS,
+        OPT_GRAPHICS_LIBS = NVC_CONTAINER_GRAPHICS_LIBS,
+        OPT_UTILITY_BINS  = NVC_CONTAINER_UTILITY_BINS,
+        OPT_COMPUTE_BINS  = NVC_CONTAINER_COMPUTE_BINS,
+        OPT_COMPAT32      = NVC_CONTAINER_COMPAT32,
 };
 
-static const struct option container_opts[] = {
+static const struct option container_opts_list[] = {
         {"supervised", OPT_SUPERVISED},
         {"standalone", OPT_STANDALONE},
         {"no-cgroups", OPT_NO_CGROUPS},
         {"no-devbind", OPT_NO_DEVBIND},
-        {"utility", OPT_UTILITY_BINS|OPT_UTILITY_LIBS},
-        {"compute", OPT_COMPUTE_BINS|OPT_COMPUTE_LIBS},
-        {"video", OPT_VIDEO_LIBS|OPT_COMPUTE_LIBS},
-        {"graphics", OPT_GRAPHICS_LIBS},
+        {"utility", NVC_CONTAINER_UTILITY},
+        {"compute", NVC_CONTAINER_COMPUTE},
+        {"video", NVC_CONTAINER_VIDEO},
+        {"graphics", NVC_CONTAINER_GRAPHICS},
         {"compat32", OPT_COMPAT32},
 };
 
+extern struct option_table container_opts;
+
 static const char * const default_container_opts = "standalone no-cgroups no-devbind utility";
 
-int32_t options_parse(struct error *, const char *, const struct option *, size_t);
+int     options_init(struct error *);
+int32_t options_parse(struct error *, const char *, const struct option_table *);
+int32_t options_mask(const struct option_table *);
 
 #endif /* HEADER_OPTIONS_H */
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2017-2018, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef HEADER_SHA256_H
+#define HEADER_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+struct sha256 {
+        uint32_t state[8];
+        uint64_t length;
+        uint8_t block[64];
+        size_t used;
+};
+
+void sha256_init(struct sha256 *);
+void sha256_update(struct sha256 *, const void *, size_t);
+void sha256_final(struct sha256 *, uint8_t [SHA256_SIZE]);
+
+#endif /* HEADER_SHA256_H */
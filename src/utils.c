@@ -3,6 +3,7 @@
  */
 
 #include <sys/fsuid.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/prctl.h>
@@ -20,8 +21,11 @@
 #include <libgen.h>
 #undef basename /* Use the GNU version of basename. */
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <sched.h>
+#include <stdalign.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,9 +47,86 @@ static int set_fsugid(uid_t, gid_t);
 static int make_ancestors(char *, mode_t);
 static int do_file_remove(const char *, const struct stat *, int, struct FTW *);
 static int openrel(struct error *, int, const char *);
+static int log_format(char *, size_t, char, const struct timeval *, const char *, unsigned long, const char *, va_list)
+    __attribute__((format(printf, 7, 0)));
+static void log_drain(void);
+static void log_exit(void);
+static const char *log_parse_spec(const char *, struct log_spec *);
+static int64_t log_arg_int(enum log_length, bool, va_list *);
+static bool log_pack(char *, size_t, size_t *, const void *, size_t);
+static size_t log_pack_args(char *, size_t, const char *, int, va_list);
+static void log_write_session(void);
+static void log_write_binary(char, const char *, unsigned long, int, const char *, va_list);
+static uint32_t log_site_id(const char *, unsigned long);
+static void log_render(FILE *, const char *, const char *, size_t);
+static int log_capture(struct error *, int, size_t);
+static size_t strset_hash(const char *);
+
+#define LOG_BUFSIZE 65536
+#define ARENA_CHUNK_SIZE 4096
+
+struct arena_chunk {
+        struct arena_chunk *next;
+        size_t size;
+        size_t used;
+        max_align_t data[];
+};
+
+/*
+ * Binary log format, a session record followed by site and event records.
+ * Site records map a call site ID (FNV-1a hash of "file:line") to its file, line and format, and are emitted on
+ * first use. Event records hold the raw arguments of a log call, these get formatted by log_decode.
+ */
+#define LOG_SESSION_MAGIC "NVCLOG\x00\x01"
+#define LOG_PAYLOAD_MAX   8192
+#define LOG_SITES_MAX     1024
+
+enum {
+        LOG_RECORD_SESSION = 1,
+        LOG_RECORD_SITE,
+        LOG_RECORD_EVENT,
+};
+
+struct log_record {
+        uint16_t type;
+        uint16_t size; /* Size of the payload following the record. */
+        uint32_t site;
+        uint64_t time; /* CLOCK_MONOTONIC in nanoseconds. */
+        uint32_t tid;
+        char level;
+        char pad[3];
+};
+
+static_assert(sizeof(struct log_record) == 24, "invalid log record size");
 
 static FILE *logfile;
 
+/*
+ * Log lines are accumulated in a per-process buffer and written out in large chunks, either when the buffer fills up,
+ * on errors, or explicitly through log_flush (e.g. at the end of each library call, before creating a process or
+ * exiting). The buffer is shared by all threads and guarded by a lock, forking drains it such that children don't
+ * inherit pending lines (see log_fork_prepare).
+ * The timestamp prefix is cached as well as the ID of each thread, log_flush resets them so that children recompute
+ * their own.
+ */
+static __thread long logtid;
+
+static struct {
+        pthread_mutex_t lock;
+        char buf[LOG_BUFSIZE];
+        size_t len;
+        time_t sec;
+        char date[16];
+        pid_t pid;
+        bool binary;
+        bool splice;
+        struct {
+                const char *file;
+                unsigned long line;
+                uint32_t id;
+        } sites[LOG_SITES_MAX];
+} logbuf = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
 bool
 log_active(void)
 {
@@ -53,15 +134,34 @@ log_active(void)
 }
 
 void
-log_open(const char *path)
+log_open(const char *path, bool binary)
 {
+        static bool registered = false;
+        static bool forkable = false;
+
         if (path == NULL || log_active())
                 return;
         logfile = fopen(path, "ae");
         assert(logfile != NULL);
         if (log_active()) {
+                struct stat s;
+
                 setbuf(logfile, NULL);
-                fprintf(logfile, "\n-- WARNING, the following logs are for debugging purposes only --\n\n");
+                /*
+                 * The log is shared by concurrent invocations and relies on O_APPEND, which splice(2) rejects.
+                 * Process output can only be spliced when logging to a pipe.
+                 */
+                logbuf.splice = (fstat(fileno(logfile), &s) == 0 && S_ISFIFO(s.st_mode));
+                logbuf.pid = getpid();
+                logbuf.binary = binary;
+                if (binary)
+                        log_write_session();
+                else
+                        fprintf(logfile, "\n-- WARNING, the following logs are for debugging purposes only --\n\n");
+                if (!registered)
+                        registered = (atexit(log_exit) == 0);
+                if (!forkable)
+                        forkable = (pthread_atfork(log_fork_prepare, log_fork_parent, log_fork_child) == 0);
         }
 }
 
@@ -70,63 +170,721 @@ log_close(void)
 {
         if (!log_active())
                 return;
+        log_flush();
+        pthread_mutex_lock(&logbuf.lock);
         fclose(logfile);
         logfile = NULL;
+        pthread_mutex_unlock(&logbuf.lock);
+}
+
+static void
+log_drain(void)
+{
+        ssize_t n;
+        size_t off = 0;
+
+        while (off < logbuf.len) {
+                if ((n = write(fileno(logfile), logbuf.buf + off, logbuf.len - off)) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        break;
+                }
+                off += (size_t)n;
+        }
+        logbuf.len = 0;
+}
+
+void
+log_flush(void)
+{
+        if (!log_active())
+                return;
+        pthread_mutex_lock(&logbuf.lock);
+        log_drain();
+        logbuf.sec = 0;
+        logtid = 0;
+        pthread_mutex_unlock(&logbuf.lock);
+}
+
+/*
+ * Hold the log across process creation, pending lines are written out first so that the child starts with an empty
+ * buffer. These are registered with pthread_atfork and need to be called explicitly around raw clone syscalls.
+ */
+void
+log_fork_prepare(void)
+{
+        pthread_mutex_lock(&logbuf.lock);
+        if (log_active())
+                log_drain();
+}
+
+void
+log_fork_parent(void)
+{
+        pthread_mutex_unlock(&logbuf.lock);
+}
+
+void
+log_fork_child(void)
+{
+        logbuf.len = 0;
+        logbuf.sec = 0;
+        logtid = 0;
+        pthread_mutex_init(&logbuf.lock, NULL);
+}
+
+static void
+log_exit(void)
+{
+        /* Only flush from the process which opened the log, children inherit our handlers across fork. */
+        if (getpid() == logbuf.pid)
+                log_close();
+}
+
+static int
+log_format(char *buf, size_t size, char level, const struct timeval *tv, const char *file, unsigned long line,
+    const char *fmt, va_list ap)
+{
+        int n, m;
+
+        n = snprintf(buf, size, "%c%s.%06ld %ld %s:%lu] ", level, logbuf.date, (long)tv->tv_usec, logtid,
+            basename(file), line);
+        if (n < 0)
+                return (-1);
+        m = vsnprintf(buf + MIN((size_t)n, size), size - MIN((size_t)n, size), fmt, ap);
+        if (m < 0)
+                return (-1);
+        if ((size_t)n + (size_t)m < size)
+                buf[n + m] = '\n';
+        return (n + m + 1);
 }
 
 void
 log_write(char level, const char *file, unsigned long line, const char *fmt, ...)
 {
         struct timeval tv = {0};
-        struct tm *tm;
-        char buf[16];
+        struct tm tm;
         va_list ap;
+        int errnum = errno;
+        int n;
 
         if (!log_active())
                 return;
-        if (gettimeofday(&tv, NULL) < 0 || (tm = gmtime(&tv.tv_sec)) == NULL ||
-            strftime(buf, sizeof(buf), "%m%d %T", tm) == 0)
-                strcpy(buf, "0000 00:00:00");
+        if (logtid == 0)
+                logtid = (long)syscall(SYS_gettid);
+
+        pthread_mutex_lock(&logbuf.lock);
+        if (logbuf.binary) {
+                va_start(ap, fmt);
+                log_write_binary(level, file, line, errnum, fmt, ap);
+                va_end(ap);
+                goto done;
+        }
+        if (gettimeofday(&tv, NULL) < 0)
+                tv = (struct timeval){0};
+        if (tv.tv_sec != logbuf.sec || logbuf.sec == 0) {
+                if (gmtime_r(&tv.tv_sec, &tm) == NULL || strftime(logbuf.date, sizeof(logbuf.date), "%m%d %T", &tm) == 0)
+                        strcpy(logbuf.date, "0000 00:00:00");
+                logbuf.sec = tv.tv_sec;
+        }
 
-        fprintf(logfile, "%c%s.%06ld %ld %s:%lu] ", level, buf, tv.tv_usec, (long)syscall(SYS_gettid), basename(file), line);
         va_start(ap, fmt);
-        vfprintf(logfile, fmt, ap);
+        n = log_format(logbuf.buf + logbuf.len, sizeof(logbuf.buf) - logbuf.len, level, &tv, file, line, fmt, ap);
         va_end(ap);
-        fputc('\n', logfile);
+        if (n >= 0 && (size_t)n > sizeof(logbuf.buf) - logbuf.len) {
+                log_drain();
+                va_start(ap, fmt);
+                n = log_format(logbuf.buf, sizeof(logbuf.buf), level, &tv, file, line, fmt, ap);
+                va_end(ap);
+                /* Truncate lines which don't fit in the buffer. */
+                if (n >= 0 && (size_t)n > sizeof(logbuf.buf)) {
+                        n = (int)sizeof(logbuf.buf);
+                        logbuf.buf[n - 1] = '\n';
+                }
+        }
+        if (n >= 0)
+                logbuf.len += (size_t)n;
+        if (n >= 0 && level == 'E')
+                log_drain();
+ done:
+        pthread_mutex_unlock(&logbuf.lock);
+}
+
+static const char *
+log_parse_spec(const char *p, struct log_spec *spec)
+{
+        *spec = (struct log_spec){.flags = p, .prec = -1};
+
+        p += strspn(p, "-+ #0'");
+        if (*p == '*') {
+                spec->width_arg = true;
+                ++p;
+        } else {
+                p += strspn(p, "0123456789");
+        }
+        if (*p == '.') {
+                if (*++p == '*') {
+                        spec->prec_arg = true;
+                        ++p;
+                } else {
+                        spec->prec = (int)strtol(p, NULL, 10);
+                        p += strspn(p, "0123456789");
+                }
+        }
+        spec->nflags = (size_t)(p - spec->flags);
+
+        if (!strncmp(p, "hh", 2) || !strncmp(p, "ll", 2)) {
+                spec->length = (*p == 'h') ? LEN_HH : LEN_LL;
+                p += 2;
+        } else {
+                switch (*p) {
+                case 'h': spec->length = LEN_H; break;
+                case 'l': spec->length = LEN_L; break;
+                case 'q': spec->length = LEN_LL; break;
+                case 'j': spec->length = LEN_J; break;
+                case 'z': spec->length = LEN_Z; break;
+                case 't': spec->length = LEN_T; break;
+                case 'L': spec->length = LEN_LD; break;
+                }
+                if (spec->length != LEN_NONE)
+                        ++p;
+        }
+        spec->conv = *p;
+        return ((*p != '\0') ? p + 1 : p);
+}
+
+static int64_t
+log_arg_int(enum log_length length, bool sign, va_list *ap)
+{
+        switch (length) {
+        case LEN_HH:
+                return (sign ? (signed char)va_arg(*ap, int) : (unsigned char)va_arg(*ap, unsigned int));
+        case LEN_H:
+                return (sign ? (short)va_arg(*ap, int) : (unsigned short)va_arg(*ap, unsigned int));
+        case LEN_L:
+                return (sign ? va_arg(*ap, long) : (int64_t)va_arg(*ap, unsigned long));
+        case LEN_LL:
+                return (sign ? va_arg(*ap, long long) : (int64_t)va_arg(*ap, unsigned long long));
+        case LEN_J:
+                return (sign ? va_arg(*ap, intmax_t) : (int64_t)va_arg(*ap, uintmax_t));
+        case LEN_Z:
+                return (sign ? va_arg(*ap, ssize_t) : (int64_t)va_arg(*ap, size_t));
+        case LEN_T:
+                return (va_arg(*ap, ptrdiff_t));
+        default:
+                return (sign ? va_arg(*ap, int) : (int64_t)va_arg(*ap, unsigned int));
+        }
+}
+
+static bool
+log_pack(char *buf, size_t size, size_t *off, const void *data, size_t len)
+{
+        if (size - *off < len)
+                return (false);
+        memcpy(buf + *off, data, len);
+        *off += len;
+        return (true);
+}
+
+/*
+ * Pack the arguments of a log call according to its format, integers and pointers as int64, floating points as
+ * double and strings as a uint16 length followed by their (possibly truncated) content.
+ */
+static size_t
+log_pack_args(char *buf, size_t size, const char *fmt, int errnum, va_list ap)
+{
+        struct log_spec spec;
+        const char *str;
+        int64_t v;
+        double d;
+        uint16_t len;
+        size_t off = 0;
+        va_list aq;
+
+        va_copy(aq, ap);
+        for (const char *p = fmt; (p = strchr(p, '%')) != NULL;) {
+                p = log_parse_spec(p + 1, &spec);
+                if (spec.conv == '%')
+                        continue;
+                if (spec.width_arg && !log_pack(buf, size, &off, &(int64_t){va_arg(aq, int)}, sizeof(int64_t)))
+                        break;
+                if (spec.prec_arg) {
+                        spec.prec = va_arg(aq, int);
+                        if (!log_pack(buf, size, &off, &(int64_t){spec.prec}, sizeof(int64_t)))
+                                break;
+                }
+
+                switch (spec.conv) {
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                        v = log_arg_int(spec.length, spec.conv == 'd' || spec.conv == 'i', &aq);
+                        if (!log_pack(buf, size, &off, &v, sizeof(v)))
+                                goto done;
+                        break;
+                case 'c':
+                        v = va_arg(aq, int);
+                        if (!log_pack(buf, size, &off, &v, sizeof(v)))
+                                goto done;
+                        break;
+                case 'p':
+                        v = (int64_t)(uintptr_t)va_arg(aq, void *);
+                        if (!log_pack(buf, size, &off, &v, sizeof(v)))
+                                goto done;
+                        break;
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A':
+                        d = (spec.length == LEN_LD) ? (double)va_arg(aq, long double) : va_arg(aq, double);
+                        if (!log_pack(buf, size, &off, &d, sizeof(d)))
+                                goto done;
+                        break;
+                case 's':
+                case 'm':
+                        str = (spec.conv == 's') ? va_arg(aq, const char *) : strerror(errnum);
+                        if (str == NULL)
+                                str = "(null)";
+                        if (size - off < sizeof(len))
+                                goto done;
+                        /* Strings need not be NUL terminated if a precision is given. */
+                        len = (uint16_t)MIN(strnlen(str, (spec.prec >= 0) ? (size_t)spec.prec : SIZE_MAX),
+                            size - off - sizeof(len));
+                        log_pack(buf, size, &off, &len, sizeof(len));
+                        log_pack(buf, size, &off, str, len);
+                        break;
+                default:
+                        goto done;
+                }
+        }
+ done:
+        va_end(aq);
+        return (off);
+}
+
+static uint32_t
+log_site_id(const char *file, unsigned long line)
+{
+        char buf[32];
+        uint32_t h = 2166136261u;
+
+        snprintf(buf, sizeof(buf), ":%lu", line);
+        for (const char *p = file; *p != '\0'; ++p)
+                h = (h ^ (uint8_t)*p) * 16777619u;
+        for (const char *p = buf; *p != '\0'; ++p)
+                h = (h ^ (uint8_t)*p) * 16777619u;
+        return (h);
+}
+
+static void
+log_write_session(void)
+{
+        struct timespec mono = {0}, real = {0};
+        struct log_record rec = {.type = LOG_RECORD_SESSION, .size = sizeof(LOG_SESSION_MAGIC) - 1 + sizeof(uint64_t)};
+        uint64_t ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_REALTIME, &real);
+        rec.time = (uint64_t)mono.tv_sec * 1000000000 + (uint64_t)mono.tv_nsec;
+        ts = (uint64_t)real.tv_sec * 1000000000 + (uint64_t)real.tv_nsec;
+
+        if (sizeof(logbuf.buf) - logbuf.len < sizeof(rec) + rec.size)
+                log_drain();
+        memcpy(logbuf.buf + logbuf.len, &rec, sizeof(rec));
+        memcpy(logbuf.buf + logbuf.len + sizeof(rec), LOG_SESSION_MAGIC, sizeof(LOG_SESSION_MAGIC) - 1);
+        memcpy(logbuf.buf + logbuf.len + sizeof(rec) + sizeof(LOG_SESSION_MAGIC) - 1, &ts, sizeof(ts));
+        logbuf.len += sizeof(rec) + rec.size;
+        log_drain();
+}
+
+static void
+log_write_binary(char level, const char *file, unsigned long line, int errnum, const char *fmt, va_list ap)
+{
+        struct timespec mono = {0};
+        struct log_record rec = {.level = level};
+        size_t slot, flen, len;
+        uint32_t site = 0, u32;
+        bool emit = true;
+
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+
+        /* Call sites are keyed on the address of their file name which is a string literal. */
+        slot = (((uintptr_t)file >> 3) ^ line) % LOG_SITES_MAX;
+        for (size_t i = 0; i < LOG_SITES_MAX; ++i, slot = (slot + 1) % LOG_SITES_MAX) {
+                if (logbuf.sites[slot].file == file && logbuf.sites[slot].line == line) {
+                        site = logbuf.sites[slot].id;
+                        emit = false;
+                        break;
+                }
+                if (logbuf.sites[slot].file == NULL) {
+                        site = log_site_id(file, line);
+                        logbuf.sites[slot].file = file;
+                        logbuf.sites[slot].line = line;
+                        logbuf.sites[slot].id = site;
+                        break;
+                }
+        }
+        if (site == 0)
+                site = log_site_id(file, line);
+
+        if (emit) {
+                flen = strlen(file) + 1;
+                len = MIN(sizeof(u32) + flen + strlen(fmt) + 1, LOG_PAYLOAD_MAX);
+                if (sizeof(logbuf.buf) - logbuf.len < sizeof(rec) + len)
+                        log_drain();
+                rec.type = LOG_RECORD_SITE;
+                rec.size = (uint16_t)len;
+                rec.site = site;
+                u32 = (uint32_t)line;
+                memcpy(logbuf.buf + logbuf.len, &rec, sizeof(rec));
+                memcpy(logbuf.buf + logbuf.len + sizeof(rec), &u32, sizeof(u32));
+                memcpy(logbuf.buf + logbuf.len + sizeof(rec) + sizeof(u32), file, MIN(flen, len - sizeof(u32)));
+                if (len > sizeof(u32) + flen)
+                        memcpy(logbuf.buf + logbuf.len + sizeof(rec) + sizeof(u32) + flen, fmt, len - sizeof(u32) - flen);
+                logbuf.buf[logbuf.len + sizeof(rec) + len - 1] = '\0';
+                logbuf.len += sizeof(rec) + len;
+        }
+
+        if (sizeof(logbuf.buf) - logbuf.len < sizeof(rec) + LOG_PAYLOAD_MAX)
+                log_drain();
+        rec.type = LOG_RECORD_EVENT;
+        rec.site = site;
+        rec.time = (uint64_t)mono.tv_sec * 1000000000 + (uint64_t)mono.tv_nsec;
+        rec.tid = (uint32_t)logtid;
+        rec.size = (uint16_t)log_pack_args(logbuf.buf + logbuf.len + sizeof(rec), LOG_PAYLOAD_MAX, fmt, errnum, ap);
+        memcpy(logbuf.buf + logbuf.len, &rec, sizeof(rec));
+        logbuf.len += sizeof(rec) + rec.size;
+        if (level == 'E')
+                log_drain();
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void
+log_render(FILE *out, const char *fmt, const char *args, size_t size)
+{
+        struct log_spec spec;
+        char buf[32];
+        const char *p, *q;
+        size_t off = 0;
+        int64_t star[2], v;
+        int nstar;
+        double d;
+        uint16_t len;
+
+#define unpack(ptr, n) ((size - off >= (n)) ? (memcpy(ptr, args + off, n), off += (n), true) : false)
+#define render(...) __extension__ ({                                                           \
+        if (nstar == 0)                                                                        \
+                fprintf(out, buf, __VA_ARGS__);                                                \
+        else if (nstar == 1)                                                                   \
+                fprintf(out, buf, (int)star[0], __VA_ARGS__);                                  \
+        else                                                                                   \
+                fprintf(out, buf, (int)star[0], (int)star[1], __VA_ARGS__);                    \
+})
+
+        for (p = fmt; (q = strchr(p, '%')) != NULL; p = log_parse_spec(q + 1, &spec)) {
+                fwrite(p, 1, (size_t)(q - p), out);
+                log_parse_spec(q + 1, &spec);
+                if (spec.conv == '%') {
+                        fputc('%', out);
+                        continue;
+                }
+                nstar = 0;
+                if ((spec.width_arg && !unpack(&star[nstar++], sizeof(*star))) ||
+                    (spec.prec_arg && !unpack(&star[nstar++], sizeof(*star)))) {
+                        fputs("<?>", out);
+                        continue;
+                }
+                if (spec.nflags > sizeof(buf) - 5)
+                        spec.nflags = sizeof(buf) - 5;
+
+                switch (spec.conv) {
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                case 'c':
+                case 'p':
+                        if (!unpack(&v, sizeof(v)))
+                                goto missing;
+                        if (spec.conv == 'c' || spec.conv == 'p') {
+                                snprintf(buf, sizeof(buf), "%%%.*s%c", (int)spec.nflags, spec.flags, spec.conv);
+                                if (spec.conv == 'c')
+                                        render((int)v);
+                                else
+                                        render((void *)(uintptr_t)v);
+                        } else {
+                                snprintf(buf, sizeof(buf), "%%%.*sll%c", (int)spec.nflags, spec.flags, spec.conv);
+                                render((long long)v);
+                        }
+                        break;
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'F':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A':
+                        if (!unpack(&d, sizeof(d)))
+                                goto missing;
+                        snprintf(buf, sizeof(buf), "%%%.*s%c", (int)spec.nflags, spec.flags, spec.conv);
+                        render(d);
+                        break;
+                case 's':
+                case 'm':
+                        if (!unpack(&len, sizeof(len)) || size - off < len)
+                                goto missing;
+                        /* Strings aren't NUL terminated, bound them with the precision if there is none already. */
+                        if (spec.prec_arg || memchr(spec.flags, '.', spec.nflags) != NULL) {
+                                snprintf(buf, sizeof(buf), "%%%.*ss", (int)spec.nflags, spec.flags);
+                                char *str = strndup(args + off, len);
+                                if (str != NULL)
+                                        render(str);
+                                free(str);
+                        } else {
+                                snprintf(buf, sizeof(buf), "%%%.*s.*s", (int)spec.nflags, spec.flags);
+                                star[nstar++] = len;
+                                render(args + off);
+                        }
+                        off += len;
+                        break;
+                default:
+                        fputs(q, out);
+                        return;
+                }
+                continue;
+ missing:
+                fputs("<?>", out);
+        }
+        fputs(p, out);
+
+#undef render
+#undef unpack
 }
+#pragma GCC diagnostic pop
 
 int
-log_pipe_output(struct error *err, int fd[2])
+log_decode(struct error *err, FILE *in, FILE *out)
 {
-        FILE *fs;
-        ssize_t n;
-        char *buf = NULL;
-        size_t len = 0;
-        int rv = 0;
+        struct log_record rec;
+        struct {
+                uint32_t id;
+                unsigned long line;
+                char *file;
+                char *fmt;
+        } *sites = NULL, *site, *ptr;
+        size_t nsites = 0;
+        char *payload = NULL;
+        uint64_t mono = 0, real = 0, ts;
+        uint32_t u32;
+        struct tm tm;
+        time_t sec;
+        char date[16];
+        char *file, *fmt;
+        int rv = -1;
+
+        if ((payload = xcalloc(err, 1, UINT16_MAX + 1)) == NULL)
+                return (-1);
+
+        while (fread(&rec, sizeof(rec), 1, in) == 1) {
+                if (fread(payload, 1, rec.size, in) != rec.size) {
+                        error_setx(err, "truncated log record");
+                        goto fail;
+                }
+                payload[rec.size] = '\0';
+
+                switch (rec.type) {
+                case LOG_RECORD_SESSION:
+                        if (rec.size < sizeof(LOG_SESSION_MAGIC) - 1 + sizeof(real) ||
+                            memcmp(payload, LOG_SESSION_MAGIC, sizeof(LOG_SESSION_MAGIC) - 1)) {
+                                error_setx(err, "invalid log session");
+                                goto fail;
+                        }
+                        memcpy(&real, payload + sizeof(LOG_SESSION_MAGIC) - 1, sizeof(real));
+                        mono = rec.time;
+                        break;
+                case LOG_RECORD_SITE:
+                        if (rec.size < sizeof(u32)) {
+                                error_setx(err, "invalid log site");
+                                goto fail;
+                        }
+                        memcpy(&u32, payload, sizeof(u32));
+                        file = payload + sizeof(u32);
+                        fmt = file + strlen(file);
+                        fmt += (fmt < payload + rec.size) ? 1 : 0;
+                        for (site = sites; site != NULL && site < sites + nsites; ++site) {
+                                if (site->id == rec.site)
+                                        break;
+                        }
+                        if (site != NULL && site < sites + nsites)
+                                break;
+                        if ((ptr = realloc(sites, (nsites + 1) * sizeof(*sites))) == NULL) {
+                                error_set(err, "memory allocation failed");
+                                goto fail;
+                        }
+                        sites = ptr;
+                        site = &sites[nsites++];
+                        *site = (__typeof__(*site)){rec.site, u32, NULL, NULL};
+                        if ((site->file = xstrdup(err, file)) == NULL || (site->fmt = xstrdup(err, fmt)) == NULL)
+                                goto fail;
+                        break;
+                case LOG_RECORD_EVENT:
+                        for (site = sites; site != NULL && site < sites + nsites; ++site) {
+                                if (site->id == rec.site)
+                                        break;
+                        }
+                        ts = real + (rec.time - mono);
+                        sec = (time_t)(ts / 1000000000);
+                        if (gmtime_r(&sec, &tm) == NULL || strftime(date, sizeof(date), "%m%d %T", &tm) == 0)
+                                strcpy(date, "0000 00:00:00");
+                        if (site == NULL || site >= sites + nsites) {
+                                fprintf(out, "%c%s.%06ld %"PRIu32" <unknown site %08"PRIx32">\n", rec.level, date,
+                                    (long)(ts % 1000000000 / 1000), rec.tid, rec.site);
+                                break;
+                        }
+                        fprintf(out, "%c%s.%06ld %"PRIu32" %s:%lu] ", rec.level, date, (long)(ts % 1000000000 / 1000),
+                            rec.tid, basename(site->file), site->line);
+                        log_render(out, site->fmt, payload, rec.size);
+                        fputc('\n', out);
+                        break;
+                default:
+                        error_setx(err, "invalid log record type: %"PRIu16, rec.type);
+                        goto fail;
+                }
+        }
+        if (ferror(in)) {
+                error_setx(err, "log read error");
+                goto fail;
+        }
+        if (!feof(in)) {
+                error_setx(err, "truncated log record");
+                goto fail;
+        }
+        rv = 0;
+
+ fail:
+        for (size_t i = 0; i < nsites; ++i) {
+                free(sites[i].file);
+                free(sites[i].fmt);
+        }
+        free(sites);
+        free(payload);
+        return (rv);
+}
+
+/*
+ * Move the output of a child process into the log, each chunk is prefixed with a header and spliced straight into
+ * the log file when the kernel allows it (i.e. the log isn't a file opened in append mode), otherwise it is read
+ * directly into the log buffer. If wait is false, only the output currently available is consumed.
+ * Returns 1 once the child closed its end of the pipe, 0 otherwise.
+ */
+int
+log_pipe_output(struct error *err, int fd, bool wait)
+{
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int avail;
+        int rv;
 
         if (!log_active())
+                return (1);
+
+        for (;;) {
+                if ((rv = poll(&pfd, 1, wait ? -1 : 0)) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        error_set(err, "poll failed");
+                        return (-1);
+                }
+                if (rv == 0)
+                        return (0);
+                if (ioctl(fd, FIONREAD, &avail) < 0) {
+                        error_set(err, "ioctl failed");
+                        return (-1);
+                }
+                if (avail == 0)
+                        return (1);
+                if (log_capture(err, fd, (size_t)avail) < 0)
+                        return (-1);
+        }
+}
+
+static int
+log_capture(struct error *err, int fd, size_t len)
+{
+        char *ptr, *eol;
+        char last = '\n';
+        ssize_t n;
+
+        if (logbuf.binary) {
+                /* Binary logs hold records only, log the output line by line. */
+                char buf[PIPE_BUF];
+
+                while (len > 0) {
+                        if ((n = read(fd, buf, MIN(len, sizeof(buf)))) <= 0) {
+                                if (n < 0 && errno == EINTR)
+                                        continue;
+                                error_set(err, "process output capture failed");
+                                return (-1);
+                        }
+                        len -= (size_t)n;
+                        for (ptr = buf; ptr < buf + n; ptr = eol + 1) {
+                                if ((eol = memchr(ptr, '\n', (size_t)(buf + n - ptr))) == NULL)
+                                        eol = buf + n;
+                                if (eol > ptr)
+                                        log_warnf("%.*s", (int)(eol - ptr), ptr);
+                        }
+                }
                 return (0);
-        if (fd[1] >= 0) {
-                close(fd[1]);
-                fd[1] = -1;
         }
-        if ((fs = fdopen(fd[0], "r")) == NULL) {
-                error_set(err, "open failed");
-                return (-1);
+
+        log_warnf("captured %zu bytes of process output:", len);
+        pthread_mutex_lock(&logbuf.lock);
+        log_drain();
+        /* Leave the last byte out of the splice so that we can tell whether the output needs a newline. */
+        while (len > 1 && logbuf.splice) {
+                if ((n = splice(fd, NULL, fileno(logfile), NULL, len - 1, SPLICE_F_MOVE)) <= 0) {
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n < 0 && errno == EINVAL) {
+                                logbuf.splice = false;
+                                break;
+                        }
+                        goto fail;
+                }
+                len -= (size_t)n;
         }
-        while ((n = getline(&buf, &len, fs)) >= 0) {
-                if (n > 0) {
-                        buf[n - 1] = '\0';
-                        log_warnf("%s", buf);
+        while (len > 0) {
+                if ((n = read(fd, logbuf.buf + logbuf.len, MIN(len, sizeof(logbuf.buf) - logbuf.len))) <= 0) {
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        goto fail;
                 }
+                len -= (size_t)n;
+                logbuf.len += (size_t)n;
+                last = logbuf.buf[logbuf.len - 1];
+                log_drain();
         }
-        if (ferror(fs)) {
-                error_set(err, "read error");
-                rv = -1;
+        if (last != '\n') {
+                logbuf.buf[logbuf.len++] = '\n';
+                log_drain();
         }
-        free(buf);
-        fclose(fs);
-        return (rv);
+        pthread_mutex_unlock(&logbuf.lock);
+        return (0);
+
+ fail:
+        pthread_mutex_unlock(&logbuf.lock);
+        error_set(err, "process output capture failed");
+        return (-1);
 }
 
 void
@@ -292,25 +1050,6 @@ nsenterat(struct error *err, int fd, int nstype)
         return (0);
 }
 
-int
-nsenter(struct error *err, const char *path, int nstype)
-{
-        int fd;
-        int rv = -1;
-
-        if ((fd = xopen(err, path, O_RDONLY)) < 0)
-                return (-1);
-        if (setns(fd, nstype) < 0) {
-                error_set(err, "namespace association failed: %s", path);
-                goto fail;
-        }
-        rv = 0;
-
- fail:
-        close(fd);
-        return (rv);
-}
-
 char **
 array_new(struct error *err, size_t size)
 {
@@ -355,6 +1094,159 @@ array_pack(char *arr[], size_t *size)
         }
 }
 
+/*
+ * Bump allocator backed by a list of chunks, allocations are zeroed and released all at once by arena_free.
+ * Requests larger than a chunk get a chunk of their own.
+ */
+void *
+arena_alloc(struct error *err, struct arena *arena, size_t size)
+{
+        struct arena_chunk *chunk = arena->chunks;
+        void *ptr;
+
+        size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+        if (chunk == NULL || chunk->size - chunk->used < size) {
+                if ((chunk = xcalloc(err, 1, sizeof(*chunk) + MAX(size, ARENA_CHUNK_SIZE))) == NULL)
+                        return (NULL);
+                chunk->size = MAX(size, ARENA_CHUNK_SIZE);
+                /* Keep the current chunk at the head if it has more room left than the new one. */
+                if (arena->chunks != NULL && chunk->size - size < arena->chunks->size - arena->chunks->used) {
+                        chunk->next = arena->chunks->next;
+                        arena->chunks->next = chunk;
+                } else {
+                        chunk->next = arena->chunks;
+                        arena->chunks = chunk;
+                }
+        }
+        ptr = (char *)chunk->data + chunk->used;
+        chunk->used += size;
+        return (ptr);
+}
+
+char *
+arena_strdup(struct error *err, struct arena *arena, const char *str)
+{
+        char *ptr;
+        size_t len;
+
+        len = strlen(str) + 1;
+        if ((ptr = arena_alloc(err, arena, len)) == NULL)
+                return (NULL);
+        return (memcpy(ptr, str, len));
+}
+
+bool
+arena_owns(const struct arena *arena, const void *ptr)
+{
+        for (const struct arena_chunk *c = arena->chunks; c != NULL; c = c->next) {
+                if ((const char *)ptr >= (const char *)c->data && (const char *)ptr < (const char *)c->data + c->size)
+                        return (true);
+        }
+        return (false);
+}
+
+void
+arena_free(struct arena *arena)
+{
+        struct arena_chunk *next;
+
+        for (struct arena_chunk *c = arena->chunks; c != NULL; c = next) {
+                next = c->next;
+                free(c);
+        }
+        arena->chunks = NULL;
+}
+
+static size_t
+strset_hash(const char *str)
+{
+        size_t h = 2166136261u;
+
+        for (const char *p = str; *p != '\0'; ++p)
+                h = (h ^ (uint8_t)*p) * 16777619u;
+        return (h);
+}
+
+/* Open addressing string set, the table is kept at most half full. */
+int
+strset_add(struct error *err, struct strset *set, const char *str)
+{
+        struct strset tmp;
+        size_t i;
+
+        if (set->count + 1 > set->size / 2) {
+                tmp = (struct strset){NULL, MAX(set->size * 2, 64), 0};
+                if ((tmp.slots = xcalloc(err, tmp.size, sizeof(*tmp.slots))) == NULL)
+                        return (-1);
+                for (size_t j = 0; j < set->size; ++j) {
+                        if (set->slots[j] == NULL)
+                                continue;
+                        for (i = strset_hash(set->slots[j]) % tmp.size; tmp.slots[i] != NULL; i = (i + 1) % tmp.size);
+                        tmp.slots[i] = set->slots[j];
+                        ++tmp.count;
+                }
+                free(set->slots);
+                *set = tmp;
+        }
+        for (i = strset_hash(str) % set->size; set->slots[i] != NULL; i = (i + 1) % set->size) {
+                if (!strcmp(set->slots[i], str))
+                        return (0);
+        }
+        if ((set->slots[i] = xstrdup(err, str)) == NULL)
+                return (-1);
+        ++set->count;
+        return (0);
+}
+
+bool
+strset_contains(const struct strset *set, const char *str)
+{
+        if (set->size == 0)
+                return (false);
+        for (size_t i = strset_hash(str) % set->size; set->slots[i] != NULL; i = (i + 1) % set->size) {
+                if (!strcmp(set->slots[i], str))
+                        return (true);
+        }
+        return (false);
+}
+
+void
+strset_remove(struct strset *set, const char *str)
+{
+        size_t i, j, k;
+
+        if (set->size == 0)
+                return;
+        for (i = strset_hash(str) % set->size; set->slots[i] != NULL; i = (i + 1) % set->size) {
+                if (!strcmp(set->slots[i], str))
+                        break;
+        }
+        if (set->slots[i] == NULL)
+                return;
+        free(set->slots[i]);
+        set->slots[i] = NULL;
+        --set->count;
+
+        /* Shift back the entries of the probe sequence which would otherwise become unreachable. */
+        for (j = (i + 1) % set->size; set->slots[j] != NULL; j = (j + 1) % set->size) {
+                k = strset_hash(set->slots[j]) % set->size;
+                if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+                        set->slots[i] = set->slots[j];
+                        set->slots[j] = NULL;
+                        i = j;
+                }
+        }
+}
+
+void
+strset_free(struct strset *set)
+{
+        for (size_t i = 0; i < set->size; ++i)
+                free(set->slots[i]);
+        free(set->slots);
+        *set = (struct strset){0};
+}
+
 size_t
 array_size(const char * const arr[])
 {
@@ -567,6 +1459,59 @@ do_file_remove(const char *path, const struct stat *s, int flag, maybe_unused st
         return (0);
 }
 
+/*
+ * Atomically replace the content of a regular file, the data is written to a temporary file next to it first.
+ * The file is created with the given UID/GID in the same way as file_create.
+ */
+int
+file_replace(struct error *err, const char *path, const void *data, size_t size, uid_t uid, gid_t gid, mode_t mode)
+{
+        char tmp[PATH_MAX];
+        uid_t euid;
+        gid_t egid;
+        const char *ptr = data;
+        ssize_t n;
+        int fd = -1;
+        int rv = -1;
+
+        if (xsnprintf(err, tmp, sizeof(tmp), "%s~", path) < 0)
+                return (-1);
+
+        euid = geteuid();
+        egid = getegid();
+        if (set_fsugid(uid, gid) < 0)
+                goto fail;
+
+        if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0777 & ~get_umask() & mode)) < 0)
+                goto fail;
+        while (size > 0) {
+                if ((n = write(fd, ptr, size)) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        goto fail;
+                }
+                ptr += n;
+                size -= (size_t)n;
+        }
+        if (close(fd) < 0) {
+                fd = -1;
+                goto fail;
+        }
+        fd = -1;
+        if (rename(tmp, path) < 0)
+                goto fail;
+        rv = 0;
+
+ fail:
+        if (rv < 0) {
+                error_set(err, "file creation failed: %s", path);
+                xclose(fd);
+                unlink(tmp);
+        }
+        assert_func(set_fsugid(euid, egid));
+        return (rv);
+}
+
 int
 file_remove(struct error *err, const char *path)
 {
@@ -630,8 +1575,10 @@ file_read_text(struct error *err, const char *path, char **txt)
 
         if ((fs = xfopen(err, path, "r")) == NULL)
                 return (-1);
-        *txt = NULL;
-        while ((n = fread(buf, 1, sizeof(buf), fs)) > 0) {
+        /* Empty files yield an empty string, such that callers can always parse the result. */
+        if ((*txt = xstrdup(err, "")) == NULL)
+                goto fail;
+        while ((n = fread(buf, 1, sizeof(buf) - 1, fs)) > 0) {
                 buf[n] = '\0';
                 if (strjoin(err, txt, buf, "") < 0)
                         goto fail;
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include "error.h"
 
@@ -20,6 +21,7 @@
 #define quote_str(...) #__VA_ARGS__
 #define nitems(x) (sizeof(x) / sizeof(*x))
 #define maybe_unused __attribute__((unused))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
 #define assert_func(fn) do {      \
         maybe_unused int r_ = fn; \
         assert(r_ == 0);          \
@@ -29,12 +31,49 @@
 #define MODE_REG(mode) ((mode) | S_IFREG)
 #define MODE_LNK(mode) ((mode) | S_IFLNK)
 
+struct arena {
+        struct arena_chunk *chunks;
+};
+
+struct strset {
+        char **slots;
+        size_t size;
+        size_t count;
+};
+
+enum log_length {
+        LEN_NONE,
+        LEN_HH,
+        LEN_H,
+        LEN_L,
+        LEN_LL,
+        LEN_J,
+        LEN_Z,
+        LEN_T,
+        LEN_LD,
+};
+
+struct log_spec {
+        const char *flags; /* Flags, width and precision as written. */
+        size_t nflags;
+        bool width_arg;
+        bool prec_arg;
+        int prec; /* Precision if given, -1 otherwise. */
+        enum log_length length;
+        char conv;
+};
+
 bool log_active(void);
-void log_open(const char *);
+void log_open(const char *, bool);
 void log_close(void);
+void log_flush(void);
+void log_fork_prepare(void);
+void log_fork_parent(void);
+void log_fork_child(void);
 void log_write(char, const char *, unsigned long, const char *, ...)
     __attribute__((format(printf, 4, 5), nonnull(4)));
-int  log_pipe_output(struct error *, int[2]);
+int  log_pipe_output(struct error *, int, bool);
+int  log_decode(struct error *, FILE *, FILE *);
 
 #define log_info(msg) log_write('I', __FILE__, __LINE__, msg)
 #define log_warn(msg) log_write('W', __FILE__, __LINE__, msg)
@@ -53,7 +92,6 @@ int  strtougid(struct error *, char *, uid_t *, gid_t *);
 int  strjoin(struct error *, char **, const char *, const char *);
 
 int nsenterat(struct error *, int, int);
-int nsenter(struct error *, const char *, int);
 
 char **array_new(struct error *, size_t);
 void array_free(char *[], size_t);
@@ -61,9 +99,20 @@ void array_pack(char *[], size_t *);
 size_t array_size(const char * const []);
 const char **array_append(const char **, const char * const [], size_t);
 
+void *arena_alloc(struct error *, struct arena *, size_t);
+char *arena_strdup(struct error *, struct arena *, const char *);
+bool arena_owns(const struct arena *, const void *);
+void arena_free(struct arena *);
+
+int  strset_add(struct error *, struct strset *, const char *);
+bool strset_contains(const struct strset *, const char *);
+void strset_remove(struct strset *, const char *);
+void strset_free(struct strset *);
+
 void *file_map(struct error *, const char *, size_t *);
 int  file_unmap(struct error *, const char *, void *, size_t);
 int  file_create(struct error *, const char *, const char *, uid_t, gid_t, mode_t);
+int  file_replace(struct error *, const char *, const void *, size_t, uid_t, gid_t, mode_t);
 int  file_remove(struct error *, const char *);
 int  file_exists(struct error *, const char *);
 int  file_mode(struct error *, const char *, mode_t *);
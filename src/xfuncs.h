@@ -18,7 +18,9 @@
 
 static inline void xclose(int);
 static inline int  xopen(struct error *, const char *, int);
+static inline int  xopenat(struct error *, int, const char *, int);
 static inline void *xcalloc(struct error *, size_t, size_t);
+static inline void *xrealloc(struct error *, void *, size_t);
 static inline int  xstat(struct error *, const char *, struct stat *);
 static inline FILE *xfopen(struct error *, const char *, const char *);
 static inline char *xstrdup(struct error *, const char *);
@@ -52,6 +54,16 @@ xopen(struct error *err, const char *path, int flags)
         return (rv);
 }
 
+static inline int
+xopenat(struct error *err, int dirfd, const char *path, int flags)
+{
+        int rv;
+
+        if ((rv = openat(dirfd, path, flags)) < 0)
+                error_set(err, "open failed: %s", path);
+        return (rv);
+}
+
 static inline void *
 xcalloc(struct error *err, size_t nmemb, size_t size)
 {
@@ -62,6 +74,16 @@ xcalloc(struct error *err, size_t nmemb, size_t size)
         return (p);
 }
 
+static inline void *
+xrealloc(struct error *err, void *ptr, size_t size)
+{
+        void *p;
+
+        if ((p = realloc(ptr, size)) == NULL)
+                error_set(err, "memory allocation failed");
+        return (p);
+}
+
 static inline int
 xstat(struct error *err, const char *path, struct stat *buf)
 {